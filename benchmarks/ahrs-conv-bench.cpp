@@ -0,0 +1,194 @@
+/**
+ * Benchmark of the AHRS400 angle mode conversions.
+ *
+ * Converts synthetic raw angle mode packets to SI units one message at a
+ * time, like the reader does, and with the batch functions, to messages
+ * and to columns, from raw messages and from packet payloads. Reports the
+ * speed of each in millions of messages per second, after checking the
+ * results against a double-precision reference.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "devices/ahrs400/convert.h"
+
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+/** Number of messages converted per round. */
+const size_t kCount = 1 << 14;
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+/** Scaled values of the message fields, in payload order. */
+vector<double> Fields(const mavlink_ahrs400_angle_t &angle) {
+  return {angle.roll, angle.pitch, angle.yaw, angle.xgyro, angle.ygyro,
+          angle.zgyro, angle.xacc, angle.yacc, angle.zacc, angle.xmag,
+          angle.ymag, angle.zmag, angle.temperature};
+}
+
+/** Previous per-message conversion, in double precision. */
+vector<double> Reference(const mavlink_ahrs400_angle_raw_t &raw) {
+  const double gyro = 1.5 * 200 * M_PI / 180 / 32768.0;
+  const double accel = 1.5 * 4 * 9.8 / 32768.0;
+  const double mag = 1.5 * 1.25e-4 / 32768.0;
+  return {raw.roll * M_PI / 32768.0, raw.pitch * M_PI / 32768.0,
+          raw.yaw * M_PI / 32768.0, raw.xgyro * gyro, raw.ygyro * gyro,
+          raw.zgyro * gyro, raw.xacc * accel, raw.yacc * accel,
+          raw.zacc * accel, raw.xmag * mag, raw.ymag * mag, raw.zmag * mag,
+          ((raw.temperature * 5 / 4096.0) - 1.375) * 44.44};
+}
+
+/** Previous per-message conversion, to messages. */
+__attribute__((noinline))
+void ReferenceConv(const mavlink_ahrs400_angle_raw_t *raw,
+                   mavlink_ahrs400_angle_t *scaled) {
+  const double gyro_range = 200 * M_PI / 180;
+  scaled->time_usec = raw->time_usec;
+  scaled->xacc = raw->xacc * 1.5 * 4 * 9.8 / 32768.0;
+  scaled->yacc = raw->yacc * 1.5 * 4 * 9.8 / 32768.0;
+  scaled->zacc = raw->zacc * 1.5 * 4 * 9.8 / 32768.0;
+  scaled->xgyro = raw->xgyro * 1.5 * gyro_range / 32768.0;
+  scaled->ygyro = raw->ygyro * 1.5 * gyro_range / 32768.0;
+  scaled->zgyro = raw->zgyro * 1.5 * gyro_range / 32768.0;
+  scaled->xmag = raw->xmag * 1.5 * 1.25e-4 / 32768.0;
+  scaled->ymag = raw->ymag * 1.5 * 1.25e-4 / 32768.0;
+  scaled->zmag = raw->zmag * 1.5 * 1.25e-4 / 32768.0;
+  scaled->roll = raw->roll * M_PI / 32768.0;
+  scaled->pitch = raw->pitch * M_PI / 32768.0;
+  scaled->yaw = raw->yaw * M_PI / 32768.0;
+  scaled->temperature = ((raw->temperature * 5 / 4096.0) - 1.375) * 44.44;
+  scaled->sensor_time = raw->sensor_time;
+}
+
+/** Whether the messages agree with the reference, to float precision. */
+bool Check(const vector<mavlink_ahrs400_angle_raw_t> &raw,
+           const vector<mavlink_ahrs400_angle_t> &scaled) {
+  for (size_t i=0; i<raw.size(); i++) {
+    vector<double> expected = Reference(raw[i]), actual = Fields(scaled[i]);
+    for (size_t j=0; j<expected.size(); j++) {
+      // The temperature offset can cancel most of its scaled value
+      double magnitude = std::abs(expected[j]);
+      if (j == expected.size() - 1)
+        magnitude += raw[i].temperature * 5 / 4096.0 * 44.44;
+      if (std::abs(actual[j] - expected[j])
+          > 1e-6 * std::max(1.0, magnitude))
+        return false;
+    }
+    if (scaled[i].time_usec != raw[i].time_usec
+        || scaled[i].sensor_time != raw[i].sensor_time)
+      return false;
+  }
+  return true;
+}
+
+/** Run a conversion repeatedly, print its speed. */
+template<typename Convert>
+void Measure(const string &name, Convert convert) {
+  const double target = 0.2;
+  size_t rounds = 0;
+  auto start = std::chrono::steady_clock::now();
+  do {
+    convert();
+    rounds++;
+  } while (Seconds(start) < target);
+  cout << std::setw(24) << name << std::fixed << std::setprecision(1)
+       << std::setw(12) << rounds * kCount / Seconds(start) / 1e6 << endl;
+}
+
+int main(int argc, char *argv[]) {
+  // Packets with random words, and their raw messages
+  std::mt19937 random(kCount);
+  std::uniform_int_distribution<int> byte(0, 255);
+  vector<uint8_t> payloads(kCount * AHRS_ANGLE_PAYLOAD_LEN);
+  vector<uint64_t> time_usec(kCount);
+  for (auto &b: payloads)
+    b = byte(random);
+  for (size_t i=0; i<kCount; i++)
+    time_usec[i] = 1500000000000000 + i * 10000;
+  vector<mavlink_ahrs400_angle_raw_t> raw(kCount);
+  ahrs_unpack_angle_raw(payloads.data(), time_usec.data(), kCount, raw.data());
+
+  // Outputs
+  vector<mavlink_ahrs400_angle_t> scaled(kCount);
+  vector<uint64_t> column_time(kCount);
+  vector<uint16_t> sensor_time(kCount);
+  vector<vector<float>> values(13, vector<float>(kCount));
+  ahrs_angle_columns_t columns = {
+    column_time.data(), values[0].data(), values[1].data(), values[2].data(),
+    values[3].data(), values[4].data(), values[5].data(), values[6].data(),
+    values[7].data(), values[8].data(), values[9].data(), values[10].data(),
+    values[11].data(), values[12].data(), sensor_time.data()
+  };
+
+  // Check each conversion to messages, and the columns against them
+  for (size_t i=0; i<kCount; i++)
+    ahrs_angle_conv(&raw[i], &scaled[i]);
+  bool ok = Check(raw, scaled);
+  ahrs_angle_conv_batch(raw.data(), kCount, scaled.data());
+  ok = ok && Check(raw, scaled);
+  ahrs_payloads_to_angle(payloads.data(), time_usec.data(), kCount,
+                         scaled.data());
+  ok = ok && Check(raw, scaled);
+  ahrs_payloads_to_columns(payloads.data(), time_usec.data(), kCount,
+                           &columns);
+  for (size_t i=0; ok && i<kCount; i++) {
+    ok = columns.xacc[i] == scaled[i].xacc && columns.roll[i] == scaled[i].roll
+        && columns.temperature[i] == scaled[i].temperature
+        && columns.time_usec[i] == time_usec[i]
+        && columns.sensor_time[i] == scaled[i].sensor_time;
+  }
+  if (!ok) {
+    cerr << "Conversion differs from the reference" << endl;
+    return EXIT_FAILURE;
+  }
+
+  cout << std::setw(24) << "conversion" << std::setw(12) << "Mmsg/s" << endl;
+  Measure("reference", [&]() {
+    for (size_t i=0; i<kCount; i++)
+      ReferenceConv(&raw[i], &scaled[i]);
+  });
+  Measure("unpack+conv", [&]() {
+    mavlink_ahrs400_angle_raw_t message;
+    for (size_t i=0; i<kCount; i++) {
+      ahrs_unpack_angle_raw(&payloads[i * AHRS_ANGLE_PAYLOAD_LEN],
+                            &time_usec[i], 1, &message);
+      ahrs_angle_conv(&message, &scaled[i]);
+    }
+  });
+  Measure("conv", [&]() {
+    for (size_t i=0; i<kCount; i++)
+      ahrs_angle_conv(&raw[i], &scaled[i]);
+  });
+  Measure("conv_batch", [&]() {
+    ahrs_angle_conv_batch(raw.data(), kCount, scaled.data());
+  });
+  Measure("conv_columns", [&]() {
+    ahrs_angle_conv_columns(raw.data(), kCount, &columns);
+  });
+  Measure("payloads_to_angle", [&]() {
+    ahrs_payloads_to_angle(payloads.data(), time_usec.data(), kCount,
+                           scaled.data());
+  });
+  Measure("payloads_to_columns", [&]() {
+    ahrs_payloads_to_columns(payloads.data(), time_usec.data(), kCount,
+                             &columns);
+  });
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+/**
+ * Benchmark of the AHRS400 packet framer.
+ *
+ * Frames byte streams of angle mode packets: a clean one, and copies with
+ * bit errors, dropped bytes and bursts of 0xFF noise, plus a recording of
+ * the serial port given as argument. The streams are fed to the framer in
+ * chunks of several sizes, like read() returns them, and also read with
+ * the previous stdio reader, which searched the header with fgetc and read
+ * the payload with fread. Reports the throughput in MB/s and the number of
+ * packets found by each, with the number of intact packets of the
+ * synthetic streams.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "devices/ahrs400/framer.h"
+
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+/** Payload length of the angle mode packets. */
+const unsigned kPayloadLen = 28;
+
+/** Byte stream, with its number of intact packets if known. */
+struct Stream {
+  string name;
+  vector<uint8_t> bytes;
+  long intact;
+};
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+/** Packets with random payloads, as the AHRS sends them. */
+vector<vector<uint8_t>> MakePackets(size_t count) {
+  std::mt19937 random(count);
+  std::uniform_int_distribution<int> byte(0, 255);
+  vector<vector<uint8_t>> packets(count);
+  for (auto &packet: packets) {
+    uint8_t sum = 0;
+    packet.push_back(AHRS_FRAMER_HEADER);
+    for (unsigned i=0; i<kPayloadLen; i++) {
+      packet.push_back(byte(random));
+      sum += packet.back();
+    }
+    packet.push_back(sum);
+  }
+  return packets;
+}
+
+/** Stream of packets, each corrupted by a function returning if it did. */
+template<typename Corrupt>
+Stream MakeStream(const string &name, const vector<vector<uint8_t>> &packets,
+                  Corrupt corrupt) {
+  Stream stream{name, {}, 0};
+  std::mt19937 random(name.size());
+  for (const auto &packet: packets) {
+    vector<uint8_t> bytes(packet);
+    if (!corrupt(bytes, random))
+      stream.intact++;
+    stream.bytes.insert(stream.bytes.end(), bytes.begin(), bytes.end());
+  }
+  return stream;
+}
+
+/** Frame a stream fed in chunks, return the number of packets. */
+long Frame(const Stream &stream, size_t chunk, ahrs_framer_t *framer) {
+  ahrs_framer_init(framer, kPayloadLen);
+  const uint8_t *data = stream.bytes.data();
+  size_t left = stream.bytes.size();
+  while (left) {
+    size_t len;
+    uint8_t *space = ahrs_framer_space(framer, &len);
+    len = std::min(len, std::min(chunk, left));
+    std::memcpy(space, data, len);
+    ahrs_framer_commit(framer, len);
+    data += len;
+    left -= len;
+
+    while (ahrs_framer_next(framer));
+  }
+  return framer->packets;
+}
+
+/** The previous reader, with the stream checksum and resynchronization. */
+long FrameStdio(const Stream &stream) {
+  std::FILE *file = fmemopen(const_cast<uint8_t*>(stream.bytes.data()),
+                             stream.bytes.size(), "rb");
+  long packets = 0;
+  uint8_t work[kPayloadLen + 1];
+  size_t work_ptr = 0;
+  bool header_found = false;
+  for (;;) {
+    if (!header_found) {
+      int recv;
+      while ((recv = std::fgetc(file)) != AHRS_FRAMER_HEADER && recv != EOF);
+      if (recv == EOF)
+        break;
+    }
+    if (!std::fread(work + work_ptr, sizeof work - work_ptr, 1, file))
+      break;
+
+    uint8_t sum = 0;
+    for (unsigned i=0; i<kPayloadLen; i++)
+      sum += work[i];
+    if (sum == work[kPayloadLen]) {
+      packets++;
+      work_ptr = 0;
+      header_found = false;
+      continue;
+    }
+
+    work_ptr = 0;
+    header_found = false;
+    for (size_t i=0; i<sizeof work; i++) {
+      if (work[i] == AHRS_FRAMER_HEADER) {
+        std::memmove(work, work + i + 1, sizeof work - i - 1);
+        work_ptr = sizeof work - i - 1;
+        header_found = true;
+        break;
+      }
+    }
+  }
+  std::fclose(file);
+  return packets;
+}
+
+/** Run a reader repeatedly, print its throughput and packets. */
+template<typename Reader>
+void Measure(const Stream &stream, const string &reader_name, Reader reader) {
+  const double target = 0.2;
+  long packets = 0;
+  size_t rounds = 0;
+  auto start = std::chrono::steady_clock::now();
+  do {
+    packets = reader();
+    rounds++;
+  } while (Seconds(start) < target);
+
+  double mb_per_s = rounds * stream.bytes.size() / Seconds(start) / 1e6;
+  cout << std::setw(14) << stream.name << std::setw(14) << reader_name
+       << std::fixed << std::setprecision(1) << std::setw(10) << mb_per_s
+       << std::setw(10) << packets << std::setw(10);
+  if (stream.intact >= 0)
+    cout << stream.intact << endl;
+  else
+    cout << '-' << endl;
+}
+
+int main(int argc, char *argv[]) {
+  const auto packets = MakePackets(100000);
+  vector<Stream> streams;
+  streams.push_back(MakeStream("clean", packets, [](vector<uint8_t>&,
+                                                    std::mt19937&) {
+    return false;
+  }));
+  streams.push_back(MakeStream("bit-errors", packets,
+                               [](vector<uint8_t> &bytes,
+                                  std::mt19937 &random) {
+    // One bit error every 20 packets on average
+    std::bernoulli_distribution error(0.05);
+    if (!error(random))
+      return false;
+    bytes[random() % bytes.size()] ^= 1 << (random() % 8);
+    return true;
+  }));
+  streams.push_back(MakeStream("dropped-bytes", packets,
+                               [](vector<uint8_t> &bytes,
+                                  std::mt19937 &random) {
+    std::bernoulli_distribution drop(0.05);
+    if (!drop(random))
+      return false;
+    bytes.erase(bytes.begin() + random() % bytes.size());
+    return true;
+  }));
+  streams.push_back(MakeStream("ff-noise", packets,
+                               [](vector<uint8_t> &bytes,
+                                  std::mt19937 &random) {
+    // Line noise before the packet, which is left intact
+    std::bernoulli_distribution burst(0.05);
+    if (burst(random))
+      bytes.insert(bytes.begin(), 1 + random() % 40, AHRS_FRAMER_HEADER);
+    return false;
+  }));
+
+  for (int i=1; i<argc; i++) {
+    std::ifstream file(argv[i], std::ios::binary);
+    if (!file) {
+      cerr << "Could not open recording " << argv[i] << endl;
+      return EXIT_FAILURE;
+    }
+    streams.push_back(Stream{argv[i], vector<uint8_t>(
+        std::istreambuf_iterator<char>(file),
+        std::istreambuf_iterator<char>()), -1});
+  }
+
+  static ahrs_framer_t framer;
+  cout << std::setw(14) << "stream" << std::setw(14) << "reader"
+       << std::setw(10) << "MB/s" << std::setw(10) << "packets"
+       << std::setw(10) << "intact" << endl;
+  for (const auto &stream: streams) {
+    for (size_t chunk: {1, 32, 4096}) {
+      Measure(stream, "framer/" + std::to_string(chunk), [&]() {
+        return Frame(stream, chunk, &framer);
+      });
+    }
+    Measure(stream, "stdio", [&]() {return FrameStdio(stream);});
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/**
+ * Benchmark of the iio scan buffer de-interleave kernels.
+ *
+ * Decodes synthetic buffers of signed 12-bit big-endian samples, like those
+ * of many SPI ADCs, with 16-bit storage and a 64-bit timestamp per scan, at
+ * several channel counts and buffer sizes. Reports the decoding speed of
+ * each kernel supported by the CPU, in millions of samples per second, for
+ * raw and scaled values, after checking they agree with the scalar kernel.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "devices/iio/deinterleave.hpp"
+
+
+using namespace fdas;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::vector;
+
+
+/** Scan buffer of `channels` 16-bit samples and a timestamp per scan. */
+struct ScanBuffer {
+  size_t channels, scans;
+  ptrdiff_t step;
+  vector<char> data;
+
+  ScanBuffer(size_t channels, size_t scans)
+      : channels(channels), scans(scans),
+        step((2*channels + 7) / 8 * 8 + 8), data(step * scans) {
+    std::mt19937 random(channels * scans);
+    std::uniform_int_distribution<int> sample(-2048, 2047);
+    for (size_t i=0; i<scans; i++) {
+      for (size_t j=0; j<channels; j++) {
+        uint16_t word = __builtin_bswap16(
+            static_cast<uint16_t>(sample(random) << 4));
+        std::memcpy(Sample(i, j), &word, sizeof word);
+      }
+    }
+  }
+
+  char* Sample(size_t scan, size_t channel) {
+    return data.data() + scan*step + 2*channel;
+  }
+};
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+/** Decode all channels of a buffer repeatedly, return Msamples/s. */
+template<typename Out>
+double Measure(Kernel kernel, const ColumnFormat &format, ScanBuffer &buffer,
+               vector<vector<Out>> &columns) {
+  const size_t target = 1 << 25;
+  const size_t rounds = std::max<size_t>(
+      1, target / (buffer.channels * buffer.scans));
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t round=0; round<rounds; round++) {
+    for (size_t j=0; j<buffer.channels; j++) {
+      DecodeColumn(kernel, format, buffer.Sample(0, j), buffer.step,
+                   buffer.scans, columns[j].data());
+    }
+  }
+  return rounds * buffer.channels * buffer.scans / Seconds(start) / 1e6;
+}
+
+/** Decode with a kernel and the scalar one, return whether they agree. */
+template<typename Out>
+bool Check(Kernel kernel, const ColumnFormat &format, ScanBuffer &buffer) {
+  vector<Out> expected(buffer.scans), actual(buffer.scans);
+  for (size_t j=0; j<buffer.channels; j++) {
+    DecodeColumn(Kernel::SCALAR, format, buffer.Sample(0, j), buffer.step,
+                 buffer.scans, expected.data());
+    DecodeColumn(kernel, format, buffer.Sample(0, j), buffer.step,
+                 buffer.scans, actual.data());
+    if (expected != actual)
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  ColumnFormat raw{16, 12, 4, true, true, false, 0, 1};
+  ColumnFormat scaled = raw;
+  scaled.scaled = true;
+  scaled.offset = 2048;
+  scaled.scale = 5.0 / 4096;
+
+  vector<Kernel> kernels{Kernel::SCALAR};
+  if (BestKernel() != Kernel::SCALAR)
+    kernels.push_back(Kernel::SSE41);
+  if (BestKernel() == Kernel::AVX2)
+    kernels.push_back(Kernel::AVX2);
+
+  cout << std::setw(8) << "channels" << std::setw(8) << "scans"
+       << std::setw(8) << "kernel" << std::setw(12) << "raw MS/s"
+       << std::setw(12) << "scaled MS/s" << endl;
+  for (size_t channels: {1, 4, 8, 16, 32}) {
+    for (size_t scans: {64, 512, 4096}) {
+      ScanBuffer buffer(channels, scans);
+      vector<vector<uint16_t>> raw_columns(channels, vector<uint16_t>(scans));
+      vector<vector<double>> scaled_columns(channels, vector<double>(scans));
+
+      for (Kernel kernel: kernels) {
+        if (!Check<uint16_t>(kernel, raw, buffer)
+            || !Check<double>(kernel, scaled, buffer)) {
+          cerr << KernelName(kernel) << " kernel differs from scalar" << endl;
+          return EXIT_FAILURE;
+        }
+
+        cout << std::setw(8) << channels << std::setw(8) << scans
+             << std::setw(8) << KernelName(kernel) << std::fixed
+             << std::setprecision(1) << std::setw(12)
+             << Measure(kernel, raw, buffer, raw_columns) << std::setw(12)
+             << Measure(kernel, scaled, buffer, scaled_columns) << endl;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
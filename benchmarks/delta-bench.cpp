@@ -0,0 +1,368 @@
+/**
+ * Benchmark of the delta compression codec.
+ *
+ * Encodes recorded data, a text data file as written by the
+ * log-data-text-file sink, or a synthetic 16-channel 12-bit ADC recording
+ * like the one of the VCM-DAS-1. Reports the encoding and decoding speed, in
+ * MB/s of uncompressed binary records, and the compression ratio. Fails if
+ * any decoded value or timestamp differs from the encoded one, or if a
+ * corrupt or truncated block is decoded instead of rejected.
+ */
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/common.hpp"
+#include "common/delta.hpp"
+#include "common/registry.hpp"
+
+
+using namespace fdas;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+/** Recorded samples of a stream. */
+struct Recording {
+  const DataId *id;
+  vector<int16_t> values;
+  vector<uint64_t> timestamps;
+};
+
+/** Binary encoder keeping its output in memory. */
+class MemoryBinaryDataSink : public BinaryDataSink {
+ protected:
+  virtual void Output(const char *data, size_t size) {bytes += size;}
+
+ public:
+  size_t bytes = 0;
+};
+
+/** Compressing encoder keeping its output in memory. */
+class MemoryDeltaDataSink : public DeltaDataSink {
+ protected:
+  virtual void Output(const char *data, size_t size) {
+    output.append(data, size);
+  }
+
+ public:
+  string output;
+
+  void Close() {
+    Finish();
+    WriteHeader();
+  }
+};
+
+/** Sink counting the data taken. */
+class CountingDataSink : public DataSink {
+  template<typename DataType> void Count(const DataBlock<DataType> &block) {
+    count += block.size;
+    checksum += block.data[block.size - 1];
+  }
+
+ public:
+  size_t count = 0;
+  double checksum = 0;
+
+  virtual void Take(Datum<int8_t> datum) {count++;}
+  virtual void Take(Datum<int16_t> datum) {count++;}
+  virtual void Take(Datum<int32_t> datum) {count++;}
+  virtual void Take(Datum<int64_t> datum) {count++;}
+  virtual void Take(Datum<uint8_t> datum) {count++;}
+  virtual void Take(Datum<uint16_t> datum) {count++;}
+  virtual void Take(Datum<uint32_t> datum) {count++;}
+  virtual void Take(Datum<uint64_t> datum) {count++;}
+  virtual void Take(Datum<double> datum) {count++;}
+  virtual void Take(Datum<float> datum) {count++;}
+  virtual void TakeBlock(const DataBlock<int16_t> &block) {Count(block);}
+};
+
+/** Sink comparing the data taken with the recordings, in order. */
+class VerifyingDataSink : public DataSink {
+  /** Recording of each stream and the position of its next sample. */
+  std::map<const DataId*, std::pair<const Recording*, size_t>> streams;
+
+ public:
+  size_t count = 0;
+  size_t mismatches = 0;
+
+  explicit VerifyingDataSink(const vector<Recording> &recordings) {
+    for (const auto& recording: recordings)
+      streams[recording.id] = std::make_pair(&recording, size_t(0));
+  }
+
+  /** Whether all samples of all recordings were taken. */
+  bool Complete() const {
+    for (const auto& stream: streams) {
+      if (stream.second.second != stream.second.first->values.size())
+        return false;
+    }
+    return true;
+  }
+
+  // The recordings are all int16, single data of any type are mismatches
+  virtual void Take(Datum<int8_t> datum) {mismatches++;}
+  virtual void Take(Datum<int16_t> datum) {mismatches++;}
+  virtual void Take(Datum<int32_t> datum) {mismatches++;}
+  virtual void Take(Datum<int64_t> datum) {mismatches++;}
+  virtual void Take(Datum<uint8_t> datum) {mismatches++;}
+  virtual void Take(Datum<uint16_t> datum) {mismatches++;}
+  virtual void Take(Datum<uint32_t> datum) {mismatches++;}
+  virtual void Take(Datum<uint64_t> datum) {mismatches++;}
+  virtual void Take(Datum<double> datum) {mismatches++;}
+  virtual void Take(Datum<float> datum) {mismatches++;}
+
+  virtual void TakeBlock(const DataBlock<int16_t> &block) {
+    auto stream = streams.find(block.id);
+    if (stream == streams.end()) {
+      mismatches += block.size;
+      return;
+    }
+
+    const Recording &recording = *stream->second.first;
+    size_t &next = stream->second.second;
+    for (size_t i=0; i<block.size; i++, next++) {
+      if (next >= recording.values.size()
+          || block.data[i] != recording.values[next]
+          || block.timestamps[i] != recording.timestamps[next])
+        mismatches++;
+    }
+    count += block.size;
+  }
+};
+
+/**
+ * Read the integer streams of a text data file.
+ * Values which do not fit an int16 are skipped.
+ */
+vector<Recording> ReadTextFile(const string &path) {
+  std::ifstream in(path);
+  std::map<string, size_t> index;
+  vector<Recording> ret;
+  string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    string strid;
+    double value;
+    uint64_t timestamp;
+    if (!std::getline(fields, strid, '\t') || !(fields >> value >> timestamp)
+        || value != std::floor(value) || std::fabs(value) > INT16_MAX)
+      continue;
+
+    auto it = index.find(strid);
+    if (it == index.end()) {
+      it = index.emplace(strid, ret.size()).first;
+      ret.push_back(Recording{DataIdRegistry::Instance().Register(
+          strid.c_str())});
+    }
+    ret[it->second].values.push_back(static_cast<int16_t>(value));
+    ret[it->second].timestamps.push_back(timestamp);
+  }
+  return ret;
+}
+
+/**
+ * Synthesize a 50 Hz, 16-channel recording of slowly varying 12-bit signals
+ * with a little noise and timer jitter.
+ */
+vector<Recording> Synthesize(size_t samples) {
+  std::mt19937 random(0);
+  std::uniform_int_distribution<int> noise(-3, 3);
+  std::uniform_int_distribution<int> jitter(-8, 8);
+
+  vector<uint64_t> timestamps(samples);
+  for (size_t i=0; i<samples; i++)
+    timestamps[i] = 1500000000000000 + i*20000 + jitter(random);
+
+  vector<Recording> ret;
+  for (int channel=0; channel<16; channel++) {
+    string strid = "adc.channel" + std::to_string(channel);
+    Recording recording{DataIdRegistry::Instance().Register(strid.c_str()),
+                        vector<int16_t>(samples), timestamps};
+    double frequency = 0.1 + 0.1 * channel;
+    for (size_t i=0; i<samples; i++) {
+      double t = i * 0.02;
+      recording.values[i] = static_cast<int16_t>(
+          2048 + 1500 * std::sin(2 * M_PI * frequency * t + channel)
+          + noise(random));
+    }
+    ret.push_back(std::move(recording));
+  }
+  return ret;
+}
+
+/** Feed the recordings to a sink, scan by scan like the readers do. */
+void Feed(const vector<Recording> &recordings, DataSink &sink) {
+  for (const auto& recording: recordings)
+    sink.Declare(recording.id, ValueType::INT16);
+
+  const size_t scan = 512;
+  size_t longest = 0;
+  for (const auto& recording: recordings)
+    longest = std::max(longest, recording.values.size());
+
+  for (size_t i=0; i<longest; i+=scan) {
+    for (const auto& recording: recordings) {
+      if (i >= recording.values.size())
+        continue;
+      size_t n = std::min(scan, recording.values.size() - i);
+      sink.TakeBlock(DataBlock<int16_t>(
+          recording.id, recording.values.data() + i,
+          recording.timestamps.data() + i, n));
+    }
+  }
+}
+
+/**
+ * Decode a copy of a block in a buffer of exactly its size, so reading past
+ * it is caught by the address sanitizer.
+ * @return whether the block was rejected.
+ */
+bool Rejects(const char *block, size_t size) {
+  vector<char> copy(block, block + size);
+  vector<uint64_t> values(UINT16_MAX), timestamps(UINT16_MAX);
+  uint16_t handle, count;
+  return !DeltaCodec::Decode(copy.data(), copy.size(), &handle,
+                             values.data(), timestamps.data(), &count);
+}
+
+/**
+ * Check that corrupt blocks are rejected: a header without the first
+ * sample, and a block of the recording truncated or claiming the largest
+ * sample count.
+ * @return the number of corrupt blocks decoded.
+ */
+size_t CheckCorruptBlocks(const Recording &recording) {
+  size_t failures = 0;
+
+  char empty[DeltaCodec::kBlockHeaderSize] = {};
+  uint16_t count = 300;
+  std::memcpy(empty, &DeltaCodec::kBlockMagic, 4);
+  std::memcpy(empty + 6, &count, sizeof count);
+  failures += !Rejects(empty, sizeof empty);
+
+  count = static_cast<uint16_t>(std::min<size_t>(recording.values.size(),
+                                                 1000));
+  vector<uint64_t> values(recording.values.begin(),
+                          recording.values.begin() + count);
+  vector<char> block(DeltaCodec::Bound(count));
+  size_t size = DeltaCodec::Encode(0, values.data(),
+                                   recording.timestamps.data(), count,
+                                   block.data());
+  if (Rejects(block.data(), size))
+    failures++;
+
+  for (uint32_t rest = 0; rest + 12 < size; rest++) {
+    std::memcpy(block.data() + 8, &rest, sizeof rest);
+    failures += !Rejects(block.data(), 12 + rest);
+  }
+  uint32_t rest = static_cast<uint32_t>(size - 12);
+  std::memcpy(block.data() + 8, &rest, sizeof rest);
+  count = UINT16_MAX;
+  std::memcpy(block.data() + 6, &count, sizeof count);
+  failures += !Rejects(block.data(), size);
+  return failures;
+}
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char *argv[]) {
+  vector<Recording> recordings = argc > 1 ? ReadTextFile(argv[1])
+                                          : Synthesize(1 << 20);
+  size_t samples = 0;
+  for (const auto& recording: recordings)
+    samples += recording.values.size();
+  if (!samples) {
+    cerr << "No integer data to compress" << endl;
+    return EXIT_FAILURE;
+  }
+
+  // Size of the uncompressed binary records, the reference
+  MemoryBinaryDataSink binary;
+  Feed(recordings, binary);
+
+  // Encode
+  MemoryDeltaDataSink delta;
+  auto start = std::chrono::steady_clock::now();
+  Feed(recordings, delta);
+  delta.Close();
+  double encode_time = Seconds(start);
+
+  // Decode from a file, like the decoder tool
+  char path[] = "/tmp/delta-bench.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0 || write(fd, delta.output.data(), delta.output.size())
+      != static_cast<ssize_t>(delta.output.size())) {
+    cerr << "Error writing temporary file" << endl;
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  auto counter = std::make_shared<CountingDataSink>();
+  DataSinkPtrList sinks{counter};
+  start = std::chrono::steady_clock::now();
+  {
+    DeltaFileReader reader(path);
+    while (reader.Next(sinks)) {}
+  }
+  double decode_time = Seconds(start);
+
+  // Decode again, untimed, comparing with the recordings
+  auto verifier = std::make_shared<VerifyingDataSink>(recordings);
+  sinks = DataSinkPtrList{verifier};
+  {
+    DeltaFileReader reader(path);
+    while (reader.Next(sinks)) {}
+  }
+  unlink(path);
+
+  if (counter->count != samples || verifier->mismatches
+      || !verifier->Complete()) {
+    cerr << "Decoded " << verifier->count << " of " << samples
+         << " samples, " << verifier->mismatches << " differ from the source"
+         << endl;
+    return EXIT_FAILURE;
+  }
+
+  size_t failures = CheckCorruptBlocks(recordings.front());
+  if (failures) {
+    cerr << failures << " corrupt blocks were decoded" << endl;
+    return EXIT_FAILURE;
+  }
+
+  double megabytes = binary.bytes / 1e6;
+  cout << std::fixed << std::setprecision(2)
+       << "samples:             " << samples << " in "
+       << recordings.size() << " streams, all decoded exactly" << endl
+       << "binary records:      " << megabytes << " MB" << endl
+       << "compressed:          " << delta.output.size() / 1e6 << " MB, "
+       << 8.0 * delta.output.size() / samples << " bits/sample" << endl
+       << "compression ratio:   " << double(binary.bytes) / delta.output.size()
+       << endl
+       << "encode:              " << megabytes / encode_time << " MB/s" << endl
+       << "decode:              " << megabytes / decode_time << " MB/s"
+       << "   (checksum " << std::setprecision(0) << counter->checksum << ")"
+       << endl;
+  return EXIT_SUCCESS;
+}
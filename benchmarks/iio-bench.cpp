@@ -0,0 +1,204 @@
+/**
+ * Benchmark of the iio device reader, without the hardware.
+ *
+ * Builds a libiio XML context holding a device of some channels of a data
+ * format and a 64-bit timestamp, and feeds refills of synthetic scans to a
+ * reader of the device laid out like the kernel buffer, as fast as
+ * possible. Reports, for several channel counts, data formats and buffer
+ * sizes, the samples per second, the CPU time per sample and the latency
+ * from a refill to the last of its channels reaching the sinks.
+ */
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <iio.h>
+
+#include "common/common.hpp"
+#include "common/registry.hpp"
+#include "devices/iio/reader.hpp"
+
+
+using namespace fdas;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+/** XML description of a device of `channels` channels and a timestamp. */
+string DeviceXml(size_t channels, string format) {
+  for (size_t pos; (pos = format.find('>')) != string::npos;)
+    format.replace(pos, 1, "&gt;");
+
+  std::ostringstream xml;
+  xml << "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+      << "<context name=\"xml\"><device id=\"iio:device0\" name=\"bench\">";
+  for (size_t i=0; i<channels; i++) {
+    xml << "<channel id=\"voltage" << i << "\" type=\"input\">"
+        << "<scan-element index=\"" << i << "\" format=\"" << format
+        << "\"/></channel>";
+  }
+  xml << "<channel id=\"timestamp\" type=\"input\"><scan-element index=\""
+      << channels << "\" format=\"le:S64/64&gt;&gt;0\"/></channel>"
+      << "</device></context>";
+  return xml.str();
+}
+
+/** Sink counting the samples and timing the blocks of the last channel. */
+class LatencyDataSink : public DataSink {
+  const DataId *last;
+  std::chrono::steady_clock::time_point refill;
+
+  template<typename DataType>
+  void HandleBlock(const DataBlock<DataType> &block) {
+    samples += block.size;
+    checksum += block.data[block.size - 1];
+    if (block.id != last)
+      return;
+    auto now = std::chrono::steady_clock::now();
+    double latency = std::chrono::duration<double, std::micro>(
+        now - refill).count();
+    total_latency_us += latency;
+    max_latency_us = std::max(max_latency_us, latency);
+    blocks++;
+  }
+
+ public:
+  uint64_t samples = 0, blocks = 0;
+  double checksum = 0, total_latency_us = 0, max_latency_us = 0;
+
+  explicit LatencyDataSink(const DataId *last) : last(last) {}
+
+  void Refill() {refill = std::chrono::steady_clock::now();}
+
+  virtual void Take(Datum<int8_t> datum) {}
+  virtual void Take(Datum<int16_t> datum) {}
+  virtual void Take(Datum<int32_t> datum) {}
+  virtual void Take(Datum<int64_t> datum) {}
+  virtual void Take(Datum<uint8_t> datum) {}
+  virtual void Take(Datum<uint16_t> datum) {}
+  virtual void Take(Datum<uint32_t> datum) {}
+  virtual void Take(Datum<uint64_t> datum) {}
+  virtual void Take(Datum<double> datum) {}
+  virtual void Take(Datum<float> datum) {}
+  virtual void TakeBlock(const DataBlock<int8_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int16_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int32_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int64_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint8_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint16_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint32_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint64_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<double> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<float> &block) {HandleBlock(block);}
+};
+
+double CpuSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Read `samples` synthetic samples from a device of `channels` channels.
+ * @return whether the device could be built.
+ */
+bool Run(size_t channels, const string &format, size_t buffer_size,
+         uint64_t samples) {
+  string xml = DeviceXml(channels, format);
+  struct iio_context *ctx = iio_create_xml_context_mem(xml.data(),
+                                                       xml.size());
+  struct iio_device *dev = ctx ? iio_context_find_device(ctx, "bench")
+      : nullptr;
+  if (!dev) {
+    cerr << "Could not build the XML context of " << format << endl;
+    if (ctx)
+      iio_context_destroy(ctx);
+    return false;
+  }
+
+  {
+    DeviceReader reader(dev, "", buffer_size, false, BestKernel());
+    reader.ComputeLayout();
+    string last = "voltage" + std::to_string(channels - 1);
+    auto sink = std::make_shared<LatencyDataSink>(
+        DataIdRegistry::Instance().Register(last.c_str()));
+    DataSinkPtrList data_sinks = {sink};
+    reader.Declare(data_sinks);
+
+    // Random samples, the timestamp is the last scan element
+    const ptrdiff_t step = reader.Step();
+    vector<char> scans(buffer_size * step);
+    std::mt19937 random(channels * buffer_size);
+    for (auto& byte: scans)
+      byte = static_cast<char>(random());
+
+    const uint64_t refills = std::max<uint64_t>(
+        1, samples / (channels * buffer_size));
+    auto start = std::chrono::steady_clock::now();
+    double cpu_start = CpuSeconds();
+    uint64_t first_scan = 0;
+    for (uint64_t r=0; r<refills; r++) {
+      // Scans timed back from the refill at a nominal 1 us period
+      uint64_t time_us = TimeMicroseconds();
+      for (size_t i=0; i<buffer_size; i++) {
+        int64_t timestamp_ns = (time_us - (buffer_size - 1 - i)) * 1000;
+        std::memcpy(&scans[(i + 1) * step - 8], &timestamp_ns,
+                    sizeof timestamp_ns);
+      }
+      sink->Refill();
+      reader.Process(scans.data(), scans.size(), time_us, first_scan,
+                     data_sinks);
+      first_scan += buffer_size;
+    }
+    double cpu = CpuSeconds() - cpu_start;
+    double wall = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    cout << std::setw(8) << channels << std::setw(16) << format
+         << std::setw(8) << buffer_size << std::fixed << std::setprecision(1)
+         << std::setw(12) << sink->samples / wall / 1e6
+         << std::setprecision(2) << std::setw(12)
+         << cpu * 1e9 / sink->samples
+         << std::setw(12) << sink->total_latency_us / sink->blocks
+         << std::setw(12) << sink->max_latency_us << endl;
+  }
+  iio_context_destroy(ctx);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t samples = argc > 1 ? std::strtoull(argv[1], nullptr, 0)
+      : 20000000;
+  cout << "Reading " << samples << " samples per case with the "
+       << KernelName(BestKernel()) << " kernel" << endl
+       << std::setw(8) << "channels" << std::setw(16) << "format"
+       << std::setw(8) << "buffer" << std::setw(12) << "Msamples/s"
+       << std::setw(12) << "CPU ns/smp" << std::setw(12) << "latency us"
+       << std::setw(12) << "max us" << endl;
+
+  const char *formats[] = {
+    "le:s16/16>>0", "be:s12/16>>4", "le:u32/32>>0"};
+  for (size_t channels: {1, 4, 16}) {
+    for (const char *format: formats) {
+      for (size_t buffer_size: {64, 512, 4096}) {
+        if (!Run(channels, format, buffer_size, samples))
+          return EXIT_FAILURE;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
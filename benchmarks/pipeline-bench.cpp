@@ -0,0 +1,132 @@
+/**
+ * Benchmark of statically composed pipelines against DataSinkPtrList.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "common/common.hpp"
+#include "common/pipeline.hpp"
+
+
+using namespace fdas;
+using std::cout;
+using std::endl;
+
+
+/** Accumulating sink, the cheapest possible work per datum. */
+class SumStage {
+ public:
+  double sum = 0;
+  
+  void Declare(const DataId *id, ValueType type) {}
+  void Poll() {}
+  
+  template<typename DataType> void Take(const Datum<DataType> &datum) {
+    sum += datum.data;
+  }
+};
+
+/** Accumulating DataSink, the virtual-dispatch counterpart of SumStage. */
+class SumDataSink : public DataSink {
+ public:
+  double sum = 0;
+  
+  virtual void Take(Datum<int8_t> datum) {sum += datum.data;}
+  virtual void Take(Datum<int16_t> datum) {sum += datum.data;}
+  virtual void Take(Datum<int32_t> datum) {sum += datum.data;}
+  virtual void Take(Datum<int64_t> datum) {sum += datum.data;}
+  virtual void Take(Datum<uint8_t> datum) {sum += datum.data;}
+  virtual void Take(Datum<uint16_t> datum) {sum += datum.data;}
+  virtual void Take(Datum<uint32_t> datum) {sum += datum.data;}
+  virtual void Take(Datum<uint64_t> datum) {sum += datum.data;}
+  virtual void Take(Datum<double> datum) {sum += datum.data;}
+  virtual void Take(Datum<float> datum) {sum += datum.data;}
+};
+
+/** Time the feeding of `count` data to `take`, in nanoseconds per datum. */
+template<typename Take> double Measure(size_t count, Take take) {
+  DataId id("bench");
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i=0; i<count; i++)
+    take(Datum<int16_t>(&id, static_cast<int16_t>(i), i));
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / count;
+}
+
+void Report(const char *name, double ns_per_datum, double checksum) {
+  cout << std::left << std::setw(36) << name << std::right << std::fixed
+       << std::setprecision(2) << std::setw(8) << ns_per_datum << " ns/datum"
+       << "   (checksum " << std::setprecision(0) << checksum << ")" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 50000000;
+  auto even = [](const auto &datum) {return datum.data % 2 == 0;};
+  cout << "Feeding " << count << " int16 data to three sinks" << endl;
+  
+  {
+    DataSinkPtrList sinks;
+    for (int i=0; i<3; i++)
+      sinks.push_back(DataSinkPtr(new SumDataSink));
+    double t = Measure(count, [&](const Datum<int16_t> &datum) {
+        for (const auto& sink: sinks)
+          sink->Take(datum);
+      });
+    double sum = 0;
+    for (const auto& sink: sinks)
+      sum += static_cast<SumDataSink&>(*sink).sum;
+    Report("DataSinkPtrList", t, sum);
+  }
+  
+  {
+    auto tee = MakeTee(SumStage(), SumStage(), SumStage());
+    double t = Measure(count, [&](const Datum<int16_t> &datum) {
+        tee.Take(datum);
+      });
+    double sum = tee.Stage<0>().sum + tee.Stage<1>().sum + tee.Stage<2>().sum;
+    Report("Tee", t, sum);
+  }
+  
+  {
+    DataSinkPtr bridge = MakePipelineDataSink(
+        MakeTee(SumStage(), SumStage(), SumStage()));
+    double t = Measure(count, [&](const Datum<int16_t> &datum) {
+        bridge->Take(datum);
+      });
+    auto &tee = static_cast<PipelineDataSink<Tee<SumStage, SumStage,
+                                                 SumStage>>&>(*bridge).Stages();
+    double sum = tee.Stage<0>().sum + tee.Stage<1>().sum + tee.Stage<2>().sum;
+    Report("PipelineDataSink(Tee)", t, sum);
+  }
+  
+  {
+    DataSinkPtrList sinks;
+    for (int i=0; i<3; i++)
+      sinks.push_back(DataSinkPtr(new SumDataSink));
+    double t = Measure(count, [&](const Datum<int16_t> &datum) {
+        if (even(datum))
+          for (const auto& sink: sinks)
+            sink->Take(datum);
+      });
+    double sum = 0;
+    for (const auto& sink: sinks)
+      sum += static_cast<SumDataSink&>(*sink).sum;
+    Report("filter + DataSinkPtrList", t, sum);
+  }
+  
+  {
+    auto pipeline = MakeFilter(even, MakeTee(SumStage(), SumStage(),
+                                             SumStage()));
+    double t = Measure(count, [&](const Datum<int16_t> &datum) {
+        pipeline.Take(datum);
+      });
+    auto &tee = pipeline.Downstream();
+    double sum = tee.Stage<0>().sum + tee.Stage<1>().sum + tee.Stage<2>().sum;
+    Report("Filter(Tee)", t, sum);
+  }
+  
+  return EXIT_SUCCESS;
+}
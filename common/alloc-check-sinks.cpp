@@ -0,0 +1,130 @@
+/**
+ * Feed simulated acquisition data to the data sinks built from the command
+ * line, like the readers do, to check them with libfdas-alloc-check.so.
+ *
+ * Sixteen int16 channels are sent in blocks of 100 scans every 100 ms, like
+ * an iio device read at 1 kHz, and a double stream datum by datum at 10 Hz.
+ * The sinks are polled between the refills.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/log/trivial.hpp>
+#include <boost/program_options.hpp>
+
+#include "common.hpp"
+#include "registry.hpp"
+
+
+namespace po = boost::program_options;
+using namespace fdas;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+/** Number of simulated int16 channels. */
+static const size_t kChannels = 16;
+
+/** Scans of each refill of the simulated channels. */
+static const size_t kScans = 100;
+
+/** Time between two refills. */
+static const std::chrono::milliseconds kRefillPeriod(100);
+
+
+int main (int argc, char *argv[]) {
+  // Command line arguments
+  double duration;
+
+  // Define accepted command line arguments
+  po::options_description desc(
+      "Feed simulated data to the given data sinks, to check them with "
+      "LD_PRELOAD=libfdas-alloc-check.so");
+  desc.add_options()
+      ("duration", po::value<double>(&duration)->default_value(10),
+       "Seconds of data to feed");
+  desc.add(GeneralOptions()).add(DataSinkOptions());
+
+  // Parse command line arguments
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  } catch (const std::exception& e) {
+    cerr << "Error parsing command line arguments: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  // Process help option
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return 0;
+  }
+
+  // Call notifiers and process arguments
+  try {
+    po::notify(vm);
+  } catch (const std::exception& e) {
+    cerr << "Error processing command line arguments: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    DataSinkPtrList data_sinks = BuildDataSinks(vm);
+
+    // Register and declare the streams at startup, as the readers do
+    vector<const DataId*> channels;
+    for (size_t i=0; i<kChannels; i++) {
+      string strid = "sim.channel" + std::to_string(i);
+      channels.push_back(DataIdRegistry::Instance().Register(strid.c_str()));
+      for (const auto& sink: data_sinks)
+        sink->Declare(channels.back(), ValueType::INT16);
+    }
+    const DataId *slow = DataIdRegistry::Instance().Register("sim.slow");
+    for (const auto& sink: data_sinks)
+      sink->Declare(slow, ValueType::DOUBLE);
+
+    vector<int16_t> values(kScans);
+    vector<uint64_t> timestamps(kScans);
+    using std::chrono::microseconds;
+    uint64_t period = std::chrono::duration_cast<microseconds>(
+        kRefillPeriod).count();
+    uint64_t time_us = std::chrono::duration_cast<microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    auto next = std::chrono::steady_clock::now();
+    for (size_t refill=0; refill * period < duration * 1e6; refill++) {
+      for (size_t j=0; j<kScans; j++)
+        timestamps[j] = time_us + j * period / kScans;
+
+      for (size_t i=0; i<kChannels; i++) {
+        for (size_t j=0; j<kScans; j++)
+          values[j] = static_cast<int16_t>((refill * kScans + j) * (i + 1));
+        DataBlock<int16_t> block(channels[i], values.data(),
+                                 timestamps.data(), kScans);
+        for (const auto& sink: data_sinks)
+          sink->TakeBlock(block);
+      }
+      for (const auto& sink: data_sinks) {
+        sink->Take(Datum<double>(slow, refill * 0.1, time_us));
+        sink->Poll();
+      }
+
+      time_us += period;
+      next += kRefillPeriod;
+      std::this_thread::sleep_until(next);
+    }
+  } catch (const std::exception& e) {
+    BOOST_LOG_TRIVIAL(error) << e.what();
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
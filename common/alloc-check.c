@@ -0,0 +1,191 @@
+/**
+ * Preloaded library checking that a program allocates no heap memory in its
+ * steady state, like the acquisition loops of the FDAS device modules.
+ *
+ * Usage:
+ *
+ *     LD_PRELOAD=libfdas-alloc-check.so PROGRAM [ARGS...]
+ *
+ * The library interposes the glibc allocation functions and counts the
+ * calls made during a window of time, after the program startup. The
+ * window opens FDAS_ALLOC_CHECK_DELAY seconds after the program starts
+ * (default 2) and lasts FDAS_ALLOC_CHECK_WINDOW seconds (default 5). At its
+ * end the counts are reported and the program exits with status 0 if no
+ * memory was allocated in the window, 1 otherwise, so that scripts can
+ * check the modules against recorded or simulated sources. The backtraces
+ * of the first allocations of the window are written to STDERR, with
+ * symbol names if the program is linked with -rdynamic.
+ *
+ * Memory freed in the window is reported but not counted as an error.
+ *
+ * The ctest tests run it on alloc-check-sinks, which feeds simulated data
+ * to the C++ data sinks, and on ahrs400-read, through ahrs400-sim.py.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/** Allocation functions of glibc, called by the interposed ones. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+/** Number of allocations of the window whose backtraces are written. */
+#define BACKTRACES 4
+
+/** Maximum depth of the backtraces. */
+#define BACKTRACE_DEPTH 32
+
+/** Whether the window is open. */
+static volatile bool armed;
+
+/** Allocations and frees in the window. */
+static unsigned long allocations, frees;
+
+/** Whether the thread is in an interposed function, to avoid recursion. */
+static __thread bool busy __attribute__((tls_model("initial-exec")));
+
+
+/** Write a message to STDERR without allocating. */
+static void report(const char *format, ...) {
+    char msg[256];
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(msg, sizeof msg, format, ap);
+    va_end(ap);
+    if (len > 0 && write(STDERR_FILENO, msg, len) < 0)
+        return;
+}
+
+
+/** Count an allocation made in the window, writing its backtrace. */
+static void count_allocation(size_t size) {
+    if (!armed || busy)
+        return;
+
+    unsigned long n = __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    if (n < BACKTRACES) {
+        busy = true;
+        void *frames[BACKTRACE_DEPTH];
+        int depth = backtrace(frames, BACKTRACE_DEPTH);
+        report("alloc-check: allocation %lu of %lu bytes in the window at\n",
+               n + 1, (unsigned long) size);
+        backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+        busy = false;
+    }
+}
+
+
+void *malloc(size_t size) {
+    count_allocation(size);
+    return __libc_malloc(size);
+}
+
+
+void *calloc(size_t count, size_t size) {
+    count_allocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+
+void *realloc(void *ptr, size_t size) {
+    count_allocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+
+void *memalign(size_t alignment, size_t size) {
+    count_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) || alignment & (alignment - 1))
+        return EINVAL;
+
+    count_allocation(size);
+    void *mem = __libc_memalign(alignment, size);
+    if (!mem)
+        return ENOMEM;
+    *ptr = mem;
+    return 0;
+}
+
+
+void free(void *ptr) {
+    if (ptr && armed && !busy)
+        __atomic_fetch_add(&frees, 1, __ATOMIC_RELAXED);
+    __libc_free(ptr);
+}
+
+
+/** Read a number of seconds from the environment. */
+static double env_seconds(const char *name, double fallback) {
+    const char *value = getenv(name);
+    char *end;
+    double seconds = value ? strtod(value, &end) : fallback;
+    return value && (end == value || *end || seconds < 0) ? fallback : seconds;
+}
+
+
+/** Sleep for a number of seconds, resuming after signals. */
+static void sleep_seconds(double seconds) {
+    struct timespec t = {.tv_sec=(time_t) seconds,
+                         .tv_nsec=(long) ((seconds - (time_t) seconds) * 1e9)};
+    while (nanosleep(&t, &t) && errno == EINTR);
+}
+
+
+/** Timer of the window, ending the program at its end. */
+static void *window_thread(void *arg) {
+    double *seconds = arg;
+    sleep_seconds(seconds[0]);
+    armed = true;
+    sleep_seconds(seconds[1]);
+    armed = false;
+
+    unsigned long n = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    unsigned long m = __atomic_load_n(&frees, __ATOMIC_RELAXED);
+    report("alloc-check: %lu allocations and %lu frees in the window\n", n, m);
+    _exit(n ? EXIT_FAILURE : EXIT_SUCCESS);
+    return NULL;
+}
+
+
+/** Start the timer of the window when the library is loaded. */
+__attribute__((constructor))
+static void start(void) {
+    static double seconds[2];
+    seconds[0] = env_seconds("FDAS_ALLOC_CHECK_DELAY", 2);
+    seconds[1] = env_seconds("FDAS_ALLOC_CHECK_WINDOW", 5);
+
+    // The first backtrace loads the unwinder, which allocates
+    void *frame;
+    backtrace(&frame, 1);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, window_thread, seconds)) {
+        report("alloc-check: could not start the window timer\n");
+        _exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+}
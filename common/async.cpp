@@ -0,0 +1,186 @@
+/**
+ * Asynchronous data sinking for the FDAS.
+ */
+
+#include "async.hpp"
+
+#include <chrono>
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include <boost/log/trivial.hpp>
+
+using std::string;
+
+
+namespace fdas {
+
+/** How long the writer thread sleeps when there is nothing to write. */
+static const std::chrono::milliseconds kWriterIdleSleep(1);
+
+std::istream& operator>>(std::istream &in, OverflowPolicy &policy) {
+  string name;
+  in >> name;
+  if (name == "block")
+    policy = OverflowPolicy::BLOCK;
+  else if (name == "drop-newest")
+    policy = OverflowPolicy::DROP_NEWEST;
+  else if (name == "drop-oldest")
+    policy = OverflowPolicy::DROP_OLDEST;
+  else
+    in.setstate(std::ios::failbit);
+  return in;
+}
+
+std::ostream& operator<<(std::ostream &out, OverflowPolicy policy) {
+  switch (policy) {
+    case OverflowPolicy::BLOCK:
+      return out << "block";
+    case OverflowPolicy::DROP_NEWEST:
+      return out << "drop-newest";
+    case OverflowPolicy::DROP_OLDEST:
+      return out << "drop-oldest";
+  }
+  return out;
+}
+
+AsyncDataSink::AsyncDataSink(DataSinkPtr sink, size_t capacity,
+                             OverflowPolicy policy)
+    : sink(sink), policy(policy), ring(capacity) {
+  writer = std::thread(&AsyncDataSink::Drain, this);
+}
+
+AsyncDataSink::~AsyncDataSink() {
+  running.store(false, std::memory_order_release);
+  writer.join();
+
+  if (Drops())
+    BOOST_LOG_TRIVIAL(warning) << "Asynchronous data sink dropped " << Drops()
+                               << " data in queue overflows";
+}
+
+/** Writer thread body, passes queued entries to the wrapped sink. */
+void AsyncDataSink::Drain() {
+  Entry entry;
+  for (;;) {
+    // Read the flag before emptying the ring so no entry is left behind
+    bool stop = !running.load(std::memory_order_acquire);
+
+    while (ring.Pop(entry)) {
+      if (entry.declaration)
+        sink->Declare(entry.datum.id, entry.datum.type);
+      else
+        entry.datum.SendTo(*sink);
+    }
+
+    if (stop)
+      return;
+
+    // The ring is empty, let the sink act on pending requests meanwhile
+    sink->Poll();
+    std::this_thread::sleep_for(kWriterIdleSleep);
+  }
+}
+
+void AsyncDataSink::Enqueue(const AnyDatum &datum) {
+  if (ring.Push(Entry{datum, false}, policy))
+    drops.fetch_add(1, std::memory_order_relaxed);
+}
+
+template<typename DataType>
+void AsyncDataSink::Enqueue(const DataBlock<DataType> &block) {
+  for (size_t i=0; i<block.size; i++)
+    Enqueue(block[i]);
+}
+
+void AsyncDataSink::Declare(const DataId *id, ValueType type) {
+  // Declarations always wait for room in the queue
+  Entry entry;
+  entry.datum.id = id;
+  entry.datum.type = type;
+  entry.declaration = true;
+  ring.Push(entry, OverflowPolicy::BLOCK);
+}
+
+void AsyncDataSink::Take(Datum<int8_t> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<int16_t> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<int32_t> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<int64_t> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<uint8_t> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<uint16_t> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<uint32_t> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<uint64_t> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<double> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::Take(Datum<float> datum) {
+  Enqueue(datum);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<int8_t> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<int16_t> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<int32_t> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<int64_t> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<uint8_t> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<uint16_t> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<uint32_t> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<uint64_t> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<double> &block) {
+  Enqueue(block);
+}
+
+void AsyncDataSink::TakeBlock(const DataBlock<float> &block) {
+  Enqueue(block);
+}
+
+}
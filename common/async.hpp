@@ -0,0 +1,166 @@
+#ifndef FDAS_COMMON_ASYNC_HPP_
+#define FDAS_COMMON_ASYNC_HPP_
+
+/**
+ * Asynchronous data sinking for the FDAS.
+ */
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+
+
+namespace fdas {
+
+/** What to do with new data when a bounded queue is full. */
+enum class OverflowPolicy {
+  BLOCK,       /**< Wait until there is room in the queue. */
+  DROP_NEWEST, /**< Discard the incoming datum. */
+  DROP_OLDEST  /**< Discard the oldest queued datum to make room. */
+};
+
+std::istream& operator>>(std::istream &in, OverflowPolicy &policy);
+std::ostream& operator<<(std::ostream &out, OverflowPolicy policy);
+
+
+/**
+ * Bounded lock-free single-producer/single-consumer ring.
+ *
+ * The capacity is rounded up to a power of two. The consumer claims each
+ * element with a compare-and-swap on the read index so that the producer can
+ * also advance it when discarding the oldest element. An element copied by
+ * the consumer while being overwritten is never returned, since its claim
+ * fails. Element types must therefore be trivially copyable.
+ */
+template<typename T> class SpscRing {
+  std::vector<T> slots;
+  size_t mask;
+  std::atomic<size_t> head{0}; /**< Next position to write, producer-owned. */
+  std::atomic<size_t> tail{0}; /**< Next position to read. */
+
+ public:
+  explicit SpscRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    slots.resize(size);
+    mask = size - 1;
+  }
+
+  size_t Capacity() const {return slots.size();}
+
+  /**
+   * Insert an element, called only by the producer.
+   * @return whether an element, the new or the oldest, was lost.
+   */
+  bool Push(const T &item, OverflowPolicy policy) {
+    bool lost = false;
+    size_t h = head.load(std::memory_order_relaxed);
+    for (;;) {
+      size_t t = tail.load(std::memory_order_acquire);
+      if (h - t < slots.size())
+        break;
+
+      if (policy == OverflowPolicy::DROP_NEWEST) {
+        return true;
+      } else if (policy == OverflowPolicy::DROP_OLDEST) {
+        if (tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel)) {
+          lost = true;
+          break;
+        }
+      } else {
+        std::this_thread::yield();
+      }
+    }
+
+    slots[h & mask] = item;
+    head.store(h + 1, std::memory_order_release);
+    return lost;
+  }
+
+  /**
+   * Remove the oldest element, called only by the consumer.
+   * @return false if the ring was empty.
+   */
+  bool Pop(T &item) {
+    size_t t = tail.load(std::memory_order_acquire);
+    for (;;) {
+      if (t == head.load(std::memory_order_acquire))
+        return false;
+      item = slots[t & mask];
+      if (tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel))
+        return true;
+    }
+  }
+};
+
+
+/**
+ * Data sink decorator which moves the work of another sink to a thread.
+ *
+ * Data is queued in a bounded lock-free ring and taken by the wrapped sink on
+ * a dedicated writer thread, so slow sinks do not stall acquisition. Only a
+ * single thread may feed the sink. When the ring is full the configured
+ * OverflowPolicy decides which data is lost; the losses are counted. The
+ * writer thread polls the wrapped sink whenever the ring is empty, the
+ * feeding thread never touches it.
+ */
+class AsyncDataSink : public DataSink {
+  /** Queue entry, a datum or a stream declaration. */
+  struct Entry {
+    AnyDatum datum;
+    bool declaration;
+  };
+
+  DataSinkPtr sink;
+  OverflowPolicy policy;
+  SpscRing<Entry> ring;
+  std::atomic<uint64_t> drops{0};
+  std::atomic<bool> running{true};
+  std::thread writer;
+
+  void Enqueue(const AnyDatum &datum);
+  template<typename DataType> void Enqueue(const DataBlock<DataType> &block);
+  void Drain();
+
+ public:
+  virtual void Declare(const DataId *id, ValueType type);
+  virtual void Take(Datum<int8_t> datum);
+  virtual void Take(Datum<int16_t> datum);
+  virtual void Take(Datum<int32_t> datum);
+  virtual void Take(Datum<int64_t> datum);
+  virtual void Take(Datum<uint8_t> datum);
+  virtual void Take(Datum<uint16_t> datum);
+  virtual void Take(Datum<uint32_t> datum);
+  virtual void Take(Datum<uint64_t> datum);
+  virtual void Take(Datum<double> datum);
+  virtual void Take(Datum<float> datum);
+  virtual void TakeBlock(const DataBlock<int8_t> &block);
+  virtual void TakeBlock(const DataBlock<int16_t> &block);
+  virtual void TakeBlock(const DataBlock<int32_t> &block);
+  virtual void TakeBlock(const DataBlock<int64_t> &block);
+  virtual void TakeBlock(const DataBlock<uint8_t> &block);
+  virtual void TakeBlock(const DataBlock<uint16_t> &block);
+  virtual void TakeBlock(const DataBlock<uint32_t> &block);
+  virtual void TakeBlock(const DataBlock<uint64_t> &block);
+  virtual void TakeBlock(const DataBlock<double> &block);
+  virtual void TakeBlock(const DataBlock<float> &block);
+
+  /** Number of data lost to queue overflows. */
+  uint64_t Drops() const {return drops.load(std::memory_order_relaxed);}
+
+  AsyncDataSink(DataSinkPtr sink, size_t capacity, OverflowPolicy policy);
+
+  /** Write all queued data and stop the writer thread. */
+  ~AsyncDataSink();
+};
+
+}// namespace fdas
+
+#endif//FDAS_COMMON_ASYNC_HPP_
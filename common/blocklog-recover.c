@@ -0,0 +1,134 @@
+/**
+ * Recover block logs left behind by a crash and extract their payload.
+ */
+
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "blocklog.h"
+
+
+/** Program version. */
+const char *argp_program_version = "blocklog-recover 0.1";
+
+/** Bug report address. */
+const char *argp_program_bug_address = "https://github.com/cea-ufmg/fdas3";
+
+/** Program documentation. */
+static char doc[] = "blocklog-recover -- Truncate block logs after their last valid block.";
+
+/** Description of the accepted arguments. */
+static char args_doc[] = "LOG...";
+
+/** Program options structure. */
+static struct argp_option options[] = {
+    {"cat", 'c', 0, 0,
+     "Write the concatenated block payloads to STDOUT after recovery"},
+    {0}
+};
+
+/** Program arguments structure. */
+typedef struct arguments {
+    char **logs;
+    int log_count;
+    bool cat;
+} arguments_t;
+
+
+/** Argument parser function */
+static error_t parse_opt (int key, char *arg, struct argp_state *state) {
+    //Get the arguments structure to write the parsed options
+    arguments_t *arguments = state->input;
+
+    switch (key) {
+    case 'c':
+        arguments->cat = true;
+        break;
+
+    case ARGP_KEY_ARGS:
+        arguments->logs = state->argv + state->next;
+        arguments->log_count = state->argc - state->next;
+        break;
+
+    case ARGP_KEY_NO_ARGS:
+        argp_error(state, "Not enough arguments.");
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+/** Argument parser object. */
+static struct argp argp = {options, parse_opt, args_doc, doc};
+
+
+/**
+ * Copy the block payloads of a recovered log to STDOUT.
+ * @return 0 if success, -1 if error.
+ */
+int cat_payload(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        syslog(LOG_ERR, "Error opening `%s`: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char buf[1 << 16];
+    blocklog_header_t header;
+    int status = 0;
+    while (!status && fread(&header, sizeof header, 1, file) == 1) {
+        for (size_t left = header.length; !status && left > 0;) {
+            size_t n = fread(buf, 1, left < sizeof buf ? left : sizeof buf,
+                             file);
+            if (!n) {
+                status = -1;
+            } else if (fwrite(buf, 1, n, stdout) != n) {
+                syslog(LOG_ERR, "Error writing payload: %s", strerror(errno));
+                status = -1;
+            }
+            left -= n;
+        }
+    }
+    if (ferror(file)) {
+        syslog(LOG_ERR, "Error reading `%s`: %s", path, strerror(errno));
+        status = -1;
+    }
+
+    fclose(file);
+    return status;
+}
+
+
+int main(int argc, char **argv) {
+    // Parse command line arguments
+    arguments_t arguments = {};
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    // Setup syslog
+    openlog(0, LOG_PERROR, 0);
+
+    int status = EXIT_SUCCESS;
+    for (int i=0; i<arguments.log_count; i++) {
+        const char *path = arguments.logs[i];
+        if (blocklog_recover(path) < 0) {
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if (arguments.cat && cat_payload(path))
+            status = EXIT_FAILURE;
+    }
+
+    return status;
+}
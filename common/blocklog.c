@@ -0,0 +1,470 @@
+/**
+ * Crash-safe checksummed block log writer.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blocklog.h"
+
+
+/** Delay before a block which failed is committed again, in ms. */
+#define BLOCKLOG_RETRY_MS 1000
+
+
+/** Buffer of a block, with room for its header before the payload. */
+typedef struct block_buffer {
+    char *data;
+    size_t capacity;        /**< Payload capacity. */
+    size_t used;            /**< Payload bytes. */
+} block_buffer_t;
+
+struct blocklog {
+    int fd;
+    unsigned commit_ms;
+    size_t commit_bytes;
+
+    // Shared by the writer and the commit thread, under the mutex
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    block_buffer_t pending;   /**< Writes of the next block. */
+    uint64_t pending_since;   /**< Time of the oldest pending write, ms. */
+    block_buffer_t sealed;    /**< Block to commit, kept until committed. */
+    uint64_t failed_at;       /**< Time the sealed block failed, ms. */
+    bool committing;          /**< Whether the thread owns `sealed`. */
+    bool closing;             /**< Whether the thread is to exit when idle. */
+    uint32_t sequence;        /**< Sequence number of the sealed block. */
+    off_t committed;          /**< File size up to the last synced block. */
+};
+
+
+/** CRC-32 lookup table, for the reflected polynomial 0xEDB88320. */
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t i=0; i<256; i++) {
+        uint32_t crc = i;
+        for (int bit=0; bit<8; bit++)
+            crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+        crc_table[i] = crc;
+    }
+}
+
+
+/**
+ * Update a CRC-32 with more data.
+ * Start with a crc of 0, the result of the last update is the CRC.
+ */
+uint32_t blocklog_crc32(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc_table_once, crc_table_init);
+
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+/** CRC of a block, covering the sequence number, length and payload. */
+static uint32_t block_crc(const blocklog_header_t *header,
+                          const void *payload) {
+    uint32_t crc = blocklog_crc32(0, &header->sequence,
+                                  sizeof header->sequence);
+    crc = blocklog_crc32(crc, &header->length, sizeof header->length);
+    return blocklog_crc32(crc, payload, header->length);
+}
+
+
+/** Monotonic time in milliseconds. */
+static uint64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * Make room in a buffer for a payload of `len` bytes.
+ * @return 0 if success, -1 if error.
+ */
+static int reserve(block_buffer_t *buffer, size_t len) {
+    if (len <= buffer->capacity)
+        return 0;
+
+    char *data = realloc(buffer->data, sizeof(blocklog_header_t) + len);
+    if (!data) {
+        syslog(LOG_ERR, "Error allocating block log buffer: %s",
+               strerror(errno));
+        return -1;
+    }
+    buffer->data = data;
+    buffer->capacity = len;
+    return 0;
+}
+
+
+/**
+ * Write a block at the end of the committed part of the file and flush it to
+ * the disk. On error the file is truncated back, so the block can be
+ * written again with the same sequence number.
+ * @return 0 if success, -1 if error.
+ */
+static int commit_block(blocklog_t *log, block_buffer_t *block,
+                        uint32_t sequence, off_t offset) {
+    blocklog_header_t header;
+    memcpy(header.magic, BLOCKLOG_MAGIC, sizeof header.magic);
+    header.sequence = sequence;
+    header.length = block->used;
+    header.crc = block_crc(&header, block->data + sizeof header);
+    memcpy(block->data, &header, sizeof header);
+
+    size_t size = sizeof header + block->used;
+    for (size_t done = 0; done < size;) {
+        ssize_t n = pwrite(log->fd, block->data + done, size - done,
+                           offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            syslog(LOG_ERR, "Error writing block log: %s", strerror(errno));
+            goto rollback;
+        }
+        done += n;
+    }
+
+    if (fdatasync(log->fd)) {
+        syslog(LOG_ERR, "Error syncing block log: %s", strerror(errno));
+        goto rollback;
+    }
+    return 0;
+
+rollback:
+    if (ftruncate(log->fd, offset))
+        syslog(LOG_ERR, "Error truncating block log: %s", strerror(errno));
+    return -1;
+}
+
+
+/**
+ * Hand the pending writes to the commit thread if it is idle, or have it
+ * retry a failed block. Call with the mutex held.
+ * @return 1 if the pending writes were handed over, 0 if not.
+ */
+static int seal_pending(blocklog_t *log) {
+    if (log->committing)
+        return 0;
+
+    log->committing = true;
+    pthread_cond_signal(&log->cond);
+    if (log->sealed.used)
+        return 0;
+
+    block_buffer_t sealed = log->sealed;
+    log->sealed = log->pending;
+    log->pending = sealed;
+    return 1;
+}
+
+
+/**
+ * Commit thread, writes and syncs the sealed blocks, so the writer does not
+ * wait for the disk. It also seals the pending writes once the oldest is
+ * `commit_ms` old, so they are committed even if the writer goes quiet. A
+ * block which fails is kept, with its sequence number, and committed again
+ * on the next request or after BLOCKLOG_RETRY_MS.
+ */
+static void* commit_thread(void *arg) {
+    blocklog_t *log = arg;
+
+    pthread_mutex_lock(&log->mutex);
+    for (;;) {
+        if (log->committing) {
+            uint32_t sequence = log->sequence;
+            off_t offset = log->committed;
+            pthread_mutex_unlock(&log->mutex);
+            int status = commit_block(log, &log->sealed, sequence, offset);
+            pthread_mutex_lock(&log->mutex);
+            if (!status) {
+                log->committed += sizeof(blocklog_header_t) + log->sealed.used;
+                log->sequence++;
+                log->sealed.used = 0;
+            } else {
+                log->failed_at = monotonic_ms();
+            }
+            log->committing = false;
+            pthread_cond_broadcast(&log->cond);
+        } else if (log->closing) {
+            break;
+        } else if (log->sealed.used || log->pending.used) {
+            uint64_t due = log->sealed.used
+                ? log->failed_at + BLOCKLOG_RETRY_MS
+                : log->pending_since + log->commit_ms;
+            if (monotonic_ms() >= due) {
+                seal_pending(log);
+            } else {
+                struct timespec ts = {due / 1000, due % 1000 * 1000000};
+                pthread_cond_timedwait(&log->cond, &log->mutex, &ts);
+            }
+        } else {
+            pthread_cond_wait(&log->cond, &log->mutex);
+        }
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return NULL;
+}
+
+
+/**
+ * Start the commit thread, with all signals blocked so they are still
+ * delivered to the threads of the program.
+ * @return 0 if success, -1 if error.
+ */
+static int start_commit(blocklog_t *log) {
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int status = pthread_create(&log->thread, NULL, commit_thread, log);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (status) {
+        syslog(LOG_ERR, "Error creating block log thread: %s",
+               strerror(status));
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Open a block log, replacing any existing file.
+ * @param commit_ms Longest time data waits to be committed, in ms.
+ * @param commit_bytes Amount of data committed at least together.
+ * @return The block log or NULL if error.
+ */
+blocklog_t* blocklog_open(const char *path, unsigned commit_ms,
+                          size_t commit_bytes) {
+    blocklog_t *log = calloc(1, sizeof(blocklog_t));
+    if (!log) {
+        syslog(LOG_ERR, "Error allocating block log: %s", strerror(errno));
+        return NULL;
+    }
+
+    // Leave room for the writes made while the previous block is synced
+    log->commit_ms = commit_ms;
+    log->commit_bytes = commit_bytes;
+    size_t capacity = commit_bytes ? 2 * commit_bytes : 1 << 12;
+    if (reserve(&log->pending, capacity) || reserve(&log->sealed, capacity))
+        goto error;
+
+    log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log->fd < 0) {
+        syslog(LOG_ERR, "Error opening block log `%s`: %s",
+               path, strerror(errno));
+        goto error;
+    }
+
+    // The commit thread times the pending writes on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&log->mutex, NULL);
+    pthread_cond_init(&log->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (start_commit(log)) {
+        pthread_mutex_destroy(&log->mutex);
+        pthread_cond_destroy(&log->cond);
+        close(log->fd);
+        goto error;
+    }
+    return log;
+
+error:
+    free(log->pending.data);
+    free(log->sealed.data);
+    free(log);
+    return NULL;
+}
+
+
+/**
+ * Commit the pending data and wait until it is on the disk, retrying a
+ * block that failed before.
+ * @return 0 if success, -1 if error.
+ */
+int blocklog_commit(blocklog_t *log) {
+    int status = 0;
+    bool retried = false;
+    pthread_mutex_lock(&log->mutex);
+    for (;;) {
+        if (log->committing) {
+            pthread_cond_wait(&log->cond, &log->mutex);
+        } else if (log->sealed.used && retried) {
+            status = -1;
+            break;
+        } else if (log->sealed.used || log->pending.used) {
+            retried = log->sealed.used != 0;
+            seal_pending(log);
+        } else {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return status;
+}
+
+
+/**
+ * Write data to the log, committing it according to the log policy.
+ * Writes are never split across blocks. The blocks are committed by a
+ * background thread, the writer only waits for it when the pending writes
+ * fill the buffer before the previous block is on the disk.
+ * @return 0 if success, -1 if the data could not be logged.
+ */
+int blocklog_write(blocklog_t *log, const void *data, size_t len) {
+    int status = 0;
+    pthread_mutex_lock(&log->mutex);
+    if (log->pending.used + len > log->pending.capacity
+        && log->pending.used) {
+        while (log->committing)
+            pthread_cond_wait(&log->cond, &log->mutex);
+        if (!seal_pending(log)) {
+            status = -1;
+            goto done;
+        }
+    }
+    if (reserve(&log->pending, len)) {
+        status = -1;
+        goto done;
+    }
+
+    // The first pending write starts the commit thread's timer
+    uint64_t now = monotonic_ms();
+    if (!log->pending.used) {
+        log->pending_since = now;
+        pthread_cond_broadcast(&log->cond);
+    }
+    memcpy(log->pending.data + sizeof(blocklog_header_t) + log->pending.used,
+           data, len);
+    log->pending.used += len;
+
+    if (log->pending.used >= log->commit_bytes
+        || now - log->pending_since >= log->commit_ms)
+        seal_pending(log);
+
+done:
+    pthread_mutex_unlock(&log->mutex);
+    return status;
+}
+
+
+/**
+ * Commit the pending data and close the log.
+ * @return 0 if success, -1 if error.
+ */
+int blocklog_close(blocklog_t *log) {
+    int status = blocklog_commit(log);
+
+    pthread_mutex_lock(&log->mutex);
+    log->closing = true;
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->mutex);
+    pthread_join(log->thread, NULL);
+    pthread_mutex_destroy(&log->mutex);
+    pthread_cond_destroy(&log->cond);
+
+    if (close(log->fd)) {
+        syslog(LOG_ERR, "Error closing block log: %s", strerror(errno));
+        status = -1;
+    }
+    free(log->pending.data);
+    free(log->sealed.data);
+    free(log);
+    return status;
+}
+
+
+/**
+ * Check a block read back from a log, whose payload is complete.
+ * @param sequence Sequence number expected for the block.
+ * @return 1 if the magic number, sequence number and CRC are right, 0 if not.
+ */
+int blocklog_check(const blocklog_header_t *header, const void *payload,
+                   uint32_t sequence) {
+    return !memcmp(header->magic, BLOCKLOG_MAGIC, sizeof header->magic)
+        && header->sequence == sequence
+        && block_crc(header, payload) == header->crc;
+}
+
+
+/**
+ * Truncate a block log after the last of its leading valid blocks.
+ * A block is valid if its magic number, sequence number and CRC are right
+ * and its payload is complete.
+ * @return The number of valid blocks or -1 if error.
+ */
+long blocklog_recover(const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        syslog(LOG_ERR, "Error opening block log `%s`: %s",
+               path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        syslog(LOG_ERR, "Error reading block log `%s`: %s",
+               path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    long count = 0;
+    off_t offset = 0;
+    char *payload = NULL;
+    size_t capacity = 0;
+    for (;;) {
+        blocklog_header_t header;
+        if (pread(fd, &header, sizeof header, offset) != sizeof header
+            || memcmp(header.magic, BLOCKLOG_MAGIC, sizeof header.magic)
+            || header.sequence != (uint32_t) count
+            || header.length > st.st_size - offset - sizeof header)
+            break;
+
+        if (header.length > capacity) {
+            char *grown = realloc(payload, header.length);
+            if (!grown)
+                break;
+            payload = grown;
+            capacity = header.length;
+        }
+        if (pread(fd, payload, header.length, offset + sizeof header)
+            != header.length || !blocklog_check(&header, payload, count))
+            break;
+
+        offset += sizeof header + header.length;
+        count++;
+    }
+    free(payload);
+
+    if (offset < st.st_size) {
+        syslog(LOG_WARNING, "Block log `%s`: dropping %lld bytes after %ld "
+               "valid blocks", path, (long long) (st.st_size - offset), count);
+        if (ftruncate(fd, offset)) {
+            syslog(LOG_ERR, "Error truncating block log `%s`: %s",
+                   path, strerror(errno));
+            count = -1;
+        }
+    }
+    close(fd);
+    return count;
+}
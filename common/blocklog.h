@@ -0,0 +1,65 @@
+/**
+ * Crash-safe checksummed block log writer.
+ *
+ * The log file is a sequence of blocks, each a blocklog_header_t followed
+ * by its payload. The header carries the payload length, the sequence
+ * number of the block and a CRC-32 of the sequence number, length and
+ * payload, so the valid part of a file cut short by a power loss can be
+ * told from the garbage after it and recovered with blocklog_recover().
+ *
+ * Writes are gathered in memory and committed as one block, written and
+ * flushed to the disk with fdatasync, once the oldest uncommitted write is
+ * `commit_ms` old or `commit_bytes` are pending. Those bound the data lost
+ * on a power cut, while the log only pays for one sync per block. The age
+ * is timed by the commit thread, so data written just before the writer
+ * goes quiet is still committed within `commit_ms`.
+ *
+ * Blocks are written and synced by a background thread while the writes go
+ * on to a second buffer, so blocklog_write() only waits for the disk when
+ * that buffer fills before the previous block is synced. A block is only
+ * counted once fdatasync succeeds: on error the file is truncated back to
+ * the last committed block and the failed block is kept, with its sequence
+ * number, to be written again before the next one.
+ */
+
+#ifndef BLOCKLOG_H
+#define BLOCKLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Block magic number. */
+#define BLOCKLOG_MAGIC "FDBL"
+
+/** Block header, in host byte order. */
+typedef struct blocklog_header {
+    char magic[4];     /**< BLOCKLOG_MAGIC, without the terminating NUL. */
+    uint32_t sequence; /**< Number of the block in the file, from zero. */
+    uint32_t length;   /**< Payload length in bytes. */
+    uint32_t crc;      /**< CRC-32 of sequence, length and payload. */
+} blocklog_header_t;
+
+/** Block log writer. */
+typedef struct blocklog blocklog_t;
+
+blocklog_t* blocklog_open(const char *path, unsigned commit_ms,
+                          size_t commit_bytes);
+int blocklog_write(blocklog_t *log, const void *data, size_t len);
+int blocklog_commit(blocklog_t *log);
+int blocklog_close(blocklog_t *log);
+long blocklog_recover(const char *path);
+int blocklog_check(const blocklog_header_t *header, const void *payload,
+                   uint32_t sequence);
+uint32_t blocklog_crc32(uint32_t crc, const void *data, size_t len);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//BLOCKLOG_H
@@ -0,0 +1,52 @@
+/**
+ * Mapping of device clocks onto the FDAS timebase.
+ */
+
+#include "clock.hpp"
+
+#include <cmath>
+
+
+namespace fdas {
+
+constexpr double ClockModel::kResetUs;
+
+ClockModel::ClockModel(double nominal_slope, double memory)
+    : nominal_slope(nominal_slope), decay(1 - 1 / memory),
+      slope(nominal_slope) {}
+
+void ClockModel::Reset() {
+  started = false;
+  weight = mean_x = mean_y = cxx = cxy = 0;
+  slope = nominal_slope;
+}
+
+void ClockModel::Observe(int64_t reading, uint64_t time_us) {
+  if (started) {
+    double error = static_cast<double>(time_us) - Map(reading);
+    if (std::fabs(error) > kResetUs)
+      Reset();
+  }
+  if (!started) {
+    started = true;
+    x0 = reading;
+    y0 = time_us;
+  }
+
+  // Exponentially weighted update of the means and co-moments, relative to
+  // the first observation to keep the precision of the doubles
+  double x = static_cast<double>(reading - x0);
+  double y = static_cast<double>(static_cast<int64_t>(time_us - y0));
+  weight = decay * weight + 1;
+  double dx = x - mean_x;
+  mean_x += dx / weight;
+  mean_y += (y - mean_y) / weight;
+  cxx = decay * cxx + dx * (x - mean_x);
+  cxy = decay * cxy + dx * (y - mean_y);
+
+  // Keep the nominal drift until the readings are spread out
+  if (cxx > 0 && weight >= 2)
+    slope = cxy / cxx;
+}
+
+}// namespace fdas
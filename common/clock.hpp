@@ -0,0 +1,73 @@
+#ifndef FDAS_COMMON_CLOCK_HPP_
+#define FDAS_COMMON_CLOCK_HPP_
+
+/**
+ * Mapping of device clocks onto the FDAS timebase.
+ */
+
+
+#include <cstdint>
+
+
+namespace fdas {
+
+/**
+ * Online linear model of a device clock against the system time.
+ *
+ * Maps a device clock reading, like an iio kernel timestamp in nanoseconds
+ * or the index of a scan, to microseconds since epoch on CLOCK_REALTIME,
+ * the timebase of the other devices. The offset and drift are fitted by
+ * least squares over the observations, with the weight of old ones decaying
+ * so the model follows slow drifts. It is meant to be updated once per
+ * buffer with the reading of the last scan and the time it was received,
+ * the samples in between being mapped without reading the clock.
+ *
+ * The reception latency biases the offset by its mean, the same for all
+ * devices read alike. The model restarts when an observation is further
+ * than kResetUs from it, like after a step of the system clock.
+ */
+class ClockModel {
+  double nominal_slope;
+  double decay;
+
+  bool started = false;
+  int64_t x0;          /**< Reference of the readings, the first one. */
+  uint64_t y0;         /**< Reference of the times, the first one. */
+  double weight = 0;   /**< Sum of the observation weights. */
+  double mean_x = 0, mean_y = 0;
+  double cxx = 0, cxy = 0;
+  double slope;
+
+ public:
+  /** Largest observation error before the model restarts. */
+  static constexpr double kResetUs = 1e6;
+
+  /**
+   * Create the model.
+   * @param nominal_slope Expected microseconds per clock unit, used until
+   *   the observations span enough to fit the drift.
+   * @param memory Number of observations over which the weights decay.
+   */
+  explicit ClockModel(double nominal_slope, double memory = 64);
+
+  /** Add the observation of a clock reading received at `time_us`. */
+  void Observe(int64_t reading, uint64_t time_us);
+
+  /** Time of a clock reading, in microseconds since epoch. */
+  uint64_t Map(int64_t reading) const {
+    if (!started)
+      return 0;
+    double y = mean_y + slope * (static_cast<double>(reading - x0) - mean_x);
+    return y0 + static_cast<int64_t>(y);
+  }
+
+  /** Fitted microseconds per clock unit. */
+  double Slope() const {return slope;}
+
+  /** Forget all observations. */
+  void Reset();
+};
+
+}// namespace fdas
+
+#endif//FDAS_COMMON_CLOCK_HPP_
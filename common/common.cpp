@@ -3,9 +3,23 @@
  */
 
 #include "common.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include <boost/log/trivial.hpp>
+
+#include "async.hpp"
+#include "control.hpp"
+#include "decimate.hpp"
+#include "delta.hpp"
+#include "registry.hpp"
+#include "stats.hpp"
+#include "trigger.hpp"
+
 namespace po = boost::program_options;
 using std::list;
 using std::shared_ptr;
@@ -15,64 +29,371 @@ using std::vector;
 
 namespace fdas {
 
+constexpr uint16_t DataId::kNoHandle;
+
+void AnyDatum::SendTo(DataSink &sink) const {
+  switch (type) {
+    case ValueType::INT8:
+      return sink.Take(Datum<int8_t>(id, Value<int8_t>(), timestamp));
+    case ValueType::INT16:
+      return sink.Take(Datum<int16_t>(id, Value<int16_t>(), timestamp));
+    case ValueType::INT32:
+      return sink.Take(Datum<int32_t>(id, Value<int32_t>(), timestamp));
+    case ValueType::INT64:
+      return sink.Take(Datum<int64_t>(id, Value<int64_t>(), timestamp));
+    case ValueType::UINT8:
+      return sink.Take(Datum<uint8_t>(id, Value<uint8_t>(), timestamp));
+    case ValueType::UINT16:
+      return sink.Take(Datum<uint16_t>(id, Value<uint16_t>(), timestamp));
+    case ValueType::UINT32:
+      return sink.Take(Datum<uint32_t>(id, Value<uint32_t>(), timestamp));
+    case ValueType::UINT64:
+      return sink.Take(Datum<uint64_t>(id, Value<uint64_t>(), timestamp));
+    case ValueType::DOUBLE:
+      return sink.Take(Datum<double>(id, Value<double>(), timestamp));
+    case ValueType::FLOAT:
+      return sink.Take(Datum<float>(id, Value<float>(), timestamp));
+  }
+}
+
+/** Longest time the lines written wait in the text log buffer. */
+static const std::chrono::milliseconds kTextFlushPeriod(500);
+
+TextFileDataSink::TextFileDataSink(const string &filename)
+    : file(std::fopen(filename.c_str(), "w")),
+      flush_time(std::chrono::steady_clock::now()) {
+  if (!file)
+    throw std::runtime_error("Could not open text log " + filename);
+  
+  // Allocate the buffer now rather than at the first datum
+  std::setvbuf(file, nullptr, _IOFBF, BUFSIZ);
+}
+
+TextFileDataSink::~TextFileDataSink() {
+  std::fclose(file);
+}
+
+/** Write a line with the identifier, the value and the timestamp. */
+template<typename DataType>
+void TextFileDataSink::Write(const Datum<DataType> &datum) {
+  const char *strid = datum.id->StrId();
+  unsigned long long timestamp = datum.timestamp;
+  if (std::is_floating_point<DataType>::value) {
+    std::fprintf(file, "\"%s\"\t%g\t%llu\n", strid,
+                 static_cast<double>(datum.data), timestamp);
+  } else if (std::is_signed<DataType>::value) {
+    std::fprintf(file, "\"%s\"\t%lld\t%llu\n", strid,
+                 static_cast<long long>(datum.data), timestamp);
+  } else {
+    std::fprintf(file, "\"%s\"\t%llu\t%llu\n", strid,
+                 static_cast<unsigned long long>(datum.data), timestamp);
+  }
+  FlushIfDue();
+}
+
+/**
+ * Flush the buffered lines every kTextFlushPeriod, so a reader killed
+ * without closing its sinks loses little and the log can be followed.
+ */
+void TextFileDataSink::FlushIfDue() {
+  auto now = std::chrono::steady_clock::now();
+  if (now - flush_time >= kTextFlushPeriod) {
+    std::fflush(file);
+    flush_time = now;
+  }
+}
+
 void TextFileDataSink::Take(Datum<int8_t> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<int16_t> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<int32_t> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<int64_t> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<uint8_t> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<uint16_t> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<uint32_t> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<uint64_t> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<double> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
 }
 
 void TextFileDataSink::Take(Datum<float> datum) {
-  this->ostream << '"' << datum.id->StrId() << '"' << '\t';
-  this->ostream << datum.data << '\t';
-  this->ostream << datum.timestamp << std::endl;
+  Write(datum);
+}
+
+constexpr char BinaryDataSink::kMagic[8];
+constexpr uint16_t BinaryDataSink::kVersion;
+constexpr size_t BinaryDataSink::kRecordSize;
+constexpr uint16_t BinaryDataSink::kDeclarationHandle;
+
+
+/** Registry handle of a stream, registering it if needed. */
+uint16_t BinaryDataSink::HandleOf(const DataId *id) {
+  if (id->Handle() != DataId::kNoHandle)
+    return id->Handle();
+  
+  auto it = unregistered.find(id);
+  if (it != unregistered.end())
+    return it->second;
+  
+  uint16_t handle = DataIdRegistry::Instance().Register(*id)->Handle();
+  unregistered[id] = handle;
+  return handle;
+}
+
+/**
+ * Append the header entry of a stream: its uint16 handle and uint8 value
+ * type followed by the NUL-terminated strid, description and units strings.
+ */
+void BinaryDataSink::AppendEntry(string &out, uint16_t handle,
+                                 ValueType type) {
+  const DataId *id = DataIdRegistry::Instance().Get(handle);
+  out.append(reinterpret_cast<const char*>(&handle), sizeof handle);
+  out.push_back(static_cast<char>(type));
+  out.append(id->StrId(), std::strlen(id->StrId()) + 1);
+  out.append(id->Description(), std::strlen(id->Description()) + 1);
+  out.append(id->Units(), std::strlen(id->Units()) + 1);
+}
+
+void BinaryDataSink::Declare(const DataId *id, ValueType type) {
+  uint16_t handle = HandleOf(id);
+  if (handle >= streams.size())
+    streams.resize(handle + 1, false);
+  if (streams[handle])
+    return;
+  
+  streams[handle] = true;
+  declared.emplace_back(handle, type);
+  if (header.empty())
+    return;
+  
+  // Announce the stream in the data and add it to the header, for the
+  // outputs which repeat it
+  string entry;
+  AppendEntry(entry, handle, type);
+  uint16_t count = declared.size();
+  std::memcpy(&header[sizeof kMagic + sizeof kVersion], &count, sizeof count);
+  header += entry;
+  OutputDeclaration(entry);
+}
+
+/**
+ * Write the stream header.
+ *
+ * Layout, in host byte order: the 8-byte magic number, the uint16 format
+ * version, the uint16 number of streams and then the entry of each stream,
+ * see BinaryDataSink::AppendEntry.
+ */
+void BinaryDataSink::WriteHeader() {
+  if (!header.empty())
+    return;
+  
+  uint16_t count = declared.size();
+  header.append(magic, sizeof kMagic);
+  header.append(reinterpret_cast<const char*>(&kVersion), sizeof kVersion);
+  header.append(reinterpret_cast<const char*>(&count), sizeof count);
+  for (const auto &entry: declared)
+    AppendEntry(header, entry.first, entry.second);
+  Output(header.data(), header.size());
+}
+
+/**
+ * Write a declaration record: the uint16 kDeclarationHandle followed by the
+ * header entry of the stream, in place of a data record.
+ */
+void BinaryDataSink::OutputDeclaration(const string &entry) {
+  string record(reinterpret_cast<const char*>(&kDeclarationHandle),
+                sizeof kDeclarationHandle);
+  record += entry;
+  Output(record.data(), record.size());
+}
+
+/**
+ * Streams not declared in advance are declared on their first data, in the
+ * header if it was not written yet, which is done before the first record.
+ */
+uint16_t BinaryDataSink::Accept(const DataId *id, ValueType type) {
+  uint16_t handle = HandleOf(id);
+  if (handle >= streams.size() || !streams[handle])
+    Declare(id, type);
+  WriteHeader();
+  return handle;
+}
+
+/**
+ * Write data records.
+ *
+ * Layout of each record, in host byte order: the uint16 stream handle, the
+ * uint64 timestamp and the value, zero-padded to 8 bytes.
+ */
+template<typename DataType>
+void BinaryDataSink::Write(const DataBlock<DataType> &block) {
+  static_assert(sizeof(DataType) <= 8, "Value does not fit in record");
+  
+  uint16_t handle = Accept(block.id, ValueTypeOf<DataType>());
+  
+  // Assemble the records in chunks to write them with fewer calls
+  const size_t chunk_records = 64;
+  char chunk[chunk_records * kRecordSize] = {};
+  for (size_t i=0; i<block.size; i+=chunk_records) {
+    size_t n = std::min(chunk_records, block.size - i);
+    for (size_t j=0; j<n; j++) {
+      char *record = chunk + j*kRecordSize;
+      std::memcpy(record, &handle, sizeof handle);
+      std::memcpy(record + 2, block.timestamps + i + j, sizeof(uint64_t));
+      std::memcpy(record + 10, block.data + i + j, sizeof(DataType));
+    }
+    Output(chunk, n * kRecordSize);
+  }
+}
+
+void BinaryDataSink::Take(Datum<int8_t> datum) {
+  Write(DataBlock<int8_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<int16_t> datum) {
+  Write(DataBlock<int16_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<int32_t> datum) {
+  Write(DataBlock<int32_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<int64_t> datum) {
+  Write(DataBlock<int64_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<uint8_t> datum) {
+  Write(DataBlock<uint8_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<uint16_t> datum) {
+  Write(DataBlock<uint16_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<uint32_t> datum) {
+  Write(DataBlock<uint32_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<uint64_t> datum) {
+  Write(DataBlock<uint64_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<double> datum) {
+  Write(DataBlock<double>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::Take(Datum<float> datum) {
+  Write(DataBlock<float>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<int8_t> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<int16_t> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<int32_t> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<int64_t> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<uint8_t> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<uint16_t> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<uint32_t> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<uint64_t> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<double> &block) {
+  Write(block);
+}
+
+void BinaryDataSink::TakeBlock(const DataBlock<float> &block) {
+  Write(block);
+}
+
+BinaryFileDataSink::~BinaryFileDataSink() {
+  // Make sure the file is self-describing even if no data was taken
+  WriteHeader();
+}
+
+void BinaryFileDataSink::Output(const char *data, size_t size) {
+  ostream.write(data, size);
+}
+
+SegmentLogDataSink::SegmentLogDataSink(const string &prefix,
+                                       size_t segment_size)
+    : log(seglog_open(prefix.c_str(), segment_size)) {
+  if (!log)
+    throw std::runtime_error("Could not open segment log " + prefix);
+}
+
+SegmentLogDataSink::~SegmentLogDataSink() {
+  WriteHeader();
+  seglog_close(log);
+}
+
+void SegmentLogDataSink::Output(const char *data, size_t size) {
+  // Start each new segment with the header, so it can be decoded alone
+  if (size > seglog_remaining(log) && !seglog_roll(log) && !Header().empty()
+      && seglog_write(log, Header().data(), Header().size()))
+    BOOST_LOG_TRIVIAL(error) << "Error writing header to segment log";
+  if (seglog_write(log, data, size))
+    BOOST_LOG_TRIVIAL(error) << "Error writing to segment log";
+}
+
+BlockLogDataSink::BlockLogDataSink(const string &path, unsigned commit_ms,
+                                   size_t commit_bytes)
+    : log(blocklog_open(path.c_str(), commit_ms, commit_bytes)) {
+  if (!log)
+    throw std::runtime_error("Could not open block log " + path);
+}
+
+BlockLogDataSink::~BlockLogDataSink() {
+  WriteHeader();
+  blocklog_close(log);
+}
+
+void BlockLogDataSink::Output(const char *data, size_t size) {
+  if (blocklog_write(log, data, size))
+    BOOST_LOG_TRIVIAL(error) << "Error writing to block log";
 }
 
 po::options_description GeneralOptions() {
@@ -87,21 +408,212 @@ po::options_description DataSinkOptions() {
   po::options_description desc("Common FDAS data sinking options");
   desc.add_options()
       ("log-data-text-file", po::value< vector<string> >(), 
-       "Log data into text file");
+       "Log data into text file")
+      ("log-data-text-file-async", po::value< vector<string> >(), 
+       "Log data into text file from a writer thread")
+      ("log-data-binary-file", po::value< vector<string> >(),
+       "Log data into self-describing binary file")
+      ("log-data-binary-file-async", po::value< vector<string> >(),
+       "Log data into self-describing binary file from a writer thread")
+      ("log-data-delta-file", po::value< vector<string> >(),
+       "Log data into delta-compressed binary file")
+      ("log-data-delta-file-async", po::value< vector<string> >(),
+       "Log data into delta-compressed binary file from a writer thread")
+      ("log-data-block-file", po::value< vector<string> >(),
+       "Log data into crash-safe checksummed block log file")
+      ("log-data-block-file-async", po::value< vector<string> >(),
+       "Log data into crash-safe checksummed block log file from a writer "
+       "thread")
+      ("log-data-segment-prefix", po::value< vector<string> >(),
+       "Log data into memory-mapped, preallocated segments PREFIX.NNNNNN")
+      ("log-data-segment-prefix-async", po::value< vector<string> >(),
+       "Log data into memory-mapped segments from a writer thread")
+      ("log-segment-size", po::value<size_t>()->default_value(64),
+       "Size of each log segment in MiB")
+      ("block-commit-ms", po::value<unsigned>()->default_value(100),
+       "Longest time data waits to be flushed to a block log, in ms")
+      ("block-commit-kib", po::value<size_t>()->default_value(64),
+       "Amount of data flushed at least together to a block log, in KiB")
+      ("async-queue-size",
+       po::value<size_t>()->default_value(65536),
+       "Number of data queued for each writer thread")
+      ("async-overflow-policy",
+       po::value<OverflowPolicy>()->default_value(OverflowPolicy::BLOCK),
+       "What to do when a writer thread queue is full: "
+       "block, drop-newest or drop-oldest")
+      ("decimate", po::value< vector<DecimationRule> >(),
+       "Decimate a stream in the decimated data sinks, STRID:FACTOR with an "
+       "anti-alias FIR filter or STRID:FACTOR:cic with a CIC filter")
+      ("decimated-sink", po::value< vector<string> >(),
+       "Data sink getting the decimated streams, OPTION=VALUE like "
+       "log-data-binary-file=slow.bin; without any, all data sinks do")
+      ("stats", po::value< vector<StatisticsRule> >(),
+       "Compute the min, max, mean and RMS of a stream over windows, "
+       "STRID:WINDOW for tumbling or STRID:WINDOW:STEP for sliding windows, "
+       "in seconds, the window a multiple of the step, as streams STRID.min, STRID.max, STRID.mean and STRID.rms")
+      ("stats-sink", po::value< vector<string> >(),
+       "Data sink getting only the statistics streams, OPTION=VALUE; without "
+       "any, all data sinks get them along with the data")
+      ("trigger-pre", po::value<double>(),
+       "Only record around triggers, starting this many seconds before each")
+      ("trigger-post", po::value<double>()->default_value(10),
+       "Seconds recorded after each trigger")
+      ("trigger-ring-size", po::value<size_t>()->default_value(1 << 16),
+       "Number of data kept for the pre-trigger window, 32 bytes each")
+      ("trigger-threshold", po::value< vector<TriggerThreshold> >(),
+       "Trigger when a stream crosses a level, STRID>LEVEL or STRID<LEVEL")
+      ("trigger-on-usr1", "Trigger on SIGUSR1")
+      ("control-socket", po::value<string>(),
+       "Accept data sink rotation and reconfiguration commands on this "
+       "Unix socket")
+      ("rotate-on-hup", "Rotate the data sink files on SIGHUP");
 
   return desc;
 }
 
+/** Options whose values each build a data sink, without the -async suffix. */
+static const char *kSinkOptions[] = {
+  "log-data-text-file", "log-data-binary-file", "log-data-delta-file",
+  "log-data-block-file", "log-data-segment-prefix"
+};
+
+/** Suffix of the options building sinks which run on a writer thread. */
+static const string kAsyncSuffix = "-async";
+
+list<DataSinkSpec> DataSinkSpecs(const po::variables_map &vm) {
+  list<DataSinkSpec> ret;
+  for (const string option: kSinkOptions) {
+    for (const string &name: {option, option + kAsyncSuffix}) {
+      if (vm.count(name)) {
+        for (const auto& value: vm[name].as<vector<string>>())
+          ret.push_back(DataSinkSpec{name, value});
+      }
+    }
+  }
+  return ret;
+}
+
+DataSinkPtr BuildDataSink(const DataSinkSpec &spec, const po::variables_map &vm) {
+  // Strip the async suffix to find the kind of sink
+  string option = spec.option;
+  bool async = option.size() > kAsyncSuffix.size()
+      && !option.compare(option.size() - kAsyncSuffix.size(),
+                         kAsyncSuffix.size(), kAsyncSuffix);
+  if (async)
+    option.resize(option.size() - kAsyncSuffix.size());
+  
+  DataSinkPtr sink;
+  if (option == "log-data-text-file") {
+    sink.reset(new TextFileDataSink(spec.value));
+  } else if (option == "log-data-binary-file") {
+    sink.reset(new BinaryFileDataSink(spec.value));
+  } else if (option == "log-data-delta-file") {
+    sink.reset(new DeltaFileDataSink(spec.value));
+  } else if (option == "log-data-block-file") {
+    unsigned commit_ms = vm["block-commit-ms"].as<unsigned>();
+    size_t commit_bytes = vm["block-commit-kib"].as<size_t>() << 10;
+    sink.reset(new BlockLogDataSink(spec.value, commit_ms, commit_bytes));
+  } else if (option == "log-data-segment-prefix") {
+    size_t segment_size = vm["log-segment-size"].as<size_t>() << 20;
+    sink.reset(new SegmentLogDataSink(spec.value, segment_size));
+  } else {
+    throw std::invalid_argument("Unknown data sink option " + spec.option);
+  }
+  
+  if (async) {
+    size_t queue_size = vm["async-queue-size"].as<size_t>();
+    OverflowPolicy policy = vm["async-overflow-policy"].as<OverflowPolicy>();
+    sink.reset(new AsyncDataSink(sink, queue_size, policy));
+  }
+  return sink;
+}
+
+/**
+ * Parse a data sink specification given as OPTION=VALUE.
+ * @throw std::invalid_argument if there is no `=`.
+ */
+static DataSinkSpec ParseDataSinkSpec(const string &text) {
+  size_t pos = text.find('=');
+  if (pos == string::npos)
+    throw std::invalid_argument("Data sink is not OPTION=VALUE: " + text);
+  return DataSinkSpec{text.substr(0, pos), text.substr(pos + 1)};
+}
+
+/**
+ * Build the sinks given as OPTION=VALUE by a program option, managed by a
+ * follower of `controller` if there is one.
+ */
+static DataSinkPtrList BuildOptionDataSinks(const po::variables_map &vm,
+                                            const string &option,
+                                            ControlledDataSink *controller) {
+  list<DataSinkSpec> specs;
+  for (const auto& value: vm[option].as<vector<string>>())
+    specs.push_back(ParseDataSinkSpec(value));
+
+  if (controller)
+    return DataSinkPtrList{
+      DataSinkPtr(new ControlledDataSink(specs, vm, controller))};
+
+  DataSinkPtrList ret;
+  for (const auto& spec: specs)
+    ret.push_back(BuildDataSink(spec, vm));
+  return ret;
+}
+
 DataSinkPtrList BuildDataSinks(const po::variables_map &vm) {
   DataSinkPtrList ret;
+  list<DataSinkSpec> specs = DataSinkSpecs(vm);
   
-  // Build text file data sinks
-  if (vm.count("log-data-text-file")) {
-    for (const auto& name: vm["log-data-text-file"].as<vector<string>>()) {
-      ret.push_back(DataSinkPtr(new TextFileDataSink(name)));
-    }
+  // With run-time control the sinks are managed by a ControlledDataSink
+  ControlledDataSink *controller = nullptr;
+  if (vm.count("control-socket") || vm.count("rotate-on-hup")) {
+    controller = new ControlledDataSink(specs, vm);
+    ret.push_back(DataSinkPtr(controller));
+  } else {
+    for (const auto& spec: specs)
+      ret.push_back(BuildDataSink(spec, vm));
   }
   
+  // Decimation feeds its own sinks, or all of them if there are none
+  if (vm.count("decimate")) {
+    auto rules = vm["decimate"].as<vector<DecimationRule>>();
+    if (vm.count("decimated-sink")) {
+      DataSinkPtrList decimated = BuildOptionDataSinks(vm, "decimated-sink",
+                                                       controller);
+      ret.push_back(DataSinkPtr(new DecimatingDataSink(decimated, rules)));
+    } else {
+      ret = DataSinkPtrList{DataSinkPtr(new DecimatingDataSink(ret, rules))};
+    }
+  }
+
+  // Statistics go to their own sinks, or along with the data to all
+  if (vm.count("stats")) {
+    auto rules = vm["stats"].as<vector<StatisticsRule>>();
+    if (vm.count("stats-sink")) {
+      DataSinkPtrList stats = BuildOptionDataSinks(vm, "stats-sink",
+                                                   controller);
+      ret.push_back(DataSinkPtr(new StatisticsDataSink(stats, rules, false)));
+    } else {
+      ret = DataSinkPtrList{
+        DataSinkPtr(new StatisticsDataSink(ret, rules, true))};
+    }
+  }
+
+  // With triggered recording all sinks get their data through the trigger
+  if (vm.count("trigger-pre")) {
+    uint64_t pre_us = vm["trigger-pre"].as<double>() * 1e6;
+    uint64_t post_us = vm["trigger-post"].as<double>() * 1e6;
+    size_t ring_size = vm["trigger-ring-size"].as<size_t>();
+    vector<TriggerThreshold> thresholds;
+    if (vm.count("trigger-threshold"))
+      thresholds = vm["trigger-threshold"].as<vector<TriggerThreshold>>();
+    if (vm.count("trigger-on-usr1"))
+      TriggeredDataSink::TriggerOnSignal();
+    
+    DataSinkPtr trigger(new TriggeredDataSink(ret, pre_us, post_us,
+                                              ring_size, thresholds));
+    ret = DataSinkPtrList{trigger};
+  }
   return ret;
 }
 
@@ -6,27 +6,62 @@
  */
 
 
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <list>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <boost/program_options.hpp>
 
+#include "blocklog.h"
+#include "seglog.h"
+
 
 namespace fdas {
   
+/** Type tags of the values carried by a Datum. */
+enum class ValueType : uint8_t {
+  INT8 = 0, INT16, INT32, INT64, UINT8, UINT16, UINT32, UINT64, DOUBLE, FLOAT
+};
+
+/** Type tag of a Datum value type. */
+template<typename DataType> constexpr ValueType ValueTypeOf();
+template<> constexpr ValueType ValueTypeOf<int8_t>() {return ValueType::INT8;}
+template<> constexpr ValueType ValueTypeOf<int16_t>() {return ValueType::INT16;}
+template<> constexpr ValueType ValueTypeOf<int32_t>() {return ValueType::INT32;}
+template<> constexpr ValueType ValueTypeOf<int64_t>() {return ValueType::INT64;}
+template<> constexpr ValueType ValueTypeOf<uint8_t>() {return ValueType::UINT8;}
+template<> constexpr ValueType ValueTypeOf<uint16_t>() {return ValueType::UINT16;}
+template<> constexpr ValueType ValueTypeOf<uint32_t>() {return ValueType::UINT32;}
+template<> constexpr ValueType ValueTypeOf<uint64_t>() {return ValueType::UINT64;}
+template<> constexpr ValueType ValueTypeOf<double>() {return ValueType::DOUBLE;}
+template<> constexpr ValueType ValueTypeOf<float>() {return ValueType::FLOAT;}
+
 /** Data identifier. */
 class DataId {
  protected:
   const char *strid; /**< Unique data identifier string. */
   const char *description = "";
   const char *units = "";
+  uint16_t handle = kNoHandle; /**< Handle given by the DataIdRegistry. */
+  
+  friend class DataIdRegistry;
   
  public:
+  /** Handle of identifiers which were not registered. */
+  static constexpr uint16_t kNoHandle = UINT16_MAX;
+  
   const char* Description() const {return description;}
   const char* Units() const {return units;}
   const char* StrId() const {return strid;}
+  uint16_t Handle() const {return handle;}
   
   DataId(const char *strid, const char *description, const char *units)
       : strid(strid), description(description), units(units) {}
@@ -46,8 +81,83 @@ template<typename DataType> class Datum {
 };
 
 
+/**
+ * Block of consecutive data points of a single stream.
+ *
+ * The values and timestamps are contiguous arrays owned by the producer and
+ * only valid during the call which hands the block over. The blocks of the
+ * channels of a multi-channel scan can share the same timestamp array.
+ */
+template<typename DataType> class DataBlock {
+ public:
+  const DataId * const id;
+  const DataType * const data;
+  const uint64_t * const timestamps;
+  const size_t size;
+  
+  DataBlock(const DataId *id, const DataType *data, const uint64_t *timestamps,
+            size_t size)
+      : id(id), data(data), timestamps(timestamps), size(size) {}
+  
+  Datum<DataType> operator[](size_t i) const {
+    return Datum<DataType>(id, data[i], timestamps[i]);
+  }
+};
+
+
+class DataSink;
+
+/**
+ * Data point of any of the DataSink value types.
+ * Used where data of mixed types has to be stored together, like queues.
+ */
+class AnyDatum {
+  char value[8]; /**< Value bytes, interpreted according to the type. */
+  
+ public:
+  const DataId *id;
+  uint64_t timestamp;
+  ValueType type;
+  
+  AnyDatum() = default;
+  
+  template<typename DataType> 
+  AnyDatum(const Datum<DataType> &datum)
+      : id(datum.id), timestamp(datum.timestamp),
+        type(ValueTypeOf<DataType>()) {
+    static_assert(sizeof(DataType) <= sizeof value, "Value too large");
+    std::memcpy(value, &datum.data, sizeof datum.data);
+  }
+  
+  /** Get the value, which must be of the stored type. */
+  template<typename DataType> DataType Value() const {
+    DataType data;
+    std::memcpy(&data, value, sizeof data);
+    return data;
+  }
+  
+  /** Pass the datum to a sink as a Datum of the stored type. */
+  void SendTo(DataSink &sink) const;
+};
+
 class DataSink {
  public:
+  virtual ~DataSink() {}
+  
+  /**
+   * Announce a data stream before any of its data is taken.
+   * Sinks which write self-describing headers use this to know all streams
+   * in advance, the others can ignore it.
+   */
+  virtual void Declare(const DataId *id, ValueType type) {}
+  
+  /**
+   * Do pending work between two data, without taking any.
+   * Sinks holding data back call this on their downstream sinks, so those
+   * can still act on requests, like a log rotation, while no data comes.
+   */
+  virtual void Poll() {}
+  
   virtual void Take(Datum<int8_t> datum) = 0;
   virtual void Take(Datum<int16_t> datum) = 0;
   virtual void Take(Datum<int32_t> datum) = 0;
@@ -58,12 +168,47 @@ class DataSink {
   virtual void Take(Datum<uint64_t> datum) = 0;
   virtual void Take(Datum<double> datum) = 0;
   virtual void Take(Datum<float> datum) = 0;
+  
+  /**
+   * Take a block of data of a single stream.
+   * By default each datum is taken individually, sinks which can do better
+   * with whole blocks override these.
+   */
+  virtual void TakeBlock(const DataBlock<int8_t> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<int16_t> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<int32_t> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<int64_t> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<uint8_t> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<uint16_t> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<uint32_t> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<uint64_t> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<double> &block) {TakeEach(block);}
+  virtual void TakeBlock(const DataBlock<float> &block) {TakeEach(block);}
+  
+ protected:
+  /** Take each datum of a block individually. */
+  template<typename DataType> void TakeEach(const DataBlock<DataType> &block) {
+    for (size_t i=0; i<block.size; i++)
+      Take(block[i]);
+  }
 };
 
+/**
+ * Data sink writing a text line per datum, with the stream identifier, the
+ * value and the timestamp. The lines are formatted into a stdio buffer
+ * allocated when the file is opened, and written as it fills.
+ */
 class TextFileDataSink : public DataSink {
-  std::ofstream ostream;
+  std::FILE *file;
+  std::chrono::steady_clock::time_point flush_time; /**< Of the last flush. */
+  
+  template<typename DataType> void Write(const Datum<DataType> &datum);
+  void FlushIfDue();
   
  public:
+  /** Flush the buffered lines if the last flush is old enough. */
+  virtual void Poll() {FlushIfDue();}
+  
   virtual void Take(Datum<int8_t> datum);
   virtual void Take(Datum<int16_t> datum);
   virtual void Take(Datum<int32_t> datum);
@@ -75,8 +220,148 @@ class TextFileDataSink : public DataSink {
   virtual void Take(Datum<double> datum);
   virtual void Take(Datum<float> datum);  
   
-  explicit TextFileDataSink(const char *filename) : ostream(filename) {}
-  explicit TextFileDataSink(const std::string &filename) : ostream(filename) {}
+  /**
+   * Open the file.
+   * @throw std::runtime_error if the file could not be opened.
+   */
+  explicit TextFileDataSink(const std::string &filename);
+  ~TextFileDataSink();
+};
+
+/**
+ * Data sink encoding a compact binary record stream.
+ *
+ * The stream starts with a header mapping the DataIdRegistry handle of every
+ * declared stream to its metadata, written once before the first record.
+ * Each datum is then written as a fixed-size record with the handle of its
+ * stream, the timestamp and the value. Streams first seen after the header
+ * are announced by a declaration in the stream, and added to the header
+ * given by Header(). See BinaryDataSink::WriteHeader, BinaryDataSink::Write
+ * and BinaryDataSink::OutputDeclaration for the exact layout. Derived
+ * classes choose where the bytes go.
+ */
+class BinaryDataSink : public DataSink {
+  std::unordered_map<const DataId*, uint16_t> unregistered;
+  std::vector<bool> streams; /**< Whether each handle's stream is declared. */
+  std::vector<std::pair<uint16_t, ValueType>> declared;
+  std::string header; /**< Encoded header, empty until written. */
+  const char *magic;  /**< Magic number of the encoding. */
+
+  uint16_t HandleOf(const DataId *id);
+  static void AppendEntry(std::string &out, uint16_t handle, ValueType type);
+  template<typename DataType> void Write(const DataBlock<DataType> &block);
+  
+ protected:
+  /** Encoder writing its header with a magic number other than kMagic. */
+  explicit BinaryDataSink(const char *magic) : magic(magic) {}
+  
+  /**
+   * Get the handle of a stream to be written, declaring the stream and
+   * writing the header if needed.
+   */
+  uint16_t Accept(const DataId *id, ValueType type);
+  
+  /** Write encoded bytes, always whole records, declarations or header. */
+  virtual void Output(const char *data, size_t size) = 0;
+  
+  /**
+   * Write the declaration of a stream first seen after the header.
+   * @param entry Header entry of the stream.
+   */
+  virtual void OutputDeclaration(const std::string &entry);
+  
+  /** Write the header, if not done yet. */
+  void WriteHeader();
+  
+  /** The encoded header with all streams so far, empty if not written yet. */
+  const std::string& Header() const {return header;}
+  
+ public:
+  /** Stream magic number, followed by the format version. */
+  static constexpr char kMagic[8] = {'F', 'D', 'A', 'S', 'B', 'I', 'N', 0};
+  static constexpr uint16_t kVersion = 3;
+  
+  /** Size in bytes of each data record. */
+  static constexpr size_t kRecordSize = 18;
+  
+  /** Handle starting the declaration records, never given to a stream. */
+  static constexpr uint16_t kDeclarationHandle = DataId::kNoHandle;
+  
+  BinaryDataSink() : magic(kMagic) {}
+  
+  virtual void Declare(const DataId *id, ValueType type);
+  virtual void Take(Datum<int8_t> datum);
+  virtual void Take(Datum<int16_t> datum);
+  virtual void Take(Datum<int32_t> datum);
+  virtual void Take(Datum<int64_t> datum);
+  virtual void Take(Datum<uint8_t> datum);
+  virtual void Take(Datum<uint16_t> datum);
+  virtual void Take(Datum<uint32_t> datum);
+  virtual void Take(Datum<uint64_t> datum);
+  virtual void Take(Datum<double> datum);
+  virtual void Take(Datum<float> datum);
+  virtual void TakeBlock(const DataBlock<int8_t> &block);
+  virtual void TakeBlock(const DataBlock<int16_t> &block);
+  virtual void TakeBlock(const DataBlock<int32_t> &block);
+  virtual void TakeBlock(const DataBlock<int64_t> &block);
+  virtual void TakeBlock(const DataBlock<uint8_t> &block);
+  virtual void TakeBlock(const DataBlock<uint16_t> &block);
+  virtual void TakeBlock(const DataBlock<uint32_t> &block);
+  virtual void TakeBlock(const DataBlock<uint64_t> &block);
+  virtual void TakeBlock(const DataBlock<double> &block);
+  virtual void TakeBlock(const DataBlock<float> &block);
+};
+
+/** Data sink writing a binary record stream to a file. */
+class BinaryFileDataSink : public BinaryDataSink {
+  std::ofstream ostream;
+  
+ protected:
+  virtual void Output(const char *data, size_t size);
+  
+ public:
+  explicit BinaryFileDataSink(const std::string &filename)
+      : ostream(filename, std::ios::binary) {}
+  ~BinaryFileDataSink();
+};
+
+/**
+ * Data sink writing a binary record stream to a memory-mapped segment log.
+ * Every segment starts with the stream header, so each can be decoded alone.
+ */
+class SegmentLogDataSink : public BinaryDataSink {
+  seglog_t *log;
+  
+ protected:
+  virtual void Output(const char *data, size_t size);
+  
+ public:
+  /**
+   * Open the segment log.
+   * @throw std::runtime_error if the first segment could not be created.
+   */
+  SegmentLogDataSink(const std::string &prefix, size_t segment_size);
+  ~SegmentLogDataSink();
+};
+
+/**
+ * Data sink writing a binary record stream to a checksummed block log.
+ * Data is flushed to the disk in blocks, see blocklog.h for the policy.
+ */
+class BlockLogDataSink : public BinaryDataSink {
+  blocklog_t *log;
+  
+ protected:
+  virtual void Output(const char *data, size_t size);
+  
+ public:
+  /**
+   * Open the block log.
+   * @throw std::runtime_error if the file could not be opened.
+   */
+  BlockLogDataSink(const std::string &path, unsigned commit_ms,
+                   size_t commit_bytes);
+  ~BlockLogDataSink();
 };
 
 typedef std::shared_ptr<DataSink> DataSinkPtr;
@@ -88,6 +373,23 @@ boost::program_options::options_description GeneralOptions();
 //** Data sinking program options. */
 boost::program_options::options_description DataSinkOptions();
 
+/** Specification of a data sink, the program option and value building it. */
+struct DataSinkSpec {
+  std::string option;
+  std::string value;
+};
+
+//** List the specifications of the data sinks in program options. */
+std::list<DataSinkSpec> DataSinkSpecs(
+    const boost::program_options::variables_map &vm);
+
+/**
+ * Create a data sink from its specification.
+ * @throw std::invalid_argument if the option does not build a sink.
+ */
+DataSinkPtr BuildDataSink(const DataSinkSpec &spec,
+                          const boost::program_options::variables_map &vm);
+
 //** Create the list of data sinks specified in program options. */
 DataSinkPtrList BuildDataSinks(const boost::program_options::variables_map &vm);
 
@@ -0,0 +1,321 @@
+/**
+ * Run-time control of the data sinks: log rotation and reconfiguration.
+ */
+
+#include "control.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boost/log/trivial.hpp>
+
+#include "trigger.hpp"
+
+namespace po = boost::program_options;
+using std::string;
+
+
+namespace fdas {
+
+/** How long the control thread waits for the feeding thread to switch. */
+static const std::chrono::seconds kSwitchTimeout(1);
+
+/** How often the control thread checks whether it should stop. */
+static const int kControlPollMs = 200;
+
+/** Self-pipe written by the SIGHUP handler. */
+static int hup_pipe[2] = {-1, -1};
+
+static void HupHandler(int) {
+  int saved_errno = errno;
+  char byte = 0;
+  if (write(hup_pipe[1], &byte, 1) < 0) {
+    // Nothing to do, a rotation is already pending
+  }
+  errno = saved_errno;
+}
+
+/** Create the control socket listening on the given path. */
+static int OpenControlSocket(const string &path) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof addr.sun_path)
+    throw std::runtime_error("Control socket path too long");
+  std::strcpy(addr.sun_path, path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    throw std::runtime_error(string("Error creating control socket: ")
+                             + std::strerror(errno));
+
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr)
+      || listen(fd, 4)) {
+    int bind_errno = errno;
+    close(fd);
+    throw std::runtime_error("Error binding control socket `" + path + "`: "
+                             + std::strerror(bind_errno));
+  }
+  return fd;
+}
+
+string ControlledDataSink::RotatedName(const string &name, unsigned rotation) {
+  if (!rotation)
+    return name;
+  return name + '.' + std::to_string(rotation);
+}
+
+ControlledDataSink::ControlledDataSink(const std::list<DataSinkSpec> &specs,
+                                       const po::variables_map &vm,
+                                       ControlledDataSink *leader)
+    : vm(vm), leader(leader) {
+  for (const auto& spec: specs)
+    config.push_back(Entry{spec, 0, Build(spec, 0), false});
+  active = std::make_shared<EntryList>(config);
+  retired.reserve(4);
+
+  if (leader) {
+    std::lock_guard<std::mutex> lock(leader->followers_mutex);
+    leader->followers.push_back(this);
+    control_thread = std::thread(&ControlledDataSink::Control, this);
+    return;
+  }
+
+  if (vm.count("control-socket"))
+    listen_fd = OpenControlSocket(vm["control-socket"].as<string>());
+
+  if (vm.count("rotate-on-hup")) {
+    if (hup_pipe[0] < 0) {
+      if (pipe2(hup_pipe, O_CLOEXEC | O_NONBLOCK))
+        throw std::runtime_error(string("Error creating SIGHUP pipe: ")
+                                 + std::strerror(errno));
+      struct sigaction action = {};
+      action.sa_handler = HupHandler;
+      action.sa_flags = SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      sigaction(SIGHUP, &action, nullptr);
+    }
+    signal_fd = hup_pipe[0];
+  }
+
+  control_thread = std::thread(&ControlledDataSink::Control, this);
+}
+
+ControlledDataSink::~ControlledDataSink() {
+  running.store(false);
+  control_thread.join();
+
+  // Whichever of a leader and its followers goes first unlinks the others
+  if (leader) {
+    std::lock_guard<std::mutex> lock(leader->followers_mutex);
+    auto& list = leader->followers;
+    list.erase(std::remove(list.begin(), list.end(), this), list.end());
+  }
+  std::lock_guard<std::mutex> lock(followers_mutex);
+  for (auto follower: followers)
+    follower->leader = nullptr;
+
+  if (listen_fd >= 0) {
+    close(listen_fd);
+    unlink(vm["control-socket"].as<string>().c_str());
+  }
+}
+
+/** Build a sink, with the file names of the given rotation. */
+DataSinkPtr ControlledDataSink::Build(const DataSinkSpec &spec,
+                                      unsigned rotation) {
+  DataSinkSpec rotated{spec.option, RotatedName(spec.value, rotation)};
+  return BuildDataSink(rotated, vm);
+}
+
+void ControlledDataSink::Declare(const DataId *id, ValueType type) {
+  std::lock_guard<std::mutex> lock(mutex);
+  declarations.emplace_back(id, type);
+  for (const auto& entry: *active)
+    entry.sink->Declare(id, type);
+}
+
+/**
+ * Switch to the staged sinks, called by the feeding thread.
+ * The new sinks get the stream declarations here, so they see all of them.
+ */
+void ControlledDataSink::Switch() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!staged)
+    return;
+
+  for (auto& entry: *staged) {
+    if (entry.fresh) {
+      for (const auto& declaration: declarations)
+        entry.sink->Declare(declaration.first, declaration.second);
+      entry.fresh = false;
+    }
+  }
+
+  // Never destroy the replaced set here, another switch may have come
+  // before the control thread took the previous one
+  retired.push_back(std::move(active));
+  active = std::move(staged);
+  pending.store(false, std::memory_order_release);
+  switch_time = Clock::now();
+  switched.notify_all();
+}
+
+/**
+ * Hand a new sink configuration over to the feeding thread and wait for it
+ * to switch.
+ * @return the reply to the command.
+ */
+string ControlledDataSink::Stage(EntryList entries,
+                                 Clock::time_point request_time) {
+  std::unique_lock<std::mutex> lock(mutex);
+  staged = std::make_shared<EntryList>(entries);
+  pending.store(true, std::memory_order_release);
+
+  // Make room for the set the switch replaces, so the feeding thread does
+  // not allocate; a set replaced while still staged is never switched to
+  retired.reserve(retired.size() + 1);
+
+  config = std::move(entries);
+  for (auto& entry: config)
+    entry.fresh = false;
+
+  if (!switched.wait_for(lock, kSwitchTimeout, [this] {return !staged;}))
+    return "ok pending until the next datum";
+
+  auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+      switch_time - request_time).count();
+  BOOST_LOG_TRIVIAL(info) << "Data sinks switched " << latency
+                          << " us after request";
+  return "ok switched in " + std::to_string(latency) + " us";
+}
+
+/**
+ * Execute a control command.
+ * @return the reply to the command.
+ */
+string ControlledDataSink::Execute(const string &command) {
+  Clock::time_point request_time = Clock::now();
+  std::istringstream in(command);
+  string verb;
+  in >> verb;
+
+  try {
+    if (verb == "rotate") {
+      EntryList entries;
+      for (const auto& entry: config) {
+        unsigned rotation = entry.rotation + 1;
+        entries.push_back(
+            Entry{entry.spec, rotation, Build(entry.spec, rotation), true});
+      }
+      string reply = Stage(std::move(entries), request_time);
+
+      std::lock_guard<std::mutex> lock(followers_mutex);
+      for (auto follower: followers) {
+        string followed = follower->Execute(command);
+        if (!followed.compare(0, 5, "error"))
+          return followed;
+      }
+      return reply;
+    } else if (verb == "add") {
+      DataSinkSpec spec;
+      if (!(in >> spec.option >> spec.value))
+        return "error usage: add OPTION VALUE";
+      EntryList entries = config;
+      entries.push_back(Entry{spec, 0, Build(spec, 0), true});
+      return Stage(std::move(entries), request_time);
+    } else if (verb == "remove") {
+      string value;
+      if (!(in >> value))
+        return "error usage: remove VALUE";
+      EntryList entries;
+      for (const auto& entry: config) {
+        if (entry.spec.value != value)
+          entries.push_back(entry);
+      }
+      if (entries.size() == config.size())
+        return "error no sink with value " + value;
+      return Stage(std::move(entries), request_time);
+    } else if (verb == "trigger") {
+      TriggeredDataSink::TriggerAll();
+      return "ok";
+    } else if (verb == "list") {
+      string reply;
+      for (const auto& entry: config) {
+        reply += entry.spec.option + ' '
+            + RotatedName(entry.spec.value, entry.rotation) + '\n';
+      }
+      return reply + "ok";
+    }
+  } catch (const std::exception &e) {
+    return string("error ") + e.what();
+  }
+
+  return "error unknown command `" + verb + "`";
+}
+
+/** Control thread body, waits for and executes commands. */
+void ControlledDataSink::Control() {
+  std::vector<std::shared_ptr<EntryList>> done;
+  done.reserve(4);
+  while (running.load()) {
+    // Close the sinks replaced in the last switches, keeping the capacity
+    // of both lists so the feeding thread does not allocate
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done.swap(retired);
+    }
+    done.clear();
+
+    struct pollfd fds[2];
+    nfds_t nfds = 0;
+    if (listen_fd >= 0)
+      fds[nfds++] = {listen_fd, POLLIN, 0};
+    if (signal_fd >= 0)
+      fds[nfds++] = {signal_fd, POLLIN, 0};
+
+    if (poll(fds, nfds, kControlPollMs) <= 0)
+      continue;
+
+    for (nfds_t i=0; i<nfds; i++) {
+      if (!(fds[i].revents & POLLIN))
+        continue;
+
+      if (fds[i].fd == signal_fd) {
+        char bytes[16];
+        while (read(signal_fd, bytes, sizeof bytes) > 0) {}
+        BOOST_LOG_TRIVIAL(info) << "SIGHUP: " << Execute("rotate");
+        continue;
+      }
+
+      int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client < 0)
+        continue;
+      struct timeval timeout = {1, 0};
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+      char buf[1024];
+      ssize_t n = recv(client, buf, sizeof buf - 1, 0);
+      if (n > 0) {
+        buf[n] = 0;
+        string reply = Execute(string(buf, std::strcspn(buf, "\r\n"))) + '\n';
+        if (send(client, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+          BOOST_LOG_TRIVIAL(warning) << "Error replying to control command: "
+                                     << std::strerror(errno);
+      }
+      close(client);
+    }
+  }
+}
+
+}
@@ -0,0 +1,152 @@
+#ifndef FDAS_COMMON_CONTROL_HPP_
+#define FDAS_COMMON_CONTROL_HPP_
+
+/**
+ * Run-time control of the data sinks: log rotation and reconfiguration.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "common.hpp"
+
+
+namespace fdas {
+
+/**
+ * Data sink forwarding to a set of sinks which can change while running.
+ *
+ * A control thread takes commands from a local Unix socket and, optionally,
+ * rotates the files on SIGHUP. Commands are one line each:
+ *
+ *   rotate          reopen all sinks with the next rotation file names
+ *   add OPTION VAL  add a sink as given by a sink program option and value
+ *   remove VAL      remove the sinks with the given value
+ *   list            list the active sinks
+ *   trigger         fire the triggers of triggered recording
+ *
+ * The control thread opens the new sinks and hands the new set over. The
+ * feeding thread switches to it between two data, replaying the stream
+ * declarations on the new sinks and swapping a pointer, so no data is lost.
+ * The replaced sinks are flushed and closed by the control thread. The time
+ * from request to switch is measured and reported.
+ *
+ * Sinks fed with other data, like the decimated or statistics sinks, are
+ * managed by followers of the sink with the control socket: they have no
+ * socket or SIGHUP handling of their own and rotate along with their leader.
+ */
+class ControlledDataSink : public DataSink {
+  /** A managed sink. */
+  struct Entry {
+    DataSinkSpec spec;
+    unsigned rotation;
+    DataSinkPtr sink;
+    bool fresh; /**< Whether the sink still needs the declarations. */
+  };
+  typedef std::vector<Entry> EntryList;
+  typedef std::chrono::steady_clock Clock;
+
+  boost::program_options::variables_map vm;
+
+  /** Sinks in use by the feeding thread. */
+  std::shared_ptr<EntryList> active;
+  std::atomic<bool> pending{false};
+
+  /** Control state, guarded by the mutex. */
+  std::mutex mutex;
+  std::condition_variable switched;
+  std::shared_ptr<EntryList> staged;
+  /** Sets replaced in the switches, destroyed by the control thread. */
+  std::vector<std::shared_ptr<EntryList>> retired;
+  std::vector<std::pair<const DataId*, ValueType>> declarations;
+  Clock::time_point switch_time;
+
+  /** Configuration, only used by the control thread. */
+  EntryList config;
+
+  /** Sinks rotating along with this one, and the one this one follows. */
+  std::mutex followers_mutex;
+  std::vector<ControlledDataSink*> followers;
+  ControlledDataSink *leader = nullptr;
+
+  int listen_fd = -1;
+  int signal_fd = -1;
+  std::atomic<bool> running{true};
+  std::thread control_thread;
+
+  void Switch();
+  void Control();
+  std::string Execute(const std::string &command);
+  std::string Stage(EntryList entries, Clock::time_point request_time);
+  DataSinkPtr Build(const DataSinkSpec &spec, unsigned rotation);
+
+  template<typename DataType> void Forward(const Datum<DataType> &datum) {
+    Poll();
+    for (const auto& entry: *active)
+      entry.sink->Take(datum);
+  }
+
+  template<typename DataType> void Forward(const DataBlock<DataType> &block) {
+    Poll();
+    for (const auto& entry: *active)
+      entry.sink->TakeBlock(block);
+  }
+
+ public:
+  /** File name of a sink after a number of rotations. */
+  static std::string RotatedName(const std::string &name, unsigned rotation);
+
+  /**
+   * Build the initial sinks and start the control thread.
+   * @param leader Sink to follow the rotations of, or null to take commands
+   *   from the control socket and SIGHUP.
+   * @throw std::runtime_error if the control socket could not be opened.
+   */
+  ControlledDataSink(const std::list<DataSinkSpec> &specs,
+                     const boost::program_options::variables_map &vm,
+                     ControlledDataSink *leader = nullptr);
+  ~ControlledDataSink();
+
+  /** Switch to the staged sinks if there are any, between two data. */
+  virtual void Poll() final {
+    if (pending.load(std::memory_order_acquire))
+      Switch();
+  }
+
+  virtual void Declare(const DataId *id, ValueType type);
+  virtual void Take(Datum<int8_t> datum) {Forward(datum);}
+  virtual void Take(Datum<int16_t> datum) {Forward(datum);}
+  virtual void Take(Datum<int32_t> datum) {Forward(datum);}
+  virtual void Take(Datum<int64_t> datum) {Forward(datum);}
+  virtual void Take(Datum<uint8_t> datum) {Forward(datum);}
+  virtual void Take(Datum<uint16_t> datum) {Forward(datum);}
+  virtual void Take(Datum<uint32_t> datum) {Forward(datum);}
+  virtual void Take(Datum<uint64_t> datum) {Forward(datum);}
+  virtual void Take(Datum<double> datum) {Forward(datum);}
+  virtual void Take(Datum<float> datum) {Forward(datum);}
+  virtual void TakeBlock(const DataBlock<int8_t> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<int16_t> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<int32_t> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<int64_t> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<uint8_t> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<uint16_t> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<uint32_t> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<uint64_t> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<double> &block) {Forward(block);}
+  virtual void TakeBlock(const DataBlock<float> &block) {Forward(block);}
+};
+
+}// namespace fdas
+
+#endif//FDAS_COMMON_CONTROL_HPP_
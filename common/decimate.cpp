@@ -0,0 +1,228 @@
+/**
+ * Streaming decimation of data streams for the FDAS.
+ */
+
+#include "decimate.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <istream>
+
+#include <boost/log/trivial.hpp>
+
+using std::string;
+
+
+namespace fdas {
+
+constexpr int Decimator::kOrder;
+constexpr size_t DecimatingDataSink::kOutputBlockSize;
+
+/** Number of FIR taps per unit of decimation factor. */
+static const size_t kTapsPerFactor = 16;
+
+/** Input samples held by the FIR window besides the filter history. */
+static const size_t kWindowChunk = 1024;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FDAS_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define FDAS_TARGET_CLONES
+#endif
+
+/**
+ * Dot product of the taps and the input window, four lanes at a time.
+ * Compiled for AVX2 and the baseline and chosen for the CPU at load time.
+ */
+FDAS_TARGET_CLONES
+static double Dot(const double *a, const double *b, size_t n) {
+  typedef double Lanes __attribute__((vector_size(32)));
+  Lanes sum = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    Lanes x, y;
+    std::memcpy(&x, a + i, sizeof x);
+    std::memcpy(&y, b + i, sizeof y);
+    sum += x * y;
+  }
+
+  double ret = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+  for (; i < n; i++)
+    ret += a[i] * b[i];
+  return ret;
+}
+
+std::istream& operator>>(std::istream &in, DecimationRule &rule) {
+  string token;
+  in >> token;
+
+  // The filter is optional, the stream identifier may contain colons
+  rule.filter = DecimationFilter::FIR;
+  size_t pos = token.rfind(':');
+  if (pos != string::npos && (token.substr(pos + 1) == "fir"
+                              || token.substr(pos + 1) == "cic")) {
+    if (token.substr(pos + 1) == "cic")
+      rule.filter = DecimationFilter::CIC;
+    token.resize(pos);
+    pos = token.rfind(':');
+  }
+  if (pos == 0 || pos == string::npos || pos + 1 == token.size()) {
+    in.setstate(std::ios_base::failbit);
+    return in;
+  }
+
+  rule.strid = token.substr(0, pos);
+  try {
+    size_t end;
+    unsigned long factor = std::stoul(token.substr(pos + 1), &end);
+    rule.factor = static_cast<unsigned>(factor);
+    if (pos + 1 + end != token.size() || factor == 0 || factor > 1 << 16)
+      in.setstate(std::ios_base::failbit);
+  } catch (const std::exception&) {
+    in.setstate(std::ios_base::failbit);
+  }
+  return in;
+}
+
+Decimator::Decimator(unsigned factor, DecimationFilter filter)
+    : factor(factor), filter(filter), gain(std::pow(factor, kOrder)) {
+  // Blackman-windowed sinc, cutting off at 80% of the output Nyquist rate
+  const size_t n = kTapsPerFactor * factor + 1;
+  const double cutoff = 0.4 / factor;
+  double sum = 0;
+  taps.resize(n);
+  for (size_t k=0; k<n; k++) {
+    double m = k - (n - 1) / 2.0;
+    double sinc = m == 0 ? 2 * cutoff
+        : std::sin(2 * M_PI * cutoff * m) / (M_PI * m);
+    double window = 0.42 - 0.5 * std::cos(2 * M_PI * k / (n - 1))
+        + 0.08 * std::cos(4 * M_PI * k / (n - 1));
+    taps[k] = sinc * window;
+    sum += taps[k];
+  }
+  for (auto& tap: taps)
+    tap /= sum;
+
+  samples.resize(n - 1 + kWindowChunk);
+  times.resize(samples.size());
+}
+
+bool Decimator::PushFir(double value, uint64_t timestamp, double *out,
+                        uint64_t *out_timestamp) {
+  const size_t n = taps.size();
+  if (fill == samples.size()) {
+    // Keep the last n - 1 samples, the history of the next output
+    std::copy(samples.end() - (n - 1), samples.end(), samples.begin());
+    std::copy(times.end() - (n - 1), times.end(), times.begin());
+    fill = n - 1;
+  }
+  samples[fill] = value;
+  times[fill] = timestamp;
+  fill++;
+
+  if (fill < n || ++phase < factor)
+    return false;
+  phase = 0;
+
+  // The taps are symmetric, the output is at the middle of the window
+  *out = Dot(taps.data(), samples.data() + fill - n, n);
+  *out_timestamp = times[fill - 1 - (n - 1) / 2];
+  return true;
+}
+
+/** The gain is factor^kOrder, kOrder * ceil(log2(factor)) bits. */
+unsigned Decimator::CicGrowth(unsigned factor) {
+  unsigned bits = 0;
+  while ((1ul << bits) < factor)
+    bits++;
+  return kOrder * bits;
+}
+
+bool Decimator::PushCic(int64_t value, uint64_t timestamp, double *out,
+                        uint64_t *out_timestamp) {
+  uint64_t acc = static_cast<uint64_t>(value);
+  for (int i=0; i<kOrder; i++)
+    acc = integrators[i] += acc;
+  if (++phase < factor)
+    return false;
+  phase = 0;
+
+  for (int i=0; i<kOrder; i++) {
+    uint64_t previous = combs[i];
+    combs[i] = acc;
+    acc -= previous;
+  }
+
+  // The group delay is kOrder * (factor - 1) / 2 input samples
+  double period = last_time ? double(timestamp - last_time) / factor : 0;
+  last_time = timestamp;
+  if (warmup < kOrder) {
+    warmup++;
+    return false;
+  }
+  *out = static_cast<int64_t>(acc) / gain;
+  *out_timestamp = timestamp - static_cast<uint64_t>(
+      kOrder * (factor - 1) / 2.0 * period);
+  return true;
+}
+
+/**
+ * Number of bits of the values of an integer type as signed integers, 0 for
+ * the floating point types.
+ */
+static unsigned SignedBits(ValueType type) {
+  switch (type) {
+    case ValueType::INT8: return 8;
+    case ValueType::INT16: return 16;
+    case ValueType::INT32: return 32;
+    case ValueType::INT64: return 64;
+    case ValueType::UINT8: return 9;
+    case ValueType::UINT16: return 17;
+    case ValueType::UINT32: return 33;
+    case ValueType::UINT64: return 65;
+    default: return 0;
+  }
+}
+
+DecimatingDataSink::DecimatingDataSink(DataSinkPtrList downstream,
+                                       std::vector<DecimationRule> rules)
+    : downstream(std::move(downstream)), rules(std::move(rules)),
+      values(kOutputBlockSize), timestamps(kOutputBlockSize) {}
+
+void DecimatingDataSink::Declare(const DataId *id, ValueType type) {
+  for (const auto& rule: rules) {
+    if (rule.strid != id->StrId())
+      continue;
+    if (id->Handle() == DataId::kNoHandle) {
+      BOOST_LOG_TRIVIAL(warning) << "Stream " << rule.strid
+                                 << " is not registered, not decimated";
+      break;
+    }
+
+    // The wrapping CIC arithmetic is only exact if the output fits 64 bits
+    DecimationFilter filter = rule.filter;
+    unsigned bits = SignedBits(type);
+    if (filter == DecimationFilter::CIC && !bits) {
+      BOOST_LOG_TRIVIAL(warning) << "Stream " << rule.strid << " is not an "
+                                 << "integer stream, decimated with FIR";
+      filter = DecimationFilter::FIR;
+    } else if (filter == DecimationFilter::CIC
+               && bits + Decimator::CicGrowth(rule.factor) > 64) {
+      BOOST_LOG_TRIVIAL(warning) << "CIC decimation of stream " << rule.strid
+                                 << " by " << rule.factor << " could "
+                                 << "overflow 64 bits, decimated with FIR";
+      filter = DecimationFilter::FIR;
+    }
+    if (decimators.size() <= id->Handle())
+      decimators.resize(id->Handle() + 1);
+    decimators[id->Handle()].reset(new Decimator(rule.factor, filter));
+    type = ValueType::DOUBLE;
+    break;
+  }
+
+  for (const auto& sink: downstream)
+    sink->Declare(id, type);
+}
+
+}// namespace fdas
@@ -0,0 +1,192 @@
+#ifndef FDAS_COMMON_DECIMATE_HPP_
+#define FDAS_COMMON_DECIMATE_HPP_
+
+/**
+ * Streaming decimation of data streams for the FDAS.
+ */
+
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "common.hpp"
+
+
+namespace fdas {
+
+/** Anti-alias filter of a decimation. */
+enum class DecimationFilter {
+  FIR, /**< Windowed-sinc low-pass, for any stream. */
+  CIC  /**< Third-order cascaded integrator-comb, for integer streams. */
+};
+
+/** Decimation of a stream, like `STRID:FACTOR[:fir|cic]`. */
+struct DecimationRule {
+  std::string strid;
+  unsigned factor;
+  DecimationFilter filter = DecimationFilter::FIR;
+};
+
+std::istream& operator>>(std::istream &in, DecimationRule &rule);
+
+/**
+ * Decimating filter of a stream.
+ *
+ * Keeps one sample out of `factor` of the low-pass filtered stream. The FIR
+ * filter has 16 taps per unit of factor, computed only for the kept samples
+ * over a window of the input held in a preallocated buffer. The CIC filter
+ * runs in exact integer arithmetic. Both delay the output timestamps by the
+ * group delay of the filter, so the decimated stream lines up with the
+ * input. Nothing is allocated after construction.
+ */
+class Decimator {
+  unsigned factor;
+  DecimationFilter filter;
+  unsigned phase = 0;       /**< Samples taken since the last output. */
+
+  // FIR filter
+  std::vector<double> taps;
+  std::vector<double> samples;     /**< Input window, compacted when full. */
+  std::vector<uint64_t> times;
+  size_t fill = 0;
+
+  // CIC filter, wrapping around like the hardware ones
+  static constexpr int kOrder = 3;
+  uint64_t integrators[kOrder] = {};
+  uint64_t combs[kOrder] = {};     /**< Previous input of each comb. */
+  double gain;
+  unsigned warmup = 0;             /**< Outputs before the combs are full. */
+  uint64_t last_time = 0;          /**< Time of the previous output. */
+
+  bool PushFir(double value, uint64_t timestamp, double *out,
+               uint64_t *out_timestamp);
+  bool PushCic(int64_t value, uint64_t timestamp, double *out,
+               uint64_t *out_timestamp);
+
+ public:
+  Decimator(unsigned factor, DecimationFilter filter);
+
+  /** Bits the CIC filter adds to its input for a factor. */
+  static unsigned CicGrowth(unsigned factor);
+
+  /**
+   * Take a sample.
+   * @return whether an output sample was produced in `out` and
+   *   `out_timestamp`.
+   */
+  template<typename DataType>
+  bool Push(DataType value, uint64_t timestamp, double *out,
+            uint64_t *out_timestamp) {
+    if (filter == DecimationFilter::CIC && std::is_integral<DataType>::value) {
+      return PushCic(static_cast<int64_t>(value), timestamp, out,
+                     out_timestamp);
+    }
+    return PushFir(static_cast<double>(value), timestamp, out, out_timestamp);
+  }
+};
+
+/**
+ * Data sink decimating some streams before passing them on.
+ *
+ * The streams with a rule are passed on decimated, as double values under
+ * the same identifier, the others unchanged. Blocks are decimated as
+ * blocks, split in preallocated output blocks of up to kOutputBlockSize
+ * samples. CIC rules whose output could overflow 64 bits for the type of
+ * the stream fall back to FIR. Only a single thread may feed the sink.
+ */
+class DecimatingDataSink : public DataSink {
+  DataSinkPtrList downstream;
+  std::vector<DecimationRule> rules;
+
+  /** Decimators by stream handle, null for the streams passed on as is. */
+  std::vector<std::unique_ptr<Decimator>> decimators;
+
+  /** Output of the decimation of a block, passed on when full. */
+  std::vector<double> values;
+  std::vector<uint64_t> timestamps;
+
+  Decimator* Find(const DataId *id) const {
+    return id->Handle() < decimators.size()
+        ? decimators[id->Handle()].get() : nullptr;
+  }
+
+  template<typename DataType> void Handle(const Datum<DataType> &datum) {
+    Decimator *decimator = Find(datum.id);
+    if (!decimator) {
+      for (const auto& sink: downstream)
+        sink->Take(datum);
+      return;
+    }
+
+    double value;
+    uint64_t timestamp;
+    if (decimator->Push(datum.data, datum.timestamp, &value, &timestamp)) {
+      for (const auto& sink: downstream)
+        sink->Take(Datum<double>(datum.id, value, timestamp));
+    }
+  }
+
+  template<typename DataType>
+  void HandleBlock(const DataBlock<DataType> &block) {
+    Decimator *decimator = Find(block.id);
+    if (!decimator) {
+      for (const auto& sink: downstream)
+        sink->TakeBlock(block);
+      return;
+    }
+
+    size_t count = 0;
+    for (size_t i=0; i<block.size; i++) {
+      count += decimator->Push(block.data[i], block.timestamps[i],
+                               &values[count], &timestamps[count]);
+      if (count == values.size() || (count && i + 1 == block.size)) {
+        DataBlock<double> decimated(block.id, values.data(),
+                                    timestamps.data(), count);
+        for (const auto& sink: downstream)
+          sink->TakeBlock(decimated);
+        count = 0;
+      }
+    }
+  }
+
+ public:
+  /** Largest number of samples of the decimated blocks passed on. */
+  static constexpr size_t kOutputBlockSize = 1024;
+
+  DecimatingDataSink(DataSinkPtrList downstream,
+                     std::vector<DecimationRule> rules);
+
+  virtual void Declare(const DataId *id, ValueType type);
+  virtual void Poll() {
+    for (const auto& sink: downstream)
+      sink->Poll();
+  }
+  virtual void Take(Datum<int8_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int16_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int32_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int64_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint8_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint16_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint32_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint64_t> datum) {Handle(datum);}
+  virtual void Take(Datum<double> datum) {Handle(datum);}
+  virtual void Take(Datum<float> datum) {Handle(datum);}
+  virtual void TakeBlock(const DataBlock<int8_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int16_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int32_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int64_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint8_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint16_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint32_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint64_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<double> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<float> &block) {HandleBlock(block);}
+};
+
+}// namespace fdas
+
+#endif//FDAS_COMMON_DECIMATE_HPP_
@@ -0,0 +1,81 @@
+/**
+ * Decode the files written by the delta-compressed data sink.
+ */
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <boost/log/trivial.hpp>
+#include <boost/program_options.hpp>
+
+#include "common.hpp"
+#include "delta.hpp"
+
+
+namespace po = boost::program_options;
+using namespace fdas;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+
+
+int main (int argc, char *argv[]) {
+  // Command line arguments
+  string input;
+
+  // Define accepted command line arguments
+  po::options_description desc(
+      "Decode a delta-compressed data file into the given data sinks, "
+      "or as text to STDOUT");
+  desc.add_options()
+      ("input", po::value<string>(&input)->required(),
+       "Compressed data file");
+  desc.add(GeneralOptions()).add(DataSinkOptions());
+  po::positional_options_description positional;
+  positional.add("input", 1);
+
+  // Parse command line arguments
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+              .options(desc).positional(positional).run(), vm);
+  } catch (const std::exception& e) {
+    cerr << "Error parsing command line arguments: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  // Process help option
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return 0;
+  }
+
+  // Call notifiers and process arguments
+  try {
+    po::notify(vm);
+  } catch (const std::exception& e) {
+    cerr << "Error processing command line arguments: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  DataSinkPtrList data_sinks = BuildDataSinks(vm);
+  if (data_sinks.empty())
+    data_sinks.push_back(DataSinkPtr(new TextFileDataSink("/dev/stdout")));
+
+  try {
+    DeltaFileReader reader(input);
+    reader.Declare(data_sinks);
+    while (reader.Next(data_sinks)) {}
+
+    if (reader.Skipped())
+      BOOST_LOG_TRIVIAL(warning) << "Skipped " << reader.Skipped()
+                                 << " bytes of invalid data";
+  } catch (const std::exception& e) {
+    BOOST_LOG_TRIVIAL(error) << e.what();
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,571 @@
+/**
+ * Delta and bit-packing compression of sample streams.
+ */
+
+#include "delta.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "registry.hpp"
+
+using std::string;
+
+
+namespace fdas {
+
+constexpr uint32_t DeltaCodec::kBlockMagic;
+constexpr size_t DeltaCodec::kBlockHeaderSize;
+constexpr size_t DeltaCodec::kGroupSize;
+constexpr char DeltaDataSink::kMagic[8];
+constexpr size_t DeltaDataSink::kBlockSize;
+constexpr uint32_t DeltaDataSink::kDeclarationMagic;
+
+
+/** Bit pattern of an integer value, sign or zero extended. */
+template<typename DataType> static inline uint64_t ToBits(DataType value) {
+  return static_cast<uint64_t>(value);
+}
+
+static inline uint64_t ToBits(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof bits);
+  return bits;
+}
+
+static inline uint64_t ToBits(double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof bits);
+  return bits;
+}
+
+/** Value of a bit pattern made by ToBits. */
+template<typename DataType> static inline DataType FromBits(uint64_t bits) {
+  return static_cast<DataType>(bits);
+}
+
+template<> inline float FromBits<float>(uint64_t bits) {
+  uint32_t low = static_cast<uint32_t>(bits);
+  float value;
+  std::memcpy(&value, &low, sizeof value);
+  return value;
+}
+
+template<> inline double FromBits<double>(uint64_t bits) {
+  double value;
+  std::memcpy(&value, &bits, sizeof value);
+  return value;
+}
+
+/** Map a signed difference to an unsigned number, small for small moduli. */
+static inline uint64_t ZigZag(uint64_t delta) {
+  return (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+}
+
+static inline uint64_t UnZigZag(uint64_t zigzag) {
+  return (zigzag >> 1) ^ (0 - (zigzag & 1));
+}
+
+/** Pack a group of numbers with the width of the largest one. */
+static char* PackGroup(const uint64_t *group, size_t count, char *out) {
+  uint64_t any = 0;
+  for (size_t i=0; i<count; i++)
+    any |= group[i];
+  unsigned width = any ? 64 - __builtin_clzll(any) : 0;
+  *out++ = static_cast<char>(width);
+
+  uint64_t acc = 0;
+  unsigned bits = 0;
+  for (size_t i=0; i<count; i++) {
+    // Put at most 32 bits at a time so the accumulator never overflows
+    uint64_t value = group[i];
+    for (unsigned left = width; left > 0;) {
+      unsigned n = std::min(left, 32u);
+      acc |= (value & ((uint64_t(1) << n) - 1)) << bits;
+      bits += n;
+      value >>= n;
+      left -= n;
+      for (; bits >= 8; bits -= 8, acc >>= 8)
+        *out++ = static_cast<char>(acc);
+    }
+  }
+  if (bits)
+    *out++ = static_cast<char>(acc);
+  return out;
+}
+
+/**
+ * Unpack a group of numbers.
+ * @return the end of the group or nullptr if it does not fit before `end`.
+ */
+static const char* UnpackGroup(const char *in, const char *end,
+                               uint64_t *group, size_t count) {
+  if (in >= end)
+    return nullptr;
+  unsigned width = static_cast<uint8_t>(*in++);
+  if (width > 64 || static_cast<size_t>(end - in) < (count*width + 7) / 8)
+    return nullptr;
+
+  uint64_t acc = 0;
+  unsigned bits = 0;
+  for (size_t i=0; i<count; i++) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < width;) {
+      unsigned n = std::min(width - shift, 32u);
+      for (; bits < n; bits += 8)
+        acc |= uint64_t(static_cast<uint8_t>(*in++)) << bits;
+      value |= (acc & ((uint64_t(1) << n) - 1)) << shift;
+      acc >>= n;
+      bits -= n;
+      shift += n;
+    }
+    group[i] = value;
+  }
+  return in;
+}
+
+size_t DeltaCodec::Bound(size_t count) {
+  size_t deltas = count ? count - 1 : 0;
+  size_t groups = (deltas + kGroupSize - 1) / kGroupSize;
+  return kBlockHeaderSize + 2 * (groups + deltas * sizeof(uint64_t));
+}
+
+size_t DeltaCodec::Encode(uint16_t handle, const uint64_t *values,
+                          const uint64_t *timestamps, uint16_t count,
+                          char *out) {
+  char *p = out + 12;
+  std::memcpy(p, timestamps, sizeof *timestamps);
+  std::memcpy(p + 8, values, sizeof *values);
+  p += 16;
+
+  // Changes of the timestamp step, zero when sampling at a steady rate
+  uint64_t group[kGroupSize];
+  uint64_t step = 0;
+  for (size_t i=1; i<count; i+=kGroupSize) {
+    size_t n = std::min(kGroupSize, count - i);
+    for (size_t j=0; j<n; j++) {
+      uint64_t next_step = timestamps[i + j] - timestamps[i + j - 1];
+      group[j] = ZigZag(next_step - step);
+      step = next_step;
+    }
+    p = PackGroup(group, n, p);
+  }
+
+  // Differences of consecutive values
+  for (size_t i=1; i<count; i+=kGroupSize) {
+    size_t n = std::min(kGroupSize, count - i);
+    for (size_t j=0; j<n; j++)
+      group[j] = ZigZag(values[i + j] - values[i + j - 1]);
+    p = PackGroup(group, n, p);
+  }
+
+  uint32_t rest = static_cast<uint32_t>(p - out - 12);
+  std::memcpy(out, &kBlockMagic, sizeof kBlockMagic);
+  std::memcpy(out + 4, &handle, sizeof handle);
+  std::memcpy(out + 6, &count, sizeof count);
+  std::memcpy(out + 8, &rest, sizeof rest);
+  return p - out;
+}
+
+size_t DeltaCodec::Decode(const char *in, size_t size, uint16_t *handle,
+                          uint64_t *values, uint64_t *timestamps,
+                          uint16_t *count) {
+  uint32_t magic, rest;
+  if (size < kBlockHeaderSize)
+    return 0;
+  std::memcpy(&magic, in, sizeof magic);
+  std::memcpy(handle, in + 4, sizeof *handle);
+  std::memcpy(count, in + 6, sizeof *count);
+  std::memcpy(&rest, in + 8, sizeof rest);
+  // The rest holds at least the first timestamp and value
+  if (magic != kBlockMagic || *count == 0 || rest < 16 || rest > size - 12)
+    return 0;
+
+  const char *end = in + 12 + rest;
+  const char *p = in + 12;
+  std::memcpy(timestamps, p, sizeof *timestamps);
+  std::memcpy(values, p + 8, sizeof *values);
+  p += 16;
+
+  uint64_t group[kGroupSize];
+  uint64_t step = 0;
+  for (size_t i=1; i<*count; i+=kGroupSize) {
+    size_t n = std::min(kGroupSize, *count - i);
+    if (!(p = UnpackGroup(p, end, group, n)))
+      return 0;
+    for (size_t j=0; j<n; j++) {
+      step += UnZigZag(group[j]);
+      timestamps[i + j] = timestamps[i + j - 1] + step;
+    }
+  }
+
+  for (size_t i=1; i<*count; i+=kGroupSize) {
+    size_t n = std::min(kGroupSize, *count - i);
+    if (!(p = UnpackGroup(p, end, group, n)))
+      return 0;
+    for (size_t j=0; j<n; j++)
+      values[i + j] = values[i + j - 1] + UnZigZag(group[j]);
+  }
+
+  return p == end ? end - in : 0;
+}
+
+/** Allocate the buffers of a stream, if not done yet. */
+void DeltaDataSink::Reserve(uint16_t handle) {
+  if (handle >= pending.size())
+    pending.resize(handle + 1);
+  Pending &stream = pending[handle];
+  if (stream.values.capacity() < kBlockSize) {
+    stream.values.reserve(kBlockSize);
+    stream.timestamps.reserve(kBlockSize);
+  }
+  if (encoded.empty())
+    encoded.resize(DeltaCodec::Bound(kBlockSize));
+}
+
+void DeltaDataSink::Declare(const DataId *id, ValueType type) {
+  BinaryDataSink::Declare(id, type);
+
+  // Allocate before the data of the registered streams, not while writing it
+  if (id->Handle() != DataId::kNoHandle)
+    Reserve(id->Handle());
+}
+
+template<typename DataType>
+void DeltaDataSink::Buffer(const DataBlock<DataType> &block) {
+  uint16_t handle = Accept(block.id, ValueTypeOf<DataType>());
+  Reserve(handle);
+  Pending &stream = pending[handle];
+  for (size_t i=0; i<block.size; i++) {
+    stream.values.push_back(ToBits(block.data[i]));
+    stream.timestamps.push_back(block.timestamps[i]);
+    if (stream.values.size() == kBlockSize)
+      Flush(handle);
+  }
+}
+
+/** Encode and output the buffered samples of a stream. */
+void DeltaDataSink::Flush(uint16_t handle) {
+  Pending &stream = pending[handle];
+  if (stream.values.empty())
+    return;
+
+  size_t size = DeltaCodec::Encode(handle, stream.values.data(),
+                                   stream.timestamps.data(),
+                                   stream.values.size(), encoded.data());
+  Output(encoded.data(), size);
+  stream.values.clear();
+  stream.timestamps.clear();
+}
+
+void DeltaDataSink::OutputDeclaration(const string &entry) {
+  uint32_t size = entry.size();
+  string block(reinterpret_cast<const char*>(&kDeclarationMagic),
+               sizeof kDeclarationMagic);
+  block.append(reinterpret_cast<const char*>(&size), sizeof size);
+  block += entry;
+  Output(block.data(), block.size());
+}
+
+void DeltaDataSink::Finish() {
+  for (size_t handle=0; handle<pending.size(); handle++)
+    Flush(handle);
+}
+
+void DeltaDataSink::Take(Datum<int8_t> datum) {
+  Buffer(DataBlock<int8_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<int16_t> datum) {
+  Buffer(DataBlock<int16_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<int32_t> datum) {
+  Buffer(DataBlock<int32_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<int64_t> datum) {
+  Buffer(DataBlock<int64_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<uint8_t> datum) {
+  Buffer(DataBlock<uint8_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<uint16_t> datum) {
+  Buffer(DataBlock<uint16_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<uint32_t> datum) {
+  Buffer(DataBlock<uint32_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<uint64_t> datum) {
+  Buffer(DataBlock<uint64_t>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<double> datum) {
+  Buffer(DataBlock<double>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::Take(Datum<float> datum) {
+  Buffer(DataBlock<float>(datum.id, &datum.data, &datum.timestamp, 1));
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<int8_t> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<int16_t> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<int32_t> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<int64_t> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<uint8_t> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<uint16_t> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<uint32_t> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<uint64_t> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<double> &block) {
+  Buffer(block);
+}
+
+void DeltaDataSink::TakeBlock(const DataBlock<float> &block) {
+  Buffer(block);
+}
+
+DeltaFileDataSink::~DeltaFileDataSink() {
+  Finish();
+  WriteHeader();
+}
+
+void DeltaFileDataSink::Output(const char *data, size_t size) {
+  ostream.write(data, size);
+}
+
+DeltaFileReader::DeltaFileReader(const string &filename)
+    : istream(filename, std::ios::binary),
+      values(UINT16_MAX), timestamps(UINT16_MAX) {
+  if (!istream)
+    throw std::runtime_error("Could not open `" + filename + "`");
+  ReadHeader();
+}
+
+/** Read the stream header, registering the streams. */
+void DeltaFileReader::ReadHeader() {
+  char magic[sizeof DeltaDataSink::kMagic];
+  uint16_t version, count;
+  istream.read(magic, sizeof magic);
+  istream.read(reinterpret_cast<char*>(&version), sizeof version);
+  istream.read(reinterpret_cast<char*>(&count), sizeof count);
+  if (!istream || std::memcmp(magic, DeltaDataSink::kMagic, sizeof magic))
+    throw std::runtime_error("Not a compressed FDAS data file");
+  if (version != BinaryDataSink::kVersion)
+    throw std::runtime_error("Unsupported format version "
+                             + std::to_string(version));
+
+  for (unsigned i=0; i<count; i++) {
+    uint16_t handle;
+    uint8_t type;
+    string strid, description, units;
+    istream.read(reinterpret_cast<char*>(&handle), sizeof handle);
+    istream.read(reinterpret_cast<char*>(&type), sizeof type);
+    std::getline(istream, strid, '\0');
+    std::getline(istream, description, '\0');
+    std::getline(istream, units, '\0');
+    if (!istream || type > static_cast<uint8_t>(ValueType::FLOAT))
+      throw std::runtime_error("Invalid compressed FDAS data file header");
+
+    AddStream(handle, type, strid, description, units);
+    order.push_back(streams[handle]);
+  }
+}
+
+/** Register a stream of the file. */
+void DeltaFileReader::AddStream(uint16_t handle, uint8_t type,
+                                const string &strid, const string &description,
+                                const string &units) {
+  const DataId *id = DataIdRegistry::Instance().Register(
+      strid.c_str(), description.c_str(), units.c_str());
+  streams[handle] = Stream{id, static_cast<ValueType>(type)};
+}
+
+/**
+ * Register the stream of the declaration block at the start of the unread
+ * bytes and declare it to the sinks.
+ * @param size Size of the header entry of the stream, after the block start.
+ * @return false if the entry is invalid.
+ */
+bool DeltaFileReader::ReadDeclaration(size_t size,
+                                      const DataSinkPtrList &sinks) {
+  const char *entry = buffer.data() + begin + 8;
+  const char *entry_end = entry + size;
+  uint16_t handle;
+  uint8_t type;
+  if (size < sizeof handle + sizeof type)
+    return false;
+  std::memcpy(&handle, entry, sizeof handle);
+  std::memcpy(&type, entry + sizeof handle, sizeof type);
+  if (type > static_cast<uint8_t>(ValueType::FLOAT))
+    return false;
+
+  // The strid, description and units, all NUL-terminated within the entry
+  const char *text[3];
+  const char *p = entry + sizeof handle + sizeof type;
+  for (auto &field: text) {
+    const char *nul = std::find(p, entry_end, '\0');
+    if (nul == entry_end)
+      return false;
+    field = p;
+    p = nul + 1;
+  }
+  if (p != entry_end)
+    return false;
+
+  AddStream(handle, type, text[0], text[1], text[2]);
+  for (const auto& sink: sinks)
+    sink->Declare(streams[handle].id, streams[handle].type);
+  return true;
+}
+
+/**
+ * Make at least `size` unread bytes available in the buffer.
+ * @return false if the file ends before.
+ */
+bool DeltaFileReader::Fill(size_t size) {
+  if (end - begin >= size)
+    return true;
+
+  std::copy(buffer.begin() + begin, buffer.begin() + end, buffer.begin());
+  end -= begin;
+  begin = 0;
+  if (buffer.size() < std::max<size_t>(size, 1 << 16))
+    buffer.resize(std::max<size_t>(size, 1 << 16));
+
+  while (end < size && istream) {
+    istream.read(buffer.data() + end, buffer.size() - end);
+    end += istream.gcount();
+  }
+  return end >= size;
+}
+
+void DeltaFileReader::Declare(const DataSinkPtrList &sinks) const {
+  for (const auto& stream: order) {
+    for (const auto& sink: sinks)
+      sink->Declare(stream.id, stream.type);
+  }
+}
+
+/** Send decoded samples to the sinks as a block of their type. */
+template<typename DataType>
+static void Send(const DataSinkPtrList &sinks, const DataId *id,
+                 const uint64_t *values, const uint64_t *timestamps,
+                 size_t count) {
+  static thread_local std::vector<DataType> data;
+  data.resize(count);
+  for (size_t i=0; i<count; i++)
+    data[i] = FromBits<DataType>(values[i]);
+
+  DataBlock<DataType> block(id, data.data(), timestamps, count);
+  for (const auto& sink: sinks)
+    sink->TakeBlock(block);
+}
+
+bool DeltaFileReader::Next(const DataSinkPtrList &sinks) {
+  static const size_t max_size = DeltaCodec::Bound(UINT16_MAX);
+
+  for (;; begin++, skipped++) {
+    if (!Fill(8)) {
+      skipped += end - begin;
+      begin = end;
+      return false;
+    }
+
+    uint32_t magic, rest;
+    std::memcpy(&magic, buffer.data() + begin, sizeof magic);
+    while (magic == DeltaDataSink::kDeclarationMagic) {
+      std::memcpy(&rest, buffer.data() + begin + 4, sizeof rest);
+      if (rest > max_size || !Fill(8 + rest) || !ReadDeclaration(rest, sinks))
+        break;
+      begin += 8 + rest;
+      if (!Fill(8)) {
+        skipped += end - begin;
+        begin = end;
+        return false;
+      }
+      std::memcpy(&magic, buffer.data() + begin, sizeof magic);
+    }
+
+    if (magic != DeltaCodec::kBlockMagic
+        || !Fill(DeltaCodec::kBlockHeaderSize))
+      continue;
+    std::memcpy(&rest, buffer.data() + begin + 8, sizeof rest);
+    if (12 + size_t(rest) > max_size || !Fill(12 + rest))
+      continue;
+
+    uint16_t handle, count;
+    size_t size = DeltaCodec::Decode(buffer.data() + begin, 12 + rest,
+                                     &handle, values.data(),
+                                     timestamps.data(), &count);
+    auto stream = streams.find(handle);
+    if (!size || stream == streams.end())
+      continue;
+    begin += size;
+
+    const DataId *id = stream->second.id;
+    switch (stream->second.type) {
+      case ValueType::INT8:
+        Send<int8_t>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::INT16:
+        Send<int16_t>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::INT32:
+        Send<int32_t>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::INT64:
+        Send<int64_t>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::UINT8:
+        Send<uint8_t>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::UINT16:
+        Send<uint16_t>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::UINT32:
+        Send<uint32_t>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::UINT64:
+        Send<uint64_t>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::DOUBLE:
+        Send<double>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+      case ValueType::FLOAT:
+        Send<float>(sinks, id, values.data(), timestamps.data(), count);
+        break;
+    }
+    return true;
+  }
+}
+
+}
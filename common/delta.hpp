@@ -0,0 +1,199 @@
+#ifndef FDAS_COMMON_DELTA_HPP_
+#define FDAS_COMMON_DELTA_HPP_
+
+/**
+ * Delta and bit-packing compression of sample streams.
+ */
+
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+
+
+namespace fdas {
+
+/**
+ * Block codec for the samples of a single stream.
+ *
+ * Values are handled as the 64-bit pattern of the sample: integers are sign
+ * or zero extended, floating point values are taken bit for bit. A block
+ * keeps the first timestamp and value verbatim and then the differences to
+ * the previous value and the change of the timestamp step, all zigzag-mapped
+ * to small unsigned numbers and bit-packed in groups of kGroupSize with the
+ * width of the largest number of each group. Slowly varying integer signals
+ * sampled at a steady rate pack into a few bits per sample.
+ *
+ * Block layout, in host byte order: the uint32 kBlockMagic, the uint16
+ * stream handle, the uint16 number of samples, the uint32 size of the rest
+ * of the block, the uint64 first timestamp, the uint64 first value and then
+ * the packed timestamp groups followed by the packed value groups. Each
+ * group is its uint8 bit width followed by the packed bits, least
+ * significant first, padded to a whole byte.
+ *
+ * Blocks are independent, so decoding can start at any block boundary and
+ * recover from corruption by searching for the next kBlockMagic.
+ */
+struct DeltaCodec {
+  /** Magic number starting every block. */
+  static constexpr uint32_t kBlockMagic = 0x4b424446; // "FDBK"
+
+  /** Size of the fixed part of a block, up to the packed groups. */
+  static constexpr size_t kBlockHeaderSize = 28;
+
+  /** Number of values packed with the same bit width. */
+  static constexpr size_t kGroupSize = 32;
+
+  /** Largest possible encoded size of a block of `count` samples. */
+  static size_t Bound(size_t count);
+
+  /**
+   * Encode a block of samples.
+   * @param out Buffer of at least Bound(count) bytes.
+   * @return the size of the encoded block.
+   */
+  static size_t Encode(uint16_t handle, const uint64_t *values,
+                       const uint64_t *timestamps, uint16_t count, char *out);
+
+  /**
+   * Decode a block of samples.
+   * @param values, timestamps Buffers of at least UINT16_MAX samples.
+   * @return the size of the decoded block, zero if the block is invalid or
+   *   incomplete within the `size` bytes available.
+   */
+  static size_t Decode(const char *in, size_t size, uint16_t *handle,
+                       uint64_t *values, uint64_t *timestamps,
+                       uint16_t *count);
+};
+
+/**
+ * Data sink writing the samples compressed with the DeltaCodec.
+ *
+ * The stream starts with the BinaryDataSink header, with kMagic in place of
+ * BinaryDataSink::kMagic, followed by the encoded blocks. Streams first seen
+ * after the header are announced by a declaration block before their data:
+ * the uint32 kDeclarationMagic, the uint32 size of the header entry of the
+ * stream and the entry. Samples of each stream are buffered until
+ * kBlockSize of them are available, so the last blocks are only written by
+ * Finish().
+ */
+class DeltaDataSink : public BinaryDataSink {
+  /** Samples of a stream waiting to be encoded. */
+  struct Pending {
+    std::vector<uint64_t> values;
+    std::vector<uint64_t> timestamps;
+  };
+
+  std::vector<Pending> pending; /**< Buffered samples of each handle. */
+  std::vector<char> encoded;
+
+  void Reserve(uint16_t handle);
+  template<typename DataType> void Buffer(const DataBlock<DataType> &block);
+  void Flush(uint16_t handle);
+
+ protected:
+  /** Encode the buffered samples of all streams. */
+  void Finish();
+
+  virtual void OutputDeclaration(const std::string &entry);
+
+ public:
+  /** Stream magic number, followed by the format version. */
+  static constexpr char kMagic[8] = {'F', 'D', 'A', 'S', 'D', 'L', 'T', 0};
+
+  /** Number of samples of each encoded block. */
+  static constexpr size_t kBlockSize = 256;
+
+  /** Magic number starting the declaration blocks. */
+  static constexpr uint32_t kDeclarationMagic = 0x43444446; // "FDDC"
+
+  DeltaDataSink() : BinaryDataSink(kMagic) {}
+
+  virtual void Declare(const DataId *id, ValueType type);
+  virtual void Take(Datum<int8_t> datum);
+  virtual void Take(Datum<int16_t> datum);
+  virtual void Take(Datum<int32_t> datum);
+  virtual void Take(Datum<int64_t> datum);
+  virtual void Take(Datum<uint8_t> datum);
+  virtual void Take(Datum<uint16_t> datum);
+  virtual void Take(Datum<uint32_t> datum);
+  virtual void Take(Datum<uint64_t> datum);
+  virtual void Take(Datum<double> datum);
+  virtual void Take(Datum<float> datum);
+  virtual void TakeBlock(const DataBlock<int8_t> &block);
+  virtual void TakeBlock(const DataBlock<int16_t> &block);
+  virtual void TakeBlock(const DataBlock<int32_t> &block);
+  virtual void TakeBlock(const DataBlock<int64_t> &block);
+  virtual void TakeBlock(const DataBlock<uint8_t> &block);
+  virtual void TakeBlock(const DataBlock<uint16_t> &block);
+  virtual void TakeBlock(const DataBlock<uint32_t> &block);
+  virtual void TakeBlock(const DataBlock<uint64_t> &block);
+  virtual void TakeBlock(const DataBlock<double> &block);
+  virtual void TakeBlock(const DataBlock<float> &block);
+};
+
+/** Data sink writing a compressed stream to a file. */
+class DeltaFileDataSink : public DeltaDataSink {
+  std::ofstream ostream;
+
+ protected:
+  virtual void Output(const char *data, size_t size);
+
+ public:
+  explicit DeltaFileDataSink(const std::string &filename)
+      : ostream(filename, std::ios::binary) {}
+  ~DeltaFileDataSink();
+};
+
+/** Reader of the streams written by a DeltaFileDataSink. */
+class DeltaFileReader {
+  /** A stream of the file, with the identifier registered in this process. */
+  struct Stream {
+    const DataId *id;
+    ValueType type;
+  };
+
+  std::ifstream istream;
+  std::unordered_map<uint16_t, Stream> streams;
+  std::vector<Stream> order; /**< Streams in the order of the header. */
+  std::vector<char> buffer;
+  size_t begin = 0, end = 0;
+  std::vector<uint64_t> values, timestamps;
+  uint64_t skipped = 0;
+
+  bool Fill(size_t size);
+  void ReadHeader();
+  void AddStream(uint16_t handle, uint8_t type, const std::string &strid,
+                 const std::string &description, const std::string &units);
+  bool ReadDeclaration(size_t size, const DataSinkPtrList &sinks);
+
+ public:
+  /**
+   * Open a compressed file and read its header.
+   * @throw std::runtime_error if the file could not be read or is invalid.
+   */
+  explicit DeltaFileReader(const std::string &filename);
+
+  /** Declare all streams of the file to the sinks. */
+  void Declare(const DataSinkPtrList &sinks) const;
+
+  /**
+   * Decode the next block and send it to the sinks.
+   * Streams declared in the data are declared to the sinks on the way.
+   * Invalid data is skipped up to the next valid block.
+   * @return false at the end of the file.
+   */
+  bool Next(const DataSinkPtrList &sinks);
+
+  /** Number of bytes skipped because they were not valid blocks. */
+  uint64_t Skipped() const {return skipped;}
+};
+
+}// namespace fdas
+
+#endif//FDAS_COMMON_DELTA_HPP_
@@ -0,0 +1,264 @@
+/**
+ * Log files of the C readers and their rotation off the sampling thread.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "logrotate.h"
+#include "utils.h"
+
+
+struct logrotate {
+    log_config_t config;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned requested;    /**< Last rotation requested. */
+    unsigned opened;       /**< Last rotation opened. */
+    log_files_t next;      /**< Files opened, or replaced if retiring. */
+    int ready;             /**< Whether `next` holds opened files, atomic. */
+    bool retiring;         /**< Whether `next` holds files to close. */
+    bool stopping;
+    uint64_t request_us;   /**< Time of the last request. */
+    uint64_t swap_us;      /**< Time of the last swap. */
+};
+
+
+/**
+ * Open a stdio log file.
+ * @return The file or NULL if error.
+ */
+static FILE* open_file(const char *path, const char *name) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        syslog(LOG_ERR, "Error opening %s `%s`: %s", name, path,
+               strerror(errno));
+        return NULL;
+    }
+    preallocate_stream(file, _IOFBF);
+    return file;
+}
+
+
+/**
+ * Open the log files of a rotation, named FILE.ROTATION, or FILE for the
+ * rotation 0. The logs which cannot be opened are left NULL.
+ * @return 0 if success, -1 if any log could not be opened.
+ */
+int log_files_open(const log_config_t *config, unsigned rotation,
+                   log_files_t *files) {
+    char path[PATH_MAX];
+    int status = 0;
+
+    if (config->text_log) {
+        snprintf(path, sizeof path, rotation ? "%s.%u" : "%s",
+                 config->text_log, rotation);
+        files->text_log = open_file(path, "text log");
+        if (!files->text_log)
+            status = -1;
+        else if (config->text_header)
+            config->text_header(files->text_log);
+    }
+
+    if (config->binary_log) {
+        snprintf(path, sizeof path, rotation ? "%s.%u" : "%s",
+                 config->binary_log, rotation);
+        files->binary_log = open_file(path, "binary log");
+        if (!files->binary_log)
+            status = -1;
+    }
+
+    if (config->segment_log) {
+        snprintf(path, sizeof path, rotation ? "%s.%u" : "%s",
+                 config->segment_log, rotation);
+        files->segment_log = seglog_open(path, config->segment_size);
+        if (!files->segment_log)
+            status = -1;
+    }
+
+    if (config->block_log) {
+        snprintf(path, sizeof path, rotation ? "%s.%u" : "%s",
+                 config->block_log, rotation);
+        files->block_log = blocklog_open(path, config->commit_ms,
+                                         config->commit_bytes);
+        if (!files->block_log)
+            status = -1;
+    }
+
+    return status;
+}
+
+
+/**
+ * Close the open log files, flushing all logged data.
+ * @return 0 if success, -1 if error.
+ */
+int log_files_close(log_files_t *files) {
+    int status = 0;
+    if (files->text_log && fclose(files->text_log)) {
+        syslog(LOG_ERR, "Error closing text log: %s", strerror(errno));
+        status = -1;
+    }
+    if (files->binary_log && fclose(files->binary_log)) {
+        syslog(LOG_ERR, "Error closing binary log: %s", strerror(errno));
+        status = -1;
+    }
+    if (files->segment_log && seglog_close(files->segment_log)) {
+        syslog(LOG_ERR, "Error closing segment log");
+        status = -1;
+    }
+    if (files->block_log && blocklog_close(files->block_log)) {
+        syslog(LOG_ERR, "Error closing block log");
+        status = -1;
+    }
+    memset(files, 0, sizeof *files);
+    return status;
+}
+
+
+/**
+ * Rotation thread, opens the files of the requested rotations and closes
+ * the files they replace.
+ */
+static void* rotation_thread(void *arg) {
+    logrotate_t *rotate = arg;
+
+    pthread_mutex_lock(&rotate->mutex);
+    for (;;) {
+        if (rotate->retiring) {
+            log_files_t retired = rotate->next;
+            uint64_t latency_us = rotate->swap_us - rotate->request_us;
+            memset(&rotate->next, 0, sizeof rotate->next);
+            pthread_mutex_unlock(&rotate->mutex);
+            log_files_close(&retired);
+            syslog(LOG_INFO, "Logs rotated, switched %llu us after request",
+                   (unsigned long long) latency_us);
+            pthread_mutex_lock(&rotate->mutex);
+            rotate->retiring = false;
+        } else if (rotate->stopping) {
+            break;
+        } else if (!rotate->ready && rotate->opened != rotate->requested) {
+            unsigned rotation = rotate->requested;
+            log_files_t files = {};
+            pthread_mutex_unlock(&rotate->mutex);
+            log_files_open(&rotate->config, rotation, &files);
+            pthread_mutex_lock(&rotate->mutex);
+            rotate->next = files;
+            rotate->opened = rotation;
+            __atomic_store_n(&rotate->ready, 1, __ATOMIC_RELEASE);
+        } else {
+            pthread_cond_wait(&rotate->cond, &rotate->mutex);
+        }
+    }
+    pthread_mutex_unlock(&rotate->mutex);
+    return NULL;
+}
+
+
+/**
+ * Start the rotation thread of a set of logs.
+ * The thread blocks all signals, so they are still delivered to the threads
+ * of the program.
+ * @param config of the logs, copied, its paths must outlive the thread.
+ * @return The rotation thread or NULL if error.
+ */
+logrotate_t* logrotate_start(const log_config_t *config) {
+    logrotate_t *rotate = calloc(1, sizeof(logrotate_t));
+    if (!rotate) {
+        syslog(LOG_ERR, "Error allocating log rotation: %s", strerror(errno));
+        return NULL;
+    }
+    rotate->config = *config;
+    pthread_mutex_init(&rotate->mutex, NULL);
+    pthread_cond_init(&rotate->cond, NULL);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int status = pthread_create(&rotate->thread, NULL, rotation_thread,
+                                rotate);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (status) {
+        syslog(LOG_ERR, "Error creating log rotation thread: %s",
+               strerror(status));
+        pthread_mutex_destroy(&rotate->mutex);
+        pthread_cond_destroy(&rotate->cond);
+        free(rotate);
+        return NULL;
+    }
+    return rotate;
+}
+
+
+/**
+ * Request the rotation of the logs to the next rotation names.
+ * Not async-signal-safe, signal handlers should only set a flag.
+ */
+void logrotate_request(logrotate_t *rotate) {
+    uint64_t now_us = get_time_us();
+    pthread_mutex_lock(&rotate->mutex);
+    rotate->requested++;
+    rotate->request_us = now_us;
+    pthread_cond_signal(&rotate->cond);
+    pthread_mutex_unlock(&rotate->mutex);
+}
+
+
+/**
+ * Switch to the files of the last rotation if they are open, handing the
+ * replaced files to the rotation thread. Call between two messages.
+ * @return 1 if the files were switched, 0 if not ready.
+ */
+int logrotate_swap(logrotate_t *rotate, log_files_t *files) {
+    if (!__atomic_load_n(&rotate->ready, __ATOMIC_ACQUIRE))
+        return 0;
+
+    // Exchange the pointers of the logs reopened, the others are kept
+#define SWAP_OPENED(type, log) do {                 \
+        if (rotate->next.log) {                     \
+            type *replaced = files->log;            \
+            files->log = rotate->next.log;          \
+            rotate->next.log = replaced;            \
+        }                                           \
+    } while (0)
+    SWAP_OPENED(FILE, text_log);
+    SWAP_OPENED(FILE, binary_log);
+    SWAP_OPENED(seglog_t, segment_log);
+    SWAP_OPENED(blocklog_t, block_log);
+#undef SWAP_OPENED
+
+    uint64_t now_us = get_time_us();
+    pthread_mutex_lock(&rotate->mutex);
+    rotate->swap_us = now_us;
+    rotate->retiring = true;
+    __atomic_store_n(&rotate->ready, 0, __ATOMIC_RELAXED);
+    pthread_cond_signal(&rotate->cond);
+    pthread_mutex_unlock(&rotate->mutex);
+    return 1;
+}
+
+
+/**
+ * Stop the rotation thread, after it closes the replaced files. Files of a
+ * rotation opened but not switched to yet are closed too.
+ */
+void logrotate_stop(logrotate_t *rotate) {
+    pthread_mutex_lock(&rotate->mutex);
+    rotate->stopping = true;
+    pthread_cond_signal(&rotate->cond);
+    pthread_mutex_unlock(&rotate->mutex);
+    pthread_join(rotate->thread, NULL);
+
+    if (rotate->ready)
+        log_files_close(&rotate->next);
+    pthread_mutex_destroy(&rotate->mutex);
+    pthread_cond_destroy(&rotate->cond);
+    free(rotate);
+}
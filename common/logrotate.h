@@ -0,0 +1,62 @@
+/**
+ * Log files of the C readers and their rotation off the sampling thread.
+ *
+ * The text, binary, segment and block logs of a reader are opened together
+ * with log_files_open(), with the names of a rotation, FILE.ROTATION. A
+ * rotation thread opens the files of the next rotation when requested, so
+ * the sampling thread only swaps the pointers with logrotate_swap(), between
+ * two messages, and hands the replaced files back to the thread to close.
+ * A log which cannot be reopened keeps its current file.
+ */
+
+#ifndef LOGROTATE_H
+#define LOGROTATE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "blocklog.h"
+#include "seglog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Log files of a reader, NULL if not used. */
+typedef struct log_files {
+    FILE *text_log;
+    FILE *binary_log;
+    seglog_t *segment_log;
+    blocklog_t *block_log;
+} log_files_t;
+
+/** Configuration of the log files, NULL paths for unused logs. */
+typedef struct log_config {
+    const char *text_log;
+    const char *binary_log;
+    const char *segment_log;
+    const char *block_log;
+    size_t segment_size;
+    unsigned commit_ms;
+    size_t commit_bytes;
+    void (*text_header)(FILE *text_log); /**< Header writer, or NULL. */
+} log_config_t;
+
+/** Log rotation thread. */
+typedef struct logrotate logrotate_t;
+
+int log_files_open(const log_config_t *config, unsigned rotation,
+                   log_files_t *files);
+int log_files_close(log_files_t *files);
+logrotate_t* logrotate_start(const log_config_t *config);
+void logrotate_request(logrotate_t *rotate);
+int logrotate_swap(logrotate_t *rotate, log_files_t *files);
+void logrotate_stop(logrotate_t *rotate);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//LOGROTATE_H
@@ -9,6 +9,7 @@
 #include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -19,6 +20,7 @@
 #include <unistd.h>
 
 #include "mavlink/v1.0/ceaufmg/mavlink.h"
+#include "./logrotate.h"
 #include "./utils.h"
 
 
@@ -78,6 +80,25 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
 static struct argp argp = {options, parse_opt, args_doc, doc};
 
 
+/** Set by the SIGHUP handler to request the rotation of the log. */
+static volatile sig_atomic_t rotate_requested = 0;
+
+/** Set by the SIGTERM and SIGINT handler to request a clean exit. */
+static volatile sig_atomic_t terminate_requested = 0;
+
+
+/** SIGHUP handler, requests the rotation of the log. */
+static void hup_handler(int sig) {
+    rotate_requested = 1;
+}
+
+
+/** SIGTERM and SIGINT handler, requests closing the log and exiting. */
+static void term_handler(int sig) {
+    terminate_requested = 1;
+}
+
+
 /**
  * Open the serial port.
  * Aborts the program on error.
@@ -108,20 +129,6 @@ int open_serial_port(char *device) {
 }
 
 
-/**
- * Open the logfile.
- * Aborts the program on error.
- */
-FILE* open_log(char *filename) {
-    FILE *file = fopen(filename, "wb");
-    if (!file) {
-        char *msg = "Error opening log file %s: %s";
-        syslog(LOG_ERR, msg, filename,  strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-}
-
-
 void logwrite(FILE *log, mavlink_message_t *msg) {
     uint64_t timestamp_be = htobe64(get_time_us());
     if (!fwrite(&timestamp_be, sizeof timestamp_be, 1, log))
@@ -144,22 +151,50 @@ int main(int argc, char **argv) {
     
     // Open the output streams
     int port = open_serial_port(arguments.device);
-    FILE *log = open_log(arguments.logfile);    
+    log_config_t log_config = {.binary_log=arguments.logfile};
+    log_files_t logs = {};
+    if (log_files_open(&log_config, 0, &logs))
+        exit(EXIT_FAILURE);
+
+    // Rotate the log on SIGHUP, the new one is opened by the rotation thread
+    // and switched to between two messages
+    logrotate_t *rotate = logrotate_start(&log_config);
+    if (!rotate)
+        exit(EXIT_FAILURE);
+
+    // Handle the signals interrupting the blocking read: rotate the log on
+    // SIGHUP, close it on SIGTERM and SIGINT
+    struct sigaction hup_action = {.sa_handler=hup_handler};
+    sigemptyset(&hup_action.sa_mask);
+    sigaction(SIGHUP, &hup_action, NULL);
+    struct sigaction term_action = {.sa_handler=term_handler};
+    sigemptyset(&term_action.sa_mask);
+    sigaction(SIGTERM, &term_action, NULL);
+    sigaction(SIGINT, &term_action, NULL);
 
     // Read loop
     mavlink_message_t msg;
     mavlink_status_t status;
     
-    for (;;) {
+    while (!terminate_requested) {
         char c;
         int n = read(port, &c, 1);
         if (n == 1) {
             if (mavlink_parse_char(MAVLINK_COMM_1, c, &msg, &status))
-                logwrite(log, &msg);
-        } else if (n < 0) {
+                logwrite(logs.binary_log, &msg);
+        } else if (n < 0 && errno != EINTR) {
             syslog(LOG_ERR, "Error reading serial port: %s", strerror(errno));
         }
+
+        if (rotate_requested) {
+            rotate_requested = 0;
+            logrotate_request(rotate);
+        }
+        logrotate_swap(rotate, &logs);
     }
-    
+
+    logrotate_stop(rotate);
+    if (log_files_close(&logs))
+        return EXIT_FAILURE;
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,60 @@
+/**
+ * Process-wide registry of data identifiers.
+ */
+
+#include "registry.hpp"
+
+#include <stdexcept>
+
+
+namespace fdas {
+
+constexpr size_t DataIdRegistry::kChunkSize;
+constexpr size_t DataIdRegistry::kChunks;
+
+DataIdRegistry& DataIdRegistry::Instance() {
+  static DataIdRegistry registry;
+  return registry;
+}
+
+/** Copy a string into storage owned by the registry. */
+const char* DataIdRegistry::Intern(const char *str) {
+  strings.emplace_back(str);
+  return strings.back().c_str();
+}
+
+const DataId* DataIdRegistry::Register(const char *strid,
+                                       const char *description,
+                                       const char *units) {
+  std::lock_guard<std::mutex> lock(mutex);
+  
+  auto it = by_strid.find(strid);
+  if (it != by_strid.end())
+    return it->second;
+  
+  size_t handle = count.load(std::memory_order_relaxed);
+  if (handle >= DataId::kNoHandle)
+    throw std::length_error("Too many registered data identifiers");
+  
+  ids.emplace_back(Intern(strid), Intern(description), Intern(units));
+  DataId *id = &ids.back();
+  id->handle = handle;
+  by_strid[id->StrId()] = id;
+  
+  // Publish the new entry to the lock-free lookups
+  auto &chunk = chunks[handle / kChunkSize];
+  if (!chunk)
+    chunk.reset(new const DataId*[kChunkSize]);
+  chunk[handle % kChunkSize] = id;
+  count.store(handle + 1, std::memory_order_release);
+  
+  return id;
+}
+
+const DataId* DataIdRegistry::Find(const char *strid) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = by_strid.find(strid);
+  return it == by_strid.end() ? nullptr : it->second;
+}
+
+}
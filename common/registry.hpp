@@ -0,0 +1,84 @@
+#ifndef FDAS_COMMON_REGISTRY_HPP_
+#define FDAS_COMMON_REGISTRY_HPP_
+
+/**
+ * Process-wide registry of data identifiers.
+ */
+
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "common.hpp"
+
+
+namespace fdas {
+
+/**
+ * Registry assigning stable numeric handles to data identifiers.
+ *
+ * The registry keeps its own copy of each DataId and of its strings, so the
+ * returned pointers stay valid for the whole program. Handles are assigned
+ * sequentially from zero and identify the DataId in compact encodings, which
+ * can emit the handle to metadata mapping once. Registration is serialized
+ * by a mutex; lookups by handle are lock-free and O(1).
+ */
+class DataIdRegistry {
+  /** Number of handles in each chunk of the lookup table. */
+  static constexpr size_t kChunkSize = 256;
+  static constexpr size_t kChunks = (DataId::kNoHandle + kChunkSize - 1)
+                                    / kChunkSize;
+  
+  std::mutex mutex;
+  std::deque<std::string> strings;
+  std::deque<DataId> ids;
+  std::unordered_map<std::string, const DataId*> by_strid;
+  
+  /** Handle lookup table, allocated in chunks as it grows. */
+  std::array<std::unique_ptr<const DataId*[]>, kChunks> chunks;
+  std::atomic<size_t> count{0};
+  
+  const char* Intern(const char *str);
+  
+ public:
+  /** The process-wide registry. */
+  static DataIdRegistry& Instance();
+  
+  /**
+   * Register a data identifier.
+   * Registering a strid again returns the DataId of the first registration.
+   * @throw std::length_error if all handles were taken.
+   */
+  const DataId* Register(const char *strid, const char *description = "",
+                         const char *units = "");
+  
+  /** Register a copy of a data identifier, see Register(). */
+  const DataId* Register(const DataId &id) {
+    if (id.Handle() != DataId::kNoHandle)
+      return Get(id.Handle());
+    return Register(id.StrId(), id.Description(), id.Units());
+  }
+  
+  /** The registered identifier with the given strid or nullptr. */
+  const DataId* Find(const char *strid);
+  
+  /** The identifier with the given handle or nullptr if not registered. */
+  const DataId* Get(uint16_t handle) const {
+    if (handle >= count.load(std::memory_order_acquire))
+      return nullptr;
+    return chunks[handle / kChunkSize][handle % kChunkSize];
+  }
+  
+  /** Number of registered identifiers, the handles are below it. */
+  size_t Size() const {return count.load(std::memory_order_acquire);}
+};
+
+}// namespace fdas
+
+#endif//FDAS_COMMON_REGISTRY_HPP_
@@ -0,0 +1,129 @@
+/**
+ * Trim log segments left behind by a crash and extract their payload.
+ */
+
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "seglog.h"
+
+
+/** Program version. */
+const char *argp_program_version = "seglog-trim 0.1";
+
+/** Bug report address. */
+const char *argp_program_bug_address = "https://github.com/cea-ufmg/fdas3";
+
+/** Program documentation. */
+static char doc[] = "seglog-trim -- Trim log segments to their payload.";
+
+/** Description of the accepted arguments. */
+static char args_doc[] = "SEGMENT...";
+
+/** Program options structure. */
+static struct argp_option options[] = {
+    {"cat", 'c', 0, 0,
+     "Write the concatenated segment payloads to STDOUT after trimming"},
+    {0}
+};
+
+/** Program arguments structure. */
+typedef struct arguments {
+    char **segments;
+    int segment_count;
+    bool cat;
+} arguments_t;
+
+
+/** Argument parser function */
+static error_t parse_opt (int key, char *arg, struct argp_state *state) {
+    //Get the arguments structure to write the parsed options
+    arguments_t *arguments = state->input;
+
+    switch (key) {
+    case 'c':
+        arguments->cat = true;
+        break;
+
+    case ARGP_KEY_ARGS:
+        arguments->segments = state->argv + state->next;
+        arguments->segment_count = state->argc - state->next;
+        break;
+
+    case ARGP_KEY_NO_ARGS:
+        argp_error(state, "Not enough arguments.");
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+/** Argument parser object. */
+static struct argp argp = {options, parse_opt, args_doc, doc};
+
+
+/**
+ * Copy the payload of a trimmed segment to STDOUT.
+ * @return 0 if success, -1 if error.
+ */
+int cat_payload(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        syslog(LOG_ERR, "Error opening `%s`: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char buf[1 << 16];
+    size_t n;
+    int status = 0;
+    if (fseek(file, sizeof(seglog_header_t), SEEK_SET))
+        status = -1;
+    while (!status && (n = fread(buf, 1, sizeof buf, file)) > 0) {
+        if (fwrite(buf, 1, n, stdout) != n) {
+            syslog(LOG_ERR, "Error writing payload: %s", strerror(errno));
+            status = -1;
+        }
+    }
+    if (ferror(file)) {
+        syslog(LOG_ERR, "Error reading `%s`: %s", path, strerror(errno));
+        status = -1;
+    }
+
+    fclose(file);
+    return status;
+}
+
+
+int main(int argc, char **argv) {
+    // Parse command line arguments
+    arguments_t arguments = {};
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    // Setup syslog
+    openlog(0, LOG_PERROR, 0);
+
+    int status = EXIT_SUCCESS;
+    for (int i=0; i<arguments.segment_count; i++) {
+        const char *path = arguments.segments[i];
+        if (seglog_trim(path)) {
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if (arguments.cat && cat_payload(path))
+            status = EXIT_FAILURE;
+    }
+
+    return status;
+}
@@ -0,0 +1,427 @@
+/**
+ * Memory-mapped, preallocated segment log writer.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "seglog.h"
+
+
+/** Amount of written data after which it is scheduled for writeback. */
+#define SEGLOG_SYNC_CHUNK (1 << 20)
+
+
+/** A mapped segment file. */
+typedef struct segment {
+    int fd;
+    seglog_header_t *header;
+    char *payload;
+} segment_t;
+
+struct seglog {
+    char *prefix;
+    size_t size;        /**< Segment file size, including header. */
+    unsigned index;     /**< Index of the current segment. */
+    segment_t current;
+    uint64_t synced;    /**< File offset up to which writeback was requested. */
+    bool prepared;      /**< Whether the next segment was requested. */
+
+    // Work of the maintenance thread, under the mutex
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    segment_t next;     /**< Next segment, prepared in advance. */
+    segment_t retired;  /**< Segment to finish. */
+    bool prepare;       /**< Whether the next segment is to be created. */
+    bool closing;       /**< Whether the thread is to exit when idle. */
+    char *sync_base;    /**< Mapping of the range to write back. */
+    uint64_t sync_start, sync_end;
+};
+
+
+/**
+ * Create, preallocate and map a segment file.
+ * @return 0 if success, -1 if error.
+ */
+static int segment_create(seglog_t *log, unsigned index, segment_t *seg) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof path, "%s.%06u", log->prefix, index);
+
+    seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (seg->fd < 0) {
+        syslog(LOG_ERR, "Error creating log segment `%s`: %s",
+               path, strerror(errno));
+        return -1;
+    }
+
+    int status = posix_fallocate(seg->fd, 0, log->size);
+    if (status) {
+        syslog(LOG_ERR, "Error preallocating log segment `%s`: %s",
+               path, strerror(status));
+        close(seg->fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, log->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     seg->fd, 0);
+    if (map == MAP_FAILED) {
+        syslog(LOG_ERR, "Error mapping log segment `%s`: %s",
+               path, strerror(errno));
+        close(seg->fd);
+        return -1;
+    }
+    madvise(map, log->size, MADV_SEQUENTIAL);
+
+    seg->header = map;
+    seg->payload = (char*)map + sizeof(seglog_header_t);
+    memcpy(seg->header->magic, SEGLOG_MAGIC, sizeof seg->header->magic);
+    seg->header->index = index;
+    seg->header->capacity = log->size - sizeof(seglog_header_t);
+    seg->header->used = 0;
+    return 0;
+}
+
+
+/**
+ * Unmap a segment and trim its file to the written payload.
+ * @return 0 if success, -1 if error.
+ */
+static int segment_finish(seglog_t *log, segment_t *seg) {
+    if (!seg->header)
+        return 0;
+
+    int status = 0;
+    off_t length = sizeof(seglog_header_t) + seg->header->used;
+    if (munmap(seg->header, log->size)) {
+        syslog(LOG_ERR, "Error unmapping log segment: %s", strerror(errno));
+        status = -1;
+    }
+    if (ftruncate(seg->fd, length)) {
+        syslog(LOG_ERR, "Error trimming log segment: %s", strerror(errno));
+        status = -1;
+    }
+    if (close(seg->fd)) {
+        syslog(LOG_ERR, "Error closing log segment: %s", strerror(errno));
+        status = -1;
+    }
+    seg->header = NULL;
+    return status;
+}
+
+
+/**
+ * Start the writeback of a written range of a segment.
+ * The pages are also dropped from the process address space, they remain
+ * in the page cache until written.
+ */
+static void segment_sync(char *base, uint64_t start, uint64_t end) {
+    if (msync(base + start, end - start, MS_ASYNC))
+        syslog(LOG_WARNING, "Error in log segment msync: %s", strerror(errno));
+    else
+        madvise(base + start, end - start, MADV_DONTNEED);
+}
+
+
+/**
+ * Maintenance thread of a segment log.
+ * Runs the system calls which may block on the disk, the writeback of the
+ * written pages, the creation of the next segment and the finishing of the
+ * previous, so seglog_write is only a memory copy.
+ */
+static void* maintenance_thread(void *arg) {
+    seglog_t *log = arg;
+
+    pthread_mutex_lock(&log->mutex);
+    for (;;) {
+        if (log->sync_end > log->sync_start) {
+            char *base = log->sync_base;
+            uint64_t start = log->sync_start, end = log->sync_end;
+            log->sync_start = log->sync_end = 0;
+            pthread_mutex_unlock(&log->mutex);
+            segment_sync(base, start, end);
+            pthread_mutex_lock(&log->mutex);
+        } else if (log->retired.header) {
+            segment_t retired = log->retired;
+            pthread_mutex_unlock(&log->mutex);
+            segment_finish(log, &retired);
+            pthread_mutex_lock(&log->mutex);
+            log->retired.header = NULL;
+            pthread_cond_broadcast(&log->cond);
+        } else if (log->prepare) {
+            unsigned index = log->index + 1;
+            segment_t next = {};
+            pthread_mutex_unlock(&log->mutex);
+            segment_create(log, index, &next);
+            pthread_mutex_lock(&log->mutex);
+            log->next = next;
+            log->prepare = false;
+            pthread_cond_broadcast(&log->cond);
+        } else if (log->closing) {
+            break;
+        } else {
+            pthread_cond_wait(&log->cond, &log->mutex);
+        }
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return NULL;
+}
+
+
+/**
+ * Start the maintenance thread, with all signals blocked so they are still
+ * delivered to the threads of the program.
+ * @return 0 if success, -1 if error.
+ */
+static int start_maintenance(seglog_t *log) {
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int status = pthread_create(&log->thread, NULL, maintenance_thread, log);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (status) {
+        syslog(LOG_ERR, "Error creating segment log thread: %s",
+               strerror(status));
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Request the writeback of the completed pages of the current segment.
+ */
+static void schedule_sync(seglog_t *log) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t end = sizeof(seglog_header_t) + log->current.header->used;
+    uint64_t start = log->synced & ~(uint64_t)(page_size - 1);
+    end &= ~(uint64_t)(page_size - 1);
+    if (end <= start)
+        return;
+
+    // Extend the range still waiting for the thread, if any
+    pthread_mutex_lock(&log->mutex);
+    if (log->sync_end <= log->sync_start)
+        log->sync_start = start;
+    log->sync_base = (char*)log->current.header;
+    log->sync_end = end;
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->mutex);
+    log->synced = end;
+}
+
+
+/**
+ * Request the creation of the next segment from the maintenance thread.
+ */
+static void request_next(seglog_t *log) {
+    pthread_mutex_lock(&log->mutex);
+    log->prepare = true;
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->mutex);
+    log->prepared = true;
+}
+
+
+/**
+ * Open a segment log.
+ * @param prefix Path prefix of the segment files.
+ * @param segment_size Size of each segment file in bytes.
+ * @return The segment log or NULL if error.
+ */
+seglog_t* seglog_open(const char *prefix, size_t segment_size) {
+    if (segment_size <= sizeof(seglog_header_t)) {
+        syslog(LOG_ERR, "Log segment size too small");
+        return NULL;
+    }
+
+    seglog_t *log = calloc(1, sizeof(seglog_t));
+    if (!log) {
+        syslog(LOG_ERR, "Error allocating segment log: %s", strerror(errno));
+        return NULL;
+    }
+
+    log->prefix = strdup(prefix);
+    log->size = segment_size;
+    if (!log->prefix || segment_create(log, 0, &log->current)) {
+        free(log->prefix);
+        free(log);
+        return NULL;
+    }
+
+    pthread_mutex_init(&log->mutex, NULL);
+    pthread_cond_init(&log->cond, NULL);
+    if (start_maintenance(log)) {
+        segment_finish(log, &log->current);
+        pthread_mutex_destroy(&log->mutex);
+        pthread_cond_destroy(&log->cond);
+        free(log->prefix);
+        free(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+
+/**
+ * Bytes which can still be written to the current segment.
+ */
+size_t seglog_remaining(const seglog_t *log) {
+    const seglog_header_t *header = log->current.header;
+    return header->capacity - header->used;
+}
+
+
+/**
+ * Index of the current segment.
+ */
+unsigned seglog_segment(const seglog_t *log) {
+    return log->index;
+}
+
+
+/**
+ * Finish the current segment and continue writing to the next.
+ * The next segment is normally prepared in advance, when the current is half
+ * full, and the current is finished by the maintenance thread, so rolling
+ * over only swaps the mappings. It waits for the thread only if it is late.
+ * @return 0 if success, -1 if error.
+ */
+int seglog_roll(seglog_t *log) {
+    if (!log->prepared)
+        request_next(log);
+
+    pthread_mutex_lock(&log->mutex);
+    while (log->prepare || log->retired.header)
+        pthread_cond_wait(&log->cond, &log->mutex);
+    if (!log->next.header) {
+        // Creating the next segment failed, try again on the next roll
+        pthread_mutex_unlock(&log->mutex);
+        log->prepared = false;
+        return -1;
+    }
+
+    // The pages not yet written back are left to the finishing
+    if ((char*)log->current.header == log->sync_base)
+        log->sync_start = log->sync_end = 0;
+    log->retired = log->current;
+    log->current = log->next;
+    log->next.header = NULL;
+    log->index++;
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->mutex);
+
+    log->synced = 0;
+    log->prepared = false;
+    return 0;
+}
+
+
+/**
+ * Write data to the log.
+ * @return 0 if success, -1 if error.
+ */
+int seglog_write(seglog_t *log, const void *data, size_t len) {
+    if (len > log->current.header->capacity) {
+        syslog(LOG_ERR, "Write larger than log segment capacity");
+        return -1;
+    }
+
+    if (len > seglog_remaining(log) && seglog_roll(log))
+        return -1;
+
+    seglog_header_t *header = log->current.header;
+    memcpy(log->current.payload + header->used, data, len);
+    header->used += len;
+
+    // Prepare the next segment in advance and write back completed pages
+    if (!log->prepared && header->used > header->capacity / 2)
+        request_next(log);
+    if (sizeof(seglog_header_t) + header->used - log->synced
+        >= SEGLOG_SYNC_CHUNK)
+        schedule_sync(log);
+
+    return 0;
+}
+
+
+/**
+ * Close the segment log, trimming the last segment to its payload.
+ * A segment prepared in advance but never written is removed.
+ * @return 0 if success, -1 if error.
+ */
+int seglog_close(seglog_t *log) {
+    // Let the maintenance thread finish its work
+    pthread_mutex_lock(&log->mutex);
+    log->closing = true;
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->mutex);
+    pthread_join(log->thread, NULL);
+    pthread_mutex_destroy(&log->mutex);
+    pthread_cond_destroy(&log->cond);
+
+    int status = segment_finish(log, &log->current);
+
+    if (log->next.header) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, "%s.%06u", log->prefix, log->index + 1);
+        segment_finish(log, &log->next);
+        if (unlink(path))
+            syslog(LOG_WARNING, "Error removing unused log segment: %s",
+                   strerror(errno));
+    }
+
+    free(log->prefix);
+    free(log);
+    return status;
+}
+
+
+/**
+ * Trim a segment file left behind by a crash to its written payload.
+ * @return 0 if success, -1 if error or if not a segment file.
+ */
+int seglog_trim(const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        syslog(LOG_ERR, "Error opening log segment `%s`: %s",
+               path, strerror(errno));
+        return -1;
+    }
+
+    seglog_header_t header;
+    struct stat st;
+    if (pread(fd, &header, sizeof header, 0) != sizeof header
+        || memcmp(header.magic, SEGLOG_MAGIC, sizeof header.magic)
+        || fstat(fd, &st)) {
+        syslog(LOG_ERR, "Invalid log segment `%s`", path);
+        close(fd);
+        return -1;
+    }
+
+    // Never extend the file, the header may be ahead of the data
+    off_t length = sizeof header + header.used;
+    if (length > st.st_size)
+        length = st.st_size;
+
+    int status = 0;
+    if (ftruncate(fd, length)) {
+        syslog(LOG_ERR, "Error trimming log segment `%s`: %s",
+               path, strerror(errno));
+        status = -1;
+    }
+    close(fd);
+    return status;
+}
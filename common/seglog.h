@@ -0,0 +1,58 @@
+/**
+ * Memory-mapped, preallocated segment log writer.
+ *
+ * The log is a series of fixed-size segment files, `PREFIX.000000`,
+ * `PREFIX.000001`, ... Each segment is preallocated with fallocate and
+ * written through a shared memory map, so writing is a plain memory copy
+ * and the kernel writes the pages back in the background. Writes are never
+ * split across segments. A maintenance thread of each log makes the system
+ * calls which may block on the disk: it starts the writeback of the written
+ * pages, creates the next segment when the current is half full and
+ * finishes the previous one, so seglog_write only waits for it if a whole
+ * segment fills before the next is ready.
+ *
+ * Each segment starts with a seglog_header_t. Its `used` field counts the
+ * payload bytes written and is updated after each write, so a segment left
+ * behind by a crash can be trimmed to its payload with seglog_trim().
+ */
+
+#ifndef SEGLOG_H
+#define SEGLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Segment file magic number. */
+#define SEGLOG_MAGIC "FDASSEG1"
+
+/** Segment header, in host byte order. */
+typedef struct seglog_header {
+    char magic[8];     /**< SEGLOG_MAGIC, without the terminating NUL. */
+    uint32_t index;    /**< Sequence number of the segment in the log. */
+    uint32_t reserved;
+    uint64_t capacity; /**< Payload capacity of the segment in bytes. */
+    uint64_t used;     /**< Payload bytes written. */
+} seglog_header_t;
+
+/** Segment log writer. */
+typedef struct seglog seglog_t;
+
+seglog_t* seglog_open(const char *prefix, size_t segment_size);
+int seglog_write(seglog_t *log, const void *data, size_t len);
+size_t seglog_remaining(const seglog_t *log);
+int seglog_roll(seglog_t *log);
+unsigned seglog_segment(const seglog_t *log);
+int seglog_close(seglog_t *log);
+int seglog_trim(const char *path);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//SEGLOG_H
@@ -0,0 +1,150 @@
+/**
+ * Windowed statistics of data streams for the FDAS.
+ */
+
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+
+#include <boost/log/trivial.hpp>
+
+#include "registry.hpp"
+
+using std::string;
+
+
+namespace fdas {
+
+/** Suffixes of the statistics streams, in the order of Windows::ids. */
+static const char *kSuffixes[] = {".min", ".max", ".mean", ".rms"};
+
+/** Parse a positive number of seconds. */
+static bool ParseSeconds(const string &text, double *seconds) {
+  try {
+    size_t end;
+    *seconds = std::stod(text, &end);
+    return end == text.size() && *seconds > 0;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+std::istream& operator>>(std::istream &in, StatisticsRule &rule) {
+  string token;
+  in >> token;
+
+  // The step is optional, the stream identifier may contain colons
+  size_t pos = token.rfind(':');
+  if (pos == 0 || pos == string::npos
+      || !ParseSeconds(token.substr(pos + 1), &rule.window)) {
+    in.setstate(std::ios_base::failbit);
+    return in;
+  }
+  rule.step = rule.window;
+
+  size_t before = token.rfind(':', pos - 1);
+  double window;
+  if (before != string::npos && before > 0
+      && ParseSeconds(token.substr(before + 1, pos - before - 1), &window)) {
+    rule.window = window;
+    pos = before;
+  }
+  rule.strid = token.substr(0, pos);
+
+  // Windows are made of whole panes of one step
+  double panes = rule.window / rule.step;
+  if (rule.step > rule.window
+      || std::fabs(panes - std::round(panes)) > 1e-6 * panes)
+    in.setstate(std::ios_base::failbit);
+  return in;
+}
+
+void StatisticsDataSink::Aggregate::Add(const Aggregate &other) {
+  if (!other.count)
+    return;
+  if (!count || other.min < min)
+    min = other.min;
+  if (!count || other.max > max)
+    max = other.max;
+  sum += other.sum;
+  sum_squares += other.sum_squares;
+  count += other.count;
+}
+
+StatisticsDataSink::StatisticsDataSink(DataSinkPtrList downstream,
+                                       std::vector<StatisticsRule> rules,
+                                       bool pass_through)
+    : downstream(std::move(downstream)), rules(std::move(rules)),
+      pass_through(pass_through) {}
+
+void StatisticsDataSink::Declare(const DataId *id, ValueType type) {
+  if (pass_through) {
+    for (const auto& sink: downstream)
+      sink->Declare(id, type);
+  }
+
+  for (const auto& rule: rules) {
+    if (rule.strid != id->StrId())
+      continue;
+    if (id->Handle() == DataId::kNoHandle) {
+      BOOST_LOG_TRIVIAL(warning) << "Stream " << rule.strid
+                                 << " is not registered, no statistics";
+      break;
+    }
+
+    if (windows.size() <= id->Handle())
+      windows.resize(id->Handle() + 1);
+    Windows &w = windows[id->Handle()];
+    w.step_us = std::max<uint64_t>(1, std::llround(rule.step * 1e6));
+    w.panes.resize(std::max<long>(1, std::lround(rule.window / rule.step)));
+    for (auto& pane: w.panes)
+      pane.Clear();
+    for (int i=0; i<4; i++) {
+      string strid = rule.strid + kSuffixes[i];
+      w.ids[i] = DataIdRegistry::Instance().Register(
+          strid.c_str(), id->Description(), id->Units());
+      for (const auto& sink: downstream)
+        sink->Declare(w.ids[i], ValueType::DOUBLE);
+    }
+    break;
+  }
+}
+
+/** Close the panes ending before a timestamp, emitting their windows. */
+void StatisticsDataSink::Close(Windows &w, uint64_t timestamp) {
+  // After a whole window of empty panes the following windows are empty
+  for (size_t n=0; w.pane_end && timestamp >= w.pane_end
+           && n < w.panes.size(); n++) {
+    Emit(w);
+    w.current = w.current + 1 == w.panes.size() ? 0 : w.current + 1;
+    w.panes[w.current].Clear();
+    w.pane_end += w.step_us;
+  }
+
+  // Start at the pane of the timestamp after a gap or at the first datum
+  if (timestamp >= w.pane_end)
+    w.pane_end = (timestamp / w.step_us + 1) * w.step_us;
+}
+
+/** Emit the statistics of the window ending with the current pane. */
+void StatisticsDataSink::Emit(const Windows &w) {
+  Aggregate total;
+  total.Clear();
+  for (const auto& pane: w.panes)
+    total.Add(pane);
+  if (!total.count)
+    return;
+
+  double values[4] = {
+    total.min, total.max, total.sum / total.count,
+    std::sqrt(total.sum_squares / total.count)};
+  for (int i=0; i<4; i++) {
+    Datum<double> datum(w.ids[i], values[i], w.pane_end);
+    for (const auto& sink: downstream)
+      sink->Take(datum);
+  }
+}
+
+}// namespace fdas
@@ -0,0 +1,151 @@
+#ifndef FDAS_COMMON_STATS_HPP_
+#define FDAS_COMMON_STATS_HPP_
+
+/**
+ * Windowed statistics of data streams for the FDAS.
+ */
+
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+
+namespace fdas {
+
+/**
+ * Statistics of a stream, like `STRID:WINDOW[:STEP]` in seconds.
+ * Windows are tumbling if the step is the window, otherwise sliding. The
+ * window must be a whole number of steps.
+ */
+struct StatisticsRule {
+  std::string strid;
+  double window;
+  double step;
+};
+
+std::istream& operator>>(std::istream &in, StatisticsRule &rule);
+
+/**
+ * Data sink computing the minimum, maximum, mean and RMS of some streams
+ * over time windows.
+ *
+ * The statistics of a stream STRID are emitted as the double streams
+ * STRID.min, STRID.max, STRID.mean and STRID.rms, timestamped with the end
+ * of each window, every step. Windows are aligned on multiples of the step
+ * since the epoch and split into panes of one step, whose aggregates are
+ * kept in a preallocated ring: each sample updates the current pane, and
+ * each step combines the panes of a window. Windows without data are not
+ * emitted. The values are aggregated as doubles, so 64-bit integers beyond
+ * 2^53 lose precision.
+ *
+ * The other data is passed on if `pass_through`, so the statistics can go
+ * along with the data or to their own sinks.
+ */
+class StatisticsDataSink : public DataSink {
+  /** Aggregate of the samples of a pane or window. */
+  struct Aggregate {
+    double min, max, sum, sum_squares;
+    uint64_t count;
+
+    void Clear() {
+      min = max = sum = sum_squares = 0;
+      count = 0;
+    }
+    void Add(double value) {
+      if (!count || value < min)
+        min = value;
+      if (!count || value > max)
+        max = value;
+      sum += value;
+      sum_squares += value * value;
+      count++;
+    }
+    void Add(const Aggregate &other);
+  };
+
+  /** Windows of a stream. */
+  struct Windows {
+    const DataId *ids[4]; /**< Streams of the min, max, mean and RMS. */
+    uint64_t step_us;
+    std::vector<Aggregate> panes;
+    size_t current = 0;   /**< Pane of the current step in the ring. */
+    uint64_t pane_end = 0; /**< End of the current pane, 0 before data. */
+  };
+
+  DataSinkPtrList downstream;
+  std::vector<StatisticsRule> rules;
+  bool pass_through;
+
+  /** Windows by stream handle, empty for the streams without statistics. */
+  std::vector<Windows> windows;
+
+  void Close(Windows &w, uint64_t timestamp);
+  void Emit(const Windows &w);
+
+  template<typename DataType> void Add(const DataId *id, DataType value,
+                                       uint64_t timestamp) {
+    if (id->Handle() >= windows.size() || windows[id->Handle()].panes.empty())
+      return;
+
+    Windows &w = windows[id->Handle()];
+    if (timestamp >= w.pane_end)
+      Close(w, timestamp);
+    w.panes[w.current].Add(static_cast<double>(value));
+  }
+
+  template<typename DataType> void Handle(const Datum<DataType> &datum) {
+    Add(datum.id, datum.data, datum.timestamp);
+    if (pass_through) {
+      for (const auto& sink: downstream)
+        sink->Take(datum);
+    }
+  }
+
+  template<typename DataType>
+  void HandleBlock(const DataBlock<DataType> &block) {
+    for (size_t i=0; i<block.size; i++)
+      Add(block.id, block.data[i], block.timestamps[i]);
+    if (pass_through) {
+      for (const auto& sink: downstream)
+        sink->TakeBlock(block);
+    }
+  }
+
+ public:
+  StatisticsDataSink(DataSinkPtrList downstream,
+                     std::vector<StatisticsRule> rules, bool pass_through);
+
+  virtual void Declare(const DataId *id, ValueType type);
+  virtual void Poll() {
+    for (const auto& sink: downstream)
+      sink->Poll();
+  }
+  virtual void Take(Datum<int8_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int16_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int32_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int64_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint8_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint16_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint32_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint64_t> datum) {Handle(datum);}
+  virtual void Take(Datum<double> datum) {Handle(datum);}
+  virtual void Take(Datum<float> datum) {Handle(datum);}
+  virtual void TakeBlock(const DataBlock<int8_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int16_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int32_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int64_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint8_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint16_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint32_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint64_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<double> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<float> &block) {HandleBlock(block);}
+};
+
+}// namespace fdas
+
+#endif//FDAS_COMMON_STATS_HPP_
@@ -0,0 +1,127 @@
+/**
+ * Event-triggered recording for the FDAS.
+ */
+
+#include "trigger.hpp"
+
+#include <csignal>
+#include <istream>
+
+#include <boost/log/trivial.hpp>
+
+using std::string;
+
+
+namespace fdas {
+
+std::atomic<unsigned> TriggeredDataSink::generation{0};
+
+
+std::istream& operator>>(std::istream &in, TriggerThreshold &threshold) {
+  string token;
+  in >> token;
+  size_t pos = token.find_first_of("<>");
+  if (pos == 0 || pos == string::npos || pos + 1 == token.size()) {
+    in.setstate(std::ios_base::failbit);
+    return in;
+  }
+
+  threshold.strid = token.substr(0, pos);
+  threshold.above = token[pos] == '>';
+  try {
+    size_t end;
+    threshold.level = std::stod(token.substr(pos + 1), &end);
+    if (pos + 1 + end != token.size())
+      in.setstate(std::ios_base::failbit);
+  } catch (const std::exception&) {
+    in.setstate(std::ios_base::failbit);
+  }
+  return in;
+}
+
+TriggeredDataSink::TriggeredDataSink(DataSinkPtrList downstream,
+                                     uint64_t pre_us, uint64_t post_us,
+                                     size_t capacity,
+                                     std::vector<TriggerThreshold> thresholds)
+    : downstream(std::move(downstream)), pre_us(pre_us), post_us(post_us),
+      ring(capacity ? capacity : 1), thresholds(std::move(thresholds)),
+      seen_generation(generation.load()) {
+  threshold_ids.resize(this->thresholds.size(), nullptr);
+  threshold_state.resize(this->thresholds.size(), false);
+}
+
+static void UsrHandler(int) {
+  TriggeredDataSink::TriggerAll();
+}
+
+void TriggeredDataSink::TriggerOnSignal() {
+  struct sigaction action = {};
+  action.sa_handler = UsrHandler;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, nullptr);
+}
+
+void TriggeredDataSink::Declare(const DataId *id, ValueType type) {
+  for (size_t i=0; i<thresholds.size(); i++) {
+    if (thresholds[i].strid == id->StrId())
+      threshold_ids[i] = id;
+  }
+  for (const auto& sink: downstream)
+    sink->Declare(id, type);
+}
+
+/** Check the trigger requests and conditions for a datum. */
+bool TriggeredDataSink::Triggered(const DataId *id, double value,
+                                  uint64_t timestamp) {
+  bool fire = false;
+  unsigned current = generation.load(std::memory_order_relaxed);
+  if (current != seen_generation) {
+    seen_generation = current;
+    fire = true;
+  }
+  if (requested.load(std::memory_order_relaxed)
+      && requested.exchange(false, std::memory_order_relaxed))
+    fire = true;
+
+  for (size_t i=0; i<thresholds.size(); i++) {
+    if (threshold_ids[i] != id)
+      continue;
+
+    const TriggerThreshold &threshold = thresholds[i];
+    bool state = threshold.above ? value > threshold.level
+                                 : value < threshold.level;
+    if (state && !threshold_state[i]) {
+      BOOST_LOG_TRIVIAL(info) << "Trigger on `" << threshold.strid << "` = "
+                              << value << " at " << timestamp;
+      fire = true;
+    }
+    threshold_state[i] = state;
+  }
+  return fire;
+}
+
+/** Start or extend the post-trigger window, dumping the pre-trigger data. */
+void TriggeredDataSink::Fire(uint64_t timestamp) {
+  // The ring only holds data outside the window, so it is all dumped from
+  // the start of the new pre-trigger window on
+  uint64_t since = timestamp > pre_us ? timestamp - pre_us : 0;
+  Dump(since);
+  if (since > pass_until)
+    pass_from = since;
+  pass_until = std::max(pass_until, timestamp + post_us);
+}
+
+/** Send the data in the ring from the given time on downstream and empty it. */
+void TriggeredDataSink::Dump(uint64_t since) {
+  size_t i = (head + ring.size() - count) % ring.size();
+  for (; count > 0; count--) {
+    if (ring[i].timestamp >= since) {
+      for (const auto& sink: downstream)
+        ring[i].SendTo(*sink);
+    }
+    i = i + 1 == ring.size() ? 0 : i + 1;
+  }
+}
+
+}
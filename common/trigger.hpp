@@ -0,0 +1,177 @@
+#ifndef FDAS_COMMON_TRIGGER_HPP_
+#define FDAS_COMMON_TRIGGER_HPP_
+
+/**
+ * Event-triggered recording for the FDAS.
+ */
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+
+namespace fdas {
+
+/** Trigger condition on the value of a stream, like `STRID>VALUE`. */
+struct TriggerThreshold {
+  std::string strid;
+  bool above;   /**< Fire above the level, otherwise below it. */
+  double level;
+};
+
+std::istream& operator>>(std::istream &in, TriggerThreshold &threshold);
+
+/**
+ * Data sink keeping the recent data and passing it on around events.
+ *
+ * While idle, the data of all streams goes to a preallocated ring holding
+ * the last `capacity` data, without allocating per datum. When a trigger
+ * fires, the data of the last `pre_us` microseconds is dumped downstream
+ * and the incoming data passes through until `post_us` microseconds after
+ * the trigger. Triggers during that window extend it. Each datum is judged
+ * by its own timestamp, so a stream lagging behind the others still gets
+ * its whole window.
+ *
+ * A trigger fires when a threshold condition on a declared stream becomes
+ * true, or on the next datum after Trigger() or TriggerAll(). The latter
+ * fires all triggered sinks of the process and is safe to call from signal
+ * handlers. Stream declarations always pass through, so the downstream
+ * headers are complete, and the downstream sinks are polled while the data
+ * is held back, so they still act on requests like a log rotation.
+ */
+class TriggeredDataSink : public DataSink {
+  DataSinkPtrList downstream;
+  uint64_t pre_us, post_us;
+
+  std::vector<AnyDatum> ring;
+  size_t head = 0;  /**< Position of the next datum in the ring. */
+  size_t count = 0; /**< Number of data in the ring. */
+
+  std::vector<TriggerThreshold> thresholds;
+  std::vector<const DataId*> threshold_ids; /**< Resolved on declaration. */
+  std::vector<bool> threshold_state; /**< Whether each condition holds. */
+
+  std::atomic<bool> requested{false};
+  unsigned seen_generation;
+  /** Window of the data passed on, from pre-trigger to post-trigger. */
+  uint64_t pass_from = 1, pass_until = 0;
+
+  /** Trigger generation, incremented by TriggerAll(). */
+  static std::atomic<unsigned> generation;
+
+  bool Triggered(const DataId *id, double value, uint64_t timestamp);
+  void Fire(uint64_t timestamp);
+  void Dump(uint64_t since);
+
+  /** Keep a datum in the ring, replacing the oldest if full. */
+  void Store(const AnyDatum &datum) {
+    ring[head] = datum;
+    head = head + 1 == ring.size() ? 0 : head + 1;
+    if (count < ring.size())
+      count++;
+  }
+
+  /** Whether a threshold is on a stream. */
+  bool Watched(const DataId *id) const {
+    return std::find(threshold_ids.begin(), threshold_ids.end(), id)
+        != threshold_ids.end();
+  }
+
+  /**
+   * Pass a datum on if it is inside the window, or keep it in the ring.
+   * @return whether it was kept.
+   */
+  template<typename DataType> bool Route(const Datum<DataType> &datum) {
+    if (Triggered(datum.id, static_cast<double>(datum.data), datum.timestamp))
+      Fire(datum.timestamp);
+
+    if (datum.timestamp >= pass_from && datum.timestamp <= pass_until) {
+      for (const auto& sink: downstream)
+        sink->Take(datum);
+      return false;
+    }
+    Store(AnyDatum(datum));
+    return true;
+  }
+
+  template<typename DataType> void Handle(const Datum<DataType> &datum) {
+    if (Route(datum))
+      Poll();
+  }
+
+  template<typename DataType>
+  void HandleBlock(const DataBlock<DataType> &block) {
+    // Pass whole blocks on inside the post-trigger window if no value needs
+    // checking, pending triggers then extend the window from the next block
+    if (block.size && block.timestamps[0] >= pass_from
+        && block.timestamps[block.size - 1] <= pass_until
+        && !Watched(block.id)) {
+      for (const auto& sink: downstream)
+        sink->TakeBlock(block);
+      return;
+    }
+
+    bool kept = false;
+    for (size_t i=0; i<block.size; i++)
+      kept |= Route(block[i]);
+    if (kept)
+      Poll();
+  }
+
+ public:
+  /**
+   * Create the sink.
+   * @param capacity Number of data the ring holds, it should cover the
+   *   pre-trigger window at the aggregate rate of all streams.
+   */
+  TriggeredDataSink(DataSinkPtrList downstream, uint64_t pre_us,
+                    uint64_t post_us, size_t capacity,
+                    std::vector<TriggerThreshold> thresholds = {});
+
+  /** Fire the trigger on the next datum, safe from any thread. */
+  void Trigger() {requested.store(true, std::memory_order_relaxed);}
+
+  /** Fire the trigger of all triggered sinks, async-signal-safe. */
+  static void TriggerAll() {
+    generation.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /** Fire the trigger of all triggered sinks on SIGUSR1. */
+  static void TriggerOnSignal();
+
+  virtual void Declare(const DataId *id, ValueType type);
+  virtual void Poll() {
+    for (const auto& sink: downstream)
+      sink->Poll();
+  }
+  virtual void Take(Datum<int8_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int16_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int32_t> datum) {Handle(datum);}
+  virtual void Take(Datum<int64_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint8_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint16_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint32_t> datum) {Handle(datum);}
+  virtual void Take(Datum<uint64_t> datum) {Handle(datum);}
+  virtual void Take(Datum<double> datum) {Handle(datum);}
+  virtual void Take(Datum<float> datum) {Handle(datum);}
+  virtual void TakeBlock(const DataBlock<int8_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int16_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int32_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<int64_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint8_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint16_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint32_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<uint64_t> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<double> &block) {HandleBlock(block);}
+  virtual void TakeBlock(const DataBlock<float> &block) {HandleBlock(block);}
+};
+
+}// namespace fdas
+
+#endif//FDAS_COMMON_TRIGGER_HPP_
@@ -7,6 +7,7 @@
 
 
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 
 
@@ -24,5 +25,18 @@ static inline uint64_t get_time_us() {
 }
 
 
+/**
+ * Allocate the buffer of a stdio stream now instead of at its first write,
+ * so that the read loops do not allocate memory.
+ * @param mode Buffering mode of the stream, _IOFBF or _IOLBF.
+ */
+static inline void preallocate_stream(FILE *stream, int mode) {
+    // glibc allocates the buffer when a stream is made fully buffered
+    if (setvbuf(stream, NULL, _IOFBF, BUFSIZ)
+        || (mode != _IOFBF && setvbuf(stream, NULL, mode, BUFSIZ)))
+        syslog(LOG_WARNING, "Error setting stream buffer: %s", strerror(errno));
+}
+
+
 
 #endif//UTILS_H
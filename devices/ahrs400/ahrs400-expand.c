@@ -0,0 +1,306 @@
+/**
+ * Expand AHRS400 raw MAVLink logs into scaled angle mode data.
+ */
+
+
+#include <argp.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "expand.h"
+#include "common/blocklog.h"
+#include "common/utils.h"
+
+
+/** Program version. */
+const char *argp_program_version = "ahrs400-expand 0.1";
+
+/** Bug report address. */
+const char *argp_program_bug_address = "https://github.com/cea-ufmg/fdas3";
+
+/** Program documentation. */
+static char doc[] = "ahrs400-expand -- Expand AHRS400 raw MAVLink logs into "
+    "scaled values, as text to STDOUT unless an output is given. Reads "
+    "STDIN if no LOG is given. Block logs are expanded up to their last "
+    "valid block.";
+
+/** Description of the accepted arguments. */
+static char args_doc[] = "[LOG...]";
+
+/** Program options structure. */
+static struct argp_option options[] = {
+    {"logtxt", 't', "FILE", 0, "Write the scaled data as text to FILE"},
+    {"logbin", 'b', "FILE", 0,
+     "Write the scaled data as AHRS400_ANGLE MAVLink stream FILE"},
+    {0}
+};
+
+/** Program arguments structure. */
+typedef struct arguments {
+    char **logs;
+    int log_count;
+    char *text_log;
+    char *binary_log;
+} arguments_t;
+
+/** Program output streams structure */
+typedef struct output_streams {
+    FILE *text_log;
+    FILE *binary_log;
+    unsigned long long text_bytes;
+    unsigned long long binary_bytes;
+} output_streams_t;
+
+
+/** Argument parser function */
+static error_t parse_opt (int key, char *arg, struct argp_state *state) {
+    //Get the arguments structure to write the parsed options
+    arguments_t *arguments = state->input;
+
+    switch (key) {
+    case 't':
+        arguments->text_log = arg;
+        break;
+
+    case 'b':
+        arguments->binary_log = arg;
+        break;
+
+    case ARGP_KEY_ARGS:
+        arguments->logs = state->argv + state->next;
+        arguments->log_count = state->argc - state->next;
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+/** Argument parser object. */
+static struct argp argp = {options, parse_opt, args_doc, doc};
+
+
+/**
+ * Open an output file.
+ * Aborts the program on error.
+ */
+FILE* open_output(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        syslog(LOG_ERR, "Error opening `%s`: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    preallocate_stream(file, _IOFBF);
+    return file;
+}
+
+
+/**
+ * Write the scaled messages of the expander to the outputs.
+ * @return 0 if success, -1 if error.
+ */
+int write_scaled(ahrs_expander_t *expander, output_streams_t *out) {
+    size_t count = ahrs_expander_convert(expander);
+    for (size_t i=0; i<count; i++) {
+        const mavlink_ahrs400_angle_t *angle = expander->angle + i;
+        if (out->text_log) {
+            int len = ahrs_print_text(out->text_log, angle);
+            if (len < 0) {
+                syslog(LOG_ERR, "Error writing text: %s", strerror(errno));
+                return -1;
+            }
+            out->text_bytes += len;
+        }
+
+        if (out->binary_log) {
+            mavlink_message_t msg;
+            uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+            mavlink_msg_ahrs400_angle_encode(expander->sysid,
+                                             expander->compid, &msg, angle);
+            size_t len = mavlink_msg_to_send_buffer(buf, &msg);
+            if (!fwrite(buf, len, 1, out->binary_log)) {
+                syslog(LOG_ERR, "Error writing MAVLink stream: %s",
+                       strerror(errno));
+                return -1;
+            }
+            out->binary_bytes += len;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Feed raw log data to the expander, writing the full batches.
+ * @return 0 if success, -1 if error.
+ */
+static int feed(ahrs_expander_t *expander, const uint8_t *data, size_t len,
+                output_streams_t *out) {
+    for (size_t parsed=0; parsed<len;) {
+        parsed += ahrs_expander_feed(expander, data + parsed, len - parsed);
+        if (expander->count == AHRS_EXPAND_BATCH
+            && write_scaled(expander, out))
+            return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Expand the payloads of a block log, whose first block header was read,
+ * up to the last of its leading valid blocks, like blocklog-recover keeps.
+ * @return 0 if success, -1 if error.
+ */
+static int expand_blocks(FILE *file, const char *name,
+                         blocklog_header_t header,
+                         ahrs_expander_t *expander, output_streams_t *out) {
+    uint8_t *payload = NULL;
+    size_t capacity = 0;
+    int status = 0;
+    for (uint32_t sequence=0;; sequence++) {
+        // Check the header before trusting its length
+        bool valid = !memcmp(header.magic, BLOCKLOG_MAGIC, sizeof header.magic)
+            && header.sequence == sequence;
+        if (valid && header.length > capacity) {
+            uint8_t *grown = realloc(payload, header.length);
+            if (!grown) {
+                syslog(LOG_ERR, "Error allocating block of `%s`: %s", name,
+                       strerror(errno));
+                status = -1;
+                break;
+            }
+            payload = grown;
+            capacity = header.length;
+        }
+        if (!valid || fread(payload, 1, header.length, file) != header.length
+            || !blocklog_check(&header, payload, sequence)) {
+            syslog(LOG_WARNING, "`%s`: block %u is invalid, dropping the "
+                   "rest of the log", name, sequence);
+            break;
+        }
+
+        if (feed(expander, payload, header.length, out)) {
+            status = -1;
+            break;
+        }
+
+        size_t n = fread(&header, 1, sizeof header, file);
+        if (n != sizeof header) {
+            if (n)
+                syslog(LOG_WARNING, "`%s`: block %u is truncated, dropping "
+                       "it", name, sequence + 1);
+            break;
+        }
+    }
+    free(payload);
+    return status;
+}
+
+
+/**
+ * Expand a raw log, either a MAVLink stream or a block log holding one.
+ * @return 0 if success, -1 if error.
+ */
+int expand(FILE *file, const char *name, ahrs_expander_t *expander,
+           output_streams_t *out) {
+    // Block logs start with a block header, streams with a MAVLink frame
+    blocklog_header_t header;
+    size_t n = fread(&header, 1, sizeof header, file);
+    if (n == sizeof header
+        && !memcmp(header.magic, BLOCKLOG_MAGIC, sizeof header.magic)) {
+        if (expand_blocks(file, name, header, expander, out))
+            return -1;
+    } else {
+        if (feed(expander, (const uint8_t *) &header, n, out))
+            return -1;
+
+        uint8_t buf[1 << 16];
+        while ((n = fread(buf, 1, sizeof buf, file)) > 0) {
+            if (feed(expander, buf, n, out))
+                return -1;
+        }
+    }
+    if (ferror(file)) {
+        syslog(LOG_ERR, "Error reading `%s`: %s", name, strerror(errno));
+        return -1;
+    }
+    return write_scaled(expander, out);
+}
+
+
+int main(int argc, char **argv) {
+    // Parse command line arguments
+    arguments_t arguments = {};
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    // Setup syslog
+    openlog(0, LOG_PERROR, 0);
+
+    // Open the outputs
+    output_streams_t out = {};
+    if (arguments.text_log)
+        out.text_log = open_output(arguments.text_log);
+    if (arguments.binary_log)
+        out.binary_log = open_output(arguments.binary_log);
+    if (!out.text_log && !out.binary_log) {
+        preallocate_stream(stdout, _IOFBF);
+        out.text_log = stdout;
+    }
+    if (out.text_log && ahrs_print_text_header(out.text_log) < 0) {
+        syslog(LOG_ERR, "Error writing text: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Expand the logs with a single parser, they may be segments of one
+    static ahrs_expander_t expander;
+    ahrs_expander_init(&expander, MAVLINK_COMM_0);
+    int status = EXIT_SUCCESS;
+    clock_t start = clock();
+    if (!arguments.log_count) {
+        if (expand(stdin, "STDIN", &expander, &out))
+            status = EXIT_FAILURE;
+    }
+    for (int i=0; i<arguments.log_count; i++) {
+        const char *path = arguments.logs[i];
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            syslog(LOG_ERR, "Error opening `%s`: %s", path, strerror(errno));
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if (expand(file, path, &expander, &out))
+            status = EXIT_FAILURE;
+        fclose(file);
+    }
+
+    if ((out.text_log && fflush(out.text_log))
+        || (out.binary_log && fflush(out.binary_log))) {
+        syslog(LOG_ERR, "Error writing output: %s", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+
+    // Report what the raw-only log saved
+    double cpu_s = (double) (clock() - start) / CLOCKS_PER_SEC;
+    unsigned long frames = expander.raw_messages;
+    syslog(LOG_INFO, "Expanded %lu raw messages from %llu bytes in %.3f s "
+           "CPU, skipped %lu scaled and %lu other messages", frames,
+           expander.bytes, cpu_s, expander.scaled_messages,
+           expander.other_messages);
+    if (frames)
+        syslog(LOG_INFO, "Per frame: %.1f bytes in, %.1f bytes text, "
+               "%.1f bytes MAVLink, %.2f us CPU",
+               (double) expander.bytes / frames,
+               (double) out.text_bytes / frames,
+               (double) out.binary_bytes / frames, cpu_s * 1e6 / frames);
+
+    return status;
+}
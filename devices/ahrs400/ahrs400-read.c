@@ -6,16 +6,21 @@
 #include <argp.h>
 #include <errno.h>
 #include <netdb.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include "ahrs400.h"
+#include "expand.h"
+#include "common/logrotate.h"
+#include "common/utils.h"
 
 
 /** Mavlink system identifier */
@@ -24,6 +29,18 @@
 /** Mavlink compenent identifier, equal to MAV_COMP_ID_IMU */
 #define MAVLINK_COMPID 200
 
+/** Time over which the frame rate is measured, in microseconds. */
+#define FRAME_RATE_PERIOD_US 10000000
+
+/** Size of the angle mode frames, header and checksum included. */
+#define ANGLE_FRAME_SIZE (AHRS_ANGLE_PAYLOAD_LEN + 2)
+
+/** Attempts to stop the data and ping the AHRS at each baud rate. */
+#define PING_ATTEMPTS 2
+
+/** Time between the attempts to reopen the AHRS port, in microseconds. */
+#define REOPEN_DELAY_US 500000
+
 /** Program version. */
 const char *argp_program_version = "ahrs400-read 0.1";
 
@@ -40,6 +57,26 @@ static char args_doc[] = "AHRS_PORT";
 static struct argp_option options[] = {
     {"logtxt", 't', "FILE", 0, "Write received data as text to FILE"},
     {"logbin", 'b', "FILE", 0, "Write binary MAVLink stream FILE"},
+    {"logseg", 's', "PREFIX", 0,
+     "Write binary MAVLink stream to preallocated memory-mapped segments "
+     "PREFIX.NNNNNN"},
+    {"segment-size", 'S', "MIB", 0,
+     "Size of each log segment in MiB, defaults to 64"},
+    {"logblk", 'k', "FILE", 0,
+     "Write binary MAVLink stream to crash-safe checksummed block log FILE"},
+    {"commit-ms", 'C', "MS", 0,
+     "Longest time data waits to be flushed to the block log, defaults "
+     "to 100"},
+    {"commit-kib", 'K', "KIB", 0,
+     "Amount of data flushed at least together to the block log, defaults "
+     "to 64"},
+    {"max-baud", 'B', "BAUD", 0,
+     "Fastest AHRS baud rate to negotiate, defaults to 57600, 38400 keeps "
+     "the default rate"},
+    {"raw-only", 'r', 0, 0,
+     "Log and send only the raw messages, ahrs400-expand derives the "
+     "scaled ones and the text log from them, --logtxt and --verbose are "
+     "ignored"},
     {"verbose", 'v', 0, 0, "Write received data as text to STDOUT"},
     {"udp", 'u', "HOST", OPTION_ARG_OPTIONAL,
      "Send MAVLink messages via UDP to HOST, defaults to 224.0.0.1"},
@@ -53,6 +90,13 @@ typedef struct arguments {
     char *ahrs_port;
     char *text_log;
     char *binary_log;
+    char *segment_log;
+    size_t segment_size;
+    char *block_log;
+    unsigned commit_ms;
+    size_t commit_bytes;
+    unsigned max_baud;
+    bool raw_only;
     bool verbose;
     bool use_udp;
     char *udp_host;
@@ -62,10 +106,25 @@ typedef struct arguments {
 /** Program output streams structure */
 typedef struct output_streams {
     int udp_sock;
-    FILE *binary_log;
-    FILE *text_log;
+    log_files_t logs;
+    unsigned long long bytes; /**< Bytes of the logged messages and text. */
 } output_streams_t;
 
+/** Reconnection counters. */
+typedef struct reconnect_stats {
+    unsigned long count;      /**< Reconnections to the AHRS. */
+    bool recovering;          /**< Waiting for the first packet after one. */
+    uint64_t last_packet_us;  /**< Reception time of the last packet. */
+    uint64_t max_gap_us;      /**< Longest gap in the data of a reconnection. */
+} reconnect_stats_t;
+
+
+/** Set by the SIGHUP handler to request the rotation of the logs. */
+static volatile sig_atomic_t rotate_requested = 0;
+
+/** Set by the SIGTERM and SIGINT handler to request a clean exit. */
+static volatile sig_atomic_t terminate_requested = 0;
+
 
 /** Argument parser function */
 static error_t parse_opt (int key, char *arg, struct argp_state *state) {
@@ -77,6 +136,10 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         arguments->text_log = arg;
         break;
 
+    case 'r':
+        arguments->raw_only = true;
+        break;
+
     case 'v':
         arguments->verbose = true;
         break;
@@ -85,6 +148,54 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         arguments->binary_log = arg;
         break;
 
+    case 's':
+        arguments->segment_log = arg;
+        break;
+
+    case 'S':
+        {
+            char *endptr = 0;
+            unsigned long segment_size = strtoul(arg, &endptr, 0);
+            if (*endptr || !segment_size)
+                argp_error(state, "MIB argument must be a positive integer.");
+            arguments->segment_size = (size_t) segment_size << 20;
+        }
+        break;
+
+    case 'k':
+        arguments->block_log = arg;
+        break;
+
+    case 'C':
+        {
+            char *endptr = 0;
+            unsigned long commit_ms = strtoul(arg, &endptr, 0);
+            if (*endptr)
+                argp_error(state, "MS argument must be an integer.");
+            arguments->commit_ms = commit_ms;
+        }
+        break;
+
+    case 'K':
+        {
+            char *endptr = 0;
+            unsigned long commit_kib = strtoul(arg, &endptr, 0);
+            if (*endptr)
+                argp_error(state, "KIB argument must be an integer.");
+            arguments->commit_bytes = (size_t) commit_kib << 10;
+        }
+        break;
+
+    case 'B':
+        {
+            char *endptr = 0;
+            unsigned long max_baud = strtoul(arg, &endptr, 0);
+            if (*endptr || !max_baud)
+                argp_error(state, "BAUD argument must be a positive integer.");
+            arguments->max_baud = max_baud;
+        }
+        break;
+
     case 'u':
         arguments->use_udp = true;
         if (arg)
@@ -129,36 +240,39 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
 static struct argp argp = {options, parse_opt, args_doc, doc};
 
 
+/** SIGHUP handler, requests the rotation of the logs. */
+static void hup_handler(int sig) {
+    rotate_requested = 1;
+}
+
+
+/** SIGTERM and SIGINT handler, requests closing the logs and exiting. */
+static void term_handler(int sig) {
+    terminate_requested = 1;
+}
+
+
+/**
+ * Print the text log file header.
+ */
+void print_text_header(FILE *text_log) {
+    if (ahrs_print_text_header(text_log) < 0)
+        syslog(LOG_ERR, "Error writing to text log: %s", strerror(errno));
+}
+
+
 /**
  * Open the program output streams
  */
-void open_output_streams(arguments_t *args, output_streams_t *out) {
-    // Open text log
-    if (args->text_log) {
-	out->text_log = fopen(args->text_log, "w");
-	if (!out->text_log) {
-	    syslog(LOG_ERR, "Error opening text log: %s", strerror(errno));
-	    exit(EXIT_FAILURE);
-	}
-        // Print file header
-        int status = fprintf(
-            out->text_log, "%% time[us]\txacc[m/s^2]\tyacc\tzacc\t"
-            "xgyro[rad/s]\tygyro\tzgyro\txmag[gauss]\tymag\tzmag\t"
-            "xmag[gauss]\tymag\tzmag\troll[rad]\tpitch\tyaw\t"
-            "temperature[C]\tsensor_time\n"
-        );
-        if (status < 0)
-            syslog(LOG_ERR, "Error writing to text log: %s", strerror(errno));
-    }
-    
-    // Open binary log
-    if (args->binary_log) {
-	out->binary_log = fopen(args->binary_log, "w");
-	if (!out->binary_log) {
-	    syslog(LOG_ERR, "Error opening binary log: %s", strerror(errno));
-	    exit(EXIT_FAILURE);
-	}
-    }
+void open_output_streams(arguments_t *args, const log_config_t *log_config,
+                         output_streams_t *out) {
+    // Open the logs
+    if (log_files_open(log_config, 0, &out->logs))
+        exit(EXIT_FAILURE);
+
+    // Allocate the STDOUT buffer before the read loop
+    if (args->verbose)
+        preallocate_stream(stdout, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF);
     
     // Open UDP socket
     if (args->use_udp) {
@@ -193,31 +307,93 @@ void open_output_streams(arguments_t *args, output_streams_t *out) {
 }
 
 
-void log_text(const mavlink_ahrs400_angle_t *angle, FILE *out) {
+/**
+ * Close the program output streams, flushing all logged data.
+ */
+void close_output_streams(output_streams_t *out) {
+    log_files_close(&out->logs);
+    if (out->udp_sock >= 0)
+        close(out->udp_sock);
+}
+
+
+/**
+ * Write a scaled message as text.
+ * @return The number of characters written.
+ */
+size_t log_text(const mavlink_ahrs400_angle_t *angle, FILE *out) {
     if (out) {
-        int status = fprintf(
-            out, "%llu\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t"
-            "%e\t%e\t%e\t%e\t%u\n", (unsigned long long) angle->time_usec,
-            angle->xacc, angle->yacc, angle->zacc,
-            angle->xgyro, angle->ygyro, angle->zgyro,
-            angle->xmag, angle->ymag, angle->zmag,
-            angle->roll, angle->pitch, angle->yaw,
-            angle->temperature, angle->sensor_time
-        );
+        int status = ahrs_print_text(out, angle);
         if (status < 0)
 	    syslog(LOG_ERR, "Error writing to text log: %s", strerror(errno));
-    }    
+        else
+            return status;
+    }
+    return 0;
+}
+
+
+/**
+ * Get the CPU time used by the process, in microseconds.
+ */
+static uint64_t get_cpu_time_us(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ull
+        + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+
+/**
+ * Report the frame rate once measured, with the fastest the baud rate allows,
+ * and the output bytes and CPU time per frame over the same period.
+ */
+void report_frame_rate(uint64_t time_us, unsigned baud,
+                       const output_streams_t *out) {
+    static uint64_t start_us, start_cpu_us;
+    static unsigned long long start_bytes;
+    static unsigned long frames;
+    static bool reported;
+
+    if (reported)
+        return;
+    if (!frames++) {
+        start_us = time_us;
+        start_cpu_us = get_cpu_time_us();
+        start_bytes = out->bytes;
+    }
+    if (time_us - start_us >= FRAME_RATE_PERIOD_US) {
+        syslog(LOG_INFO, "AHRS frame rate %.1f Hz at %u baud, at most %.1f Hz",
+               (frames - 1) * 1e6 / (time_us - start_us), baud,
+               baud / 10.0 / ANGLE_FRAME_SIZE);
+        syslog(LOG_INFO, "Output %.1f bytes per frame, %.1f us CPU per frame",
+               (double) (out->bytes - start_bytes) / (frames - 1),
+               (double) (get_cpu_time_us() - start_cpu_us) / (frames - 1));
+        reported = true;
+    }
 }
 
 
 void output_mavlink_msg(mavlink_message_t *msg, output_streams_t *out) {
     uint8_t buf[MAVLINK_MAX_PACKET_LEN];
     size_t len = mavlink_msg_to_send_buffer(buf, msg);
-    
+    out->bytes += len;
+
     // Output to binary log
-    if (out->binary_log)
-        if (!fwrite(buf, len, 1, out->binary_log))
+    if (out->logs.binary_log)
+        if (!fwrite(buf, len, 1, out->logs.binary_log))
 	    syslog(LOG_ERR, "Error writing to binary log: %s", strerror(errno));
+
+    // Output to segment log
+    if (out->logs.segment_log)
+        if (seglog_write(out->logs.segment_log, buf, len))
+            syslog(LOG_ERR, "Error writing to segment log");
+
+    // Output to block log
+    if (out->logs.block_log)
+        if (blocklog_write(out->logs.block_log, buf, len))
+            syslog(LOG_ERR, "Error writing to block log");
     
     // Output to UDP socket
     if (out->udp_sock > 0)
@@ -245,57 +421,188 @@ void output_angle(const mavlink_ahrs400_angle_t *angle, output_streams_t *out) {
 }
 
 
+/**
+ * Bring the AHRS into the continuous angle mode, from any state.
+ * Tries the current baud rate of the port, then the default rate the AHRS
+ * has after a power cycle, and raises the rate again from the default.
+ * @param[in,out] baud rate of the port.
+ * @return 0 if success, -1 if the AHRS does not answer or if error.
+ */
+int start_ahrs(int fd, ahrs_framer_t *framer, unsigned *baud,
+               unsigned max_baud) {
+    const unsigned rates[] = {*baud, AHRS_DEFAULT_BAUD};
+    bool found = false;
+    for (int i=0; i<2 && !found; i++) {
+        if (i && rates[i] == rates[0])
+            break;
+        if (ahrs_set_port_baud(fd, rates[i]))
+            return -1;
+
+        // Stop the data in the polled mode and wait for the line to be
+        // quiet, again if the command was lost
+        for (int j=0; j<PING_ATTEMPTS && !found; j++) {
+            if (ahrs_set_polled(fd))
+                return -1;
+            found = !ahrs_purge_quiet(fd) && !ahrs_ping(fd);
+        }
+        if (found)
+            *baud = rates[i];
+    }
+    if (!found)
+        return -1;
+
+    // Drop the bytes framed before the purge
+    ahrs_framer_reset(framer);
+
+    if (*baud == AHRS_DEFAULT_BAUD) {
+        *baud = ahrs_negotiate_baud(fd, max_baud);
+        if (!*baud) {
+            *baud = AHRS_DEFAULT_BAUD;
+            return -1;
+        }
+    }
+
+    if (ahrs_set_mode(fd, AHRS_ANGLE_MODE) || ahrs_set_continuous(fd))
+        return -1;
+    return 0;
+}
+
+
+/**
+ * Reconnect to the AHRS after a stall or error, in-process, until it works
+ * or termination is requested. The port is reopened if the AHRS does not
+ * answer, in case it is gone, like an unplugged USB adapter.
+ */
+void reconnect_ahrs(arguments_t *args, int *fd, ahrs_framer_t *framer,
+                    unsigned *baud, reconnect_stats_t *stats) {
+    stats->count++;
+    if (!stats->recovering && !stats->last_packet_us)
+        stats->last_packet_us = get_time_us();
+    stats->recovering = true;
+    syslog(LOG_WARNING, "Reconnecting to the AHRS, reconnection %lu",
+           stats->count);
+
+    while (!terminate_requested
+           && start_ahrs(*fd, framer, baud, args->max_baud)) {
+        close(*fd);
+        do {
+            usleep(REOPEN_DELAY_US);
+            *fd = ahrs_open(args->ahrs_port);
+        } while (*fd < 0 && !terminate_requested);
+    }
+}
+
+
+/**
+ * Report the recovery time of a reconnection on its first packet.
+ */
+void report_recovery(uint64_t time_us, reconnect_stats_t *stats) {
+    if (stats->recovering) {
+        uint64_t gap_us = time_us - stats->last_packet_us;
+        if (gap_us > stats->max_gap_us)
+            stats->max_gap_us = gap_us;
+        syslog(LOG_INFO, "AHRS data resumed after a %.1f ms gap, "
+               "%lu reconnections, longest gap %.1f ms", gap_us / 1e3,
+               stats->count, stats->max_gap_us / 1e3);
+        stats->recovering = false;
+    }
+    stats->last_packet_us = time_us;
+}
+
+
 int main(int argc, char **argv) {
     // Parse command line arguments
-    arguments_t arguments = {.udp_host="224.0.0.1", .udp_port=38400};
+    arguments_t arguments = {
+        .udp_host="224.0.0.1", .udp_port=38400, .segment_size=64 << 20,
+        .commit_ms=100, .commit_bytes=64 << 10, .max_baud=57600
+    };
     output_streams_t output_streams = {.udp_sock=-1};
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
     // Setup syslog
     openlog(0, LOG_PERROR, 0);
 
+    // The raw-only mode formats no text in flight
+    if (arguments.raw_only && (arguments.text_log || arguments.verbose)) {
+        syslog(LOG_WARNING, "Raw-only mode, no text output is written, "
+               "ahrs400-expand converts the raw log to text");
+        arguments.text_log = NULL;
+        arguments.verbose = false;
+    }
+
     // Open the output streams
-    open_output_streams(&arguments, &output_streams);
+    log_config_t log_config = {
+        .text_log=arguments.text_log, .binary_log=arguments.binary_log,
+        .segment_log=arguments.segment_log, .block_log=arguments.block_log,
+        .segment_size=arguments.segment_size,
+        .commit_ms=arguments.commit_ms, .commit_bytes=arguments.commit_bytes,
+        .text_header=print_text_header
+    };
+    open_output_streams(&arguments, &log_config, &output_streams);
+
+    // Rotate the logs on SIGHUP, the new ones are opened by the rotation
+    // thread and switched to between two messages
+    logrotate_t *rotate = logrotate_start(&log_config);
+    if (!rotate)
+        return EXIT_FAILURE;
+    struct sigaction hup_action = {.sa_handler=hup_handler,
+                                   .sa_flags=SA_RESTART};
+    sigemptyset(&hup_action.sa_mask);
+    sigaction(SIGHUP, &hup_action, NULL);
+
+    // Close the logs on SIGTERM and SIGINT, so they are complete
+    struct sigaction term_action = {.sa_handler=term_handler,
+                                    .sa_flags=SA_RESTART};
+    sigemptyset(&term_action.sa_mask);
+    sigaction(SIGTERM, &term_action, NULL);
+    sigaction(SIGINT, &term_action, NULL);
     
     // Open AHRS port
-    FILE *ahrs_stream = ahrs_open(arguments.ahrs_port);
-    if (!ahrs_stream)
+    int ahrs_fd = ahrs_open(arguments.ahrs_port);
+    if (ahrs_fd < 0)
         return EXIT_FAILURE;
 
-    // Put AHRS into polled mode for configuration
-    if (ahrs_set_polled(ahrs_stream))
-        return EXIT_FAILURE;
-        
-    // Wait for pending data to arrive and clear buffers
-    fflush(ahrs_stream);
-    sleep(1);
-    ahrs_purge(ahrs_stream);
-    
-    // Ping the AHRS
-    if (ahrs_ping(ahrs_stream))
-        return EXIT_FAILURE;
-    
-    // Set the mode
-    if (ahrs_set_mode(ahrs_stream, AHRS_ANGLE_MODE)
-        || ahrs_set_continuous(ahrs_stream))
+    // Put the AHRS into the continuous angle mode at the fastest rate
+    static ahrs_framer_t framer;
+    ahrs_framer_init(&framer, AHRS_ANGLE_PAYLOAD_LEN);
+    unsigned baud = AHRS_DEFAULT_BAUD;
+    if (start_ahrs(ahrs_fd, &framer, &baud, arguments.max_baud))
         return EXIT_FAILURE;
 
     // Read loop
-    for (;;) {
+    reconnect_stats_t reconnect_stats = {};
+    while (!terminate_requested) {
         mavlink_ahrs400_angle_raw_t angle_raw;
-        if (ahrs_get_angle_raw(ahrs_stream, &angle_raw))
-            return EXIT_FAILURE;
+        if (ahrs_get_angle_raw(ahrs_fd, &framer, &angle_raw)) {
+            reconnect_ahrs(&arguments, &ahrs_fd, &framer, &baud,
+                           &reconnect_stats);
+            continue;
+        }
+        report_recovery(angle_raw.time_usec, &reconnect_stats);
+        report_frame_rate(angle_raw.time_usec, baud, &output_streams);
+        output_angle_raw(&angle_raw, &output_streams);
 
-        mavlink_ahrs400_angle_t angle;
-        ahrs_angle_conv(&angle_raw, &angle);
+        // The scaled message and the text are derived offline if raw-only
+        if (!arguments.raw_only) {
+            mavlink_ahrs400_angle_t angle;
+            ahrs_angle_conv(&angle_raw, &angle);
+            output_angle(&angle, &output_streams);
 
-        output_angle_raw(&angle_raw, &output_streams);
-        output_angle(&angle, &output_streams);
-        
-        log_text(&angle, output_streams.text_log);
-        if (arguments.verbose)
-            log_text(&angle, stdout);
+            output_streams.bytes += log_text(&angle,
+                                             output_streams.logs.text_log);
+            if (arguments.verbose)
+                log_text(&angle, stdout);
+        }
+
+        if (rotate_requested) {
+            rotate_requested = 0;
+            logrotate_request(rotate);
+        }
+        logrotate_swap(rotate, &output_streams.logs);
     }
-    
+
+    syslog(LOG_INFO, "Terminating, closing the logs");
+    logrotate_stop(rotate);
+    close_output_streams(&output_streams);
     return 0;
 }
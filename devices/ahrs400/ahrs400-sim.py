@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+"""Run an AHRS400 reader against a simulated AHRS400 on a pseudo-terminal.
+
+The simulated AHRS answers the ping, mode and baud rate commands and sends
+angle mode packets at 100 Hz while in the continuous mode. The path of the
+pseudo-terminal is appended to the arguments of the program, whose exit
+status is returned. With --preload, the library is preloaded in the program
+only, like libfdas-alloc-check.so, which ends the program itself.
+"""
+
+import argparse
+import os
+import pty
+import select
+import subprocess
+import sys
+import time
+
+
+PAYLOAD_LEN = 28
+PACKET_PERIOD = 0.01
+
+
+def packet(count):
+    """Angle mode packet: header, slowly varying payload and checksum."""
+    payload = bytes((count + 7 * i) % 0x80 for i in range(PAYLOAD_LEN))
+    return b'\xff' + payload + bytes([sum(payload) & 0xff])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--preload', help='library preloaded in the program')
+    parser.add_argument('--timeout', type=float, default=60,
+                        help='seconds after which the program is killed')
+    parser.add_argument('program', nargs=argparse.REMAINDER,
+                        help='program and its arguments')
+    args = parser.parse_args()
+    if not args.program:
+        parser.error('no program given')
+
+    # Keep the slave open so the reader can reopen it without EOF
+    master, slave = pty.openpty()
+    env = dict(os.environ)
+    if args.preload:
+        env['LD_PRELOAD'] = args.preload
+    reader = subprocess.Popen(args.program + [os.ttyname(slave)], env=env)
+
+    continuous = False
+    baud_code = False
+    count = 0
+    start = time.monotonic()
+    next_packet = start
+    while reader.poll() is None:
+        now = time.monotonic()
+        if now - start > args.timeout:
+            reader.kill()
+            reader.wait()
+            print('ahrs400-sim: program killed after %g s' % args.timeout,
+                  file=sys.stderr)
+            return 1
+
+        ready, _, _ = select.select([master], [], [],
+                                    max(0, next_packet - now))
+        if ready:
+            for command in os.read(master, 64):
+                command = chr(command)
+                if baud_code:
+                    baud_code = False
+                elif command == 'P':
+                    continuous = False
+                elif command == 'R':
+                    os.write(master, b'H')
+                elif command == 'a':
+                    os.write(master, b'A')
+                elif command == 'b':
+                    os.write(master, b'B')
+                    baud_code = True
+                elif command == 'C':
+                    continuous = True
+
+        if continuous and time.monotonic() >= next_packet:
+            os.write(master, packet(count))
+            count += 1
+            next_packet += PACKET_PERIOD
+        elif not continuous:
+            next_packet = time.monotonic() + PACKET_PERIOD
+
+    return reader.returncode
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -4,7 +4,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
-#include <math.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
@@ -16,17 +16,25 @@
 
 
 #include "ahrs400.h"
-#include "../../utils/utils.h"
+#include "common/utils.h"
 
 
 /*** AHRS constants ***/
-#define AHRS_GYRO_RANGE (200 * M_PI / 180)
-#define AHRS_G_RANGE 4
 #define AHRS_DEFAULT_BAUDRATE B38400
+#define AHRS_DEFAULT_BAUD_CODE 2
+
+/** Time the AHRS is given to answer a command, in ms. */
+#define AHRS_RESPONSE_TIMEOUT_MS 500
+
+/** Time without data after which reads return, in tenths of a second. */
+#define AHRS_STALL_TIMEOUT_DS 2
+
+/** Time without data after which the line is quiet, in ms. */
+#define AHRS_QUIET_MS 50
+
+/** Longest time the line is purged waiting for it to be quiet, in ms. */
+#define AHRS_QUIET_TIMEOUT_MS 200
 
-#define AHRS_DATA_HEADER 0xFF
-#define AHRS_MAX_MSG_SIZE 30
-#define AHRS_ANGLE_PAYLOAD_LEN 28
 
 
 /*** AHRS Message codes ***/
@@ -67,118 +75,262 @@
 #define CLEAR_SOFTI_RESPONSE 'T'
 
 
+/** Baud rates of the AHRS, fastest first, with their codes. */
+static const struct {
+    speed_t speed;
+    unsigned baud;
+    uint8_t code;
+} baud_rates[] = {
+    {B57600, 57600, 3},
+    {AHRS_DEFAULT_BAUDRATE, AHRS_DEFAULT_BAUD, AHRS_DEFAULT_BAUD_CODE},
+    {B19200, 19200, 1},
+    {B9600, 9600, 0}
+};
+
+
+/**
+ * Set the baud rate of the serial port, after the pending output is sent.
+ * @return 0 if success, -1 if error.
+ */
+static int set_speed(int fd, speed_t speed) {
+    struct termios ahrs_termios;
+    if (tcdrain(fd)
+        || tcgetattr(fd, &ahrs_termios)
+        || cfsetispeed(&ahrs_termios, speed)
+        || cfsetospeed(&ahrs_termios, speed)
+        || tcsetattr(fd, TCSANOW, &ahrs_termios))
+        return -1;
+    return 0;
+}
+
+
 /**
- * Open the AHRS serial port stream.
+ * Open the AHRS serial port.
+ * Reads of the port return 0 after AHRS_STALL_TIMEOUT_DS without data, so
+ * that stalls are detected without polling the port before each read.
  * @param The path of the serial port device.
- * @return The AHRS port stream or NULL if error.
+ * @return The AHRS port file descriptor or -1 if error.
  */
-FILE* ahrs_open(char *path) {
+int ahrs_open(char *path) {
     int fd = open(path, O_RDWR);
     if (fd < 0) {
         char *msg = "Error opening AHRS port `%s`: %s";
         syslog(LOG_ERR, msg, path, strerror(errno));
-        return NULL;
-    }
-    
-    FILE *file = fdopen(fd, "r+b");
-    if (!file) {
-        syslog(LOG_ERR, "Error in fdopen: %s", strerror(errno));
-        close(fd);
-        return NULL;
+        return -1;
     }
     
     struct termios ahrs_termios;
-    if (tcgetattr(fd, &ahrs_termios)
-        || cfsetispeed(&ahrs_termios, AHRS_DEFAULT_BAUDRATE)
-        || cfsetospeed(&ahrs_termios, AHRS_DEFAULT_BAUDRATE)
-        || tcsetattr(fd, TCSANOW, &ahrs_termios)) {
+    if (set_speed(fd, AHRS_DEFAULT_BAUDRATE)) {
         char *msg = "Error setting AHRS serial port baud rate: %s";
         syslog(LOG_WARNING, msg, strerror(errno));
+    } else if (tcgetattr(fd, &ahrs_termios)) {
+        char *msg = "Error getting AHRS serial port attributes: %s";
+        syslog(LOG_WARNING, msg, strerror(errno));
     } else {
         cfmakeraw(&ahrs_termios);
+        ahrs_termios.c_cc[VMIN] = 0;
+        ahrs_termios.c_cc[VTIME] = AHRS_STALL_TIMEOUT_DS;
         if (tcsetattr(fd, TCSANOW, &ahrs_termios)) {
             char *msg = "Error making AHRS serial port raw: %s";
             syslog(LOG_WARNING, msg, strerror(errno));            
         }
     }
     
-    return file;
+    return fd;
 }
 
 
 /**
- * Ping the AHRS.
- * @param AHRS400 serial port stream.
- * @return 0 if pong received, -1 if pong not received, if error or if EOF.
+ * Set the baud rate of the AHRS serial port, not of the AHRS.
+ * @param AHRS400 serial port file descriptor.
+ * @param baud rate, one of the AHRS rates.
+ * @return 0 if success, -1 if error.
  */
-int ahrs_ping(FILE *file) {
-    if (fputc(PING, file) == EOF) {
-        syslog(LOG_ERR, "Error writing ping to AHRS stream: %s",
-               strerror(errno));
+int ahrs_set_port_baud(int fd, unsigned baud) {
+    const size_t count = sizeof baud_rates / sizeof *baud_rates;
+    for (size_t i=0; i<count; i++) {
+        if (baud_rates[i].baud != baud)
+            continue;
+        if (set_speed(fd, baud_rates[i].speed)) {
+            syslog(LOG_ERR, "Error setting AHRS serial port baud rate: %s",
+                   strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+    syslog(LOG_ERR, "Invalid AHRS baud rate %u", baud);
+    return -1;
+}
+
+
+/**
+ * Write a command to the AHRS.
+ * @param AHRS400 serial port file descriptor.
+ * @param command name, for the error messages.
+ * @return 0 if success, -1 if error.
+ */
+static int write_command(int fd, char command, const char *name) {
+    ssize_t nwritten;
+    while ((nwritten = write(fd, &command, 1)) < 0 && errno == EINTR);
+    if (nwritten != 1) {
+        syslog(LOG_ERR, "Error writing %s to AHRS port: %s",
+               name, strerror(errno));
         return -1;
     }
+    return 0;
+}
 
-    int response = fgetc(file);
-    if (response == EOF) {
-        if (feof(file))
-            syslog(LOG_WARNING, "EOF while waiting for ping response");
-        else
-            syslog(LOG_ERR, "Read error while waiting for ping response: %s",
-                   strerror(errno));
+
+/**
+ * Read a command response from the AHRS.
+ * @param AHRS400 serial port file descriptor.
+ * @param command name, for the error messages.
+ * @return the response byte, -1 if error, EOF or timeout.
+ */
+static int read_response(int fd, const char *name) {
+    struct pollfd pollfd = {.fd=fd, .events=POLLIN};
+    int ready;
+    while ((ready = poll(&pollfd, 1, AHRS_RESPONSE_TIMEOUT_MS)) < 0
+           && errno == EINTR);
+    if (ready == 0) {
+        syslog(LOG_WARNING, "Timeout while waiting for %s response", name);
         return -1;
     }
-    
-    if (response != PING_RESPONSE) {
-        syslog(LOG_INFO, "Invalid ping from AHRS: %#x", response);
+
+    uint8_t response;
+    ssize_t nread;
+    while ((nread = read(fd, &response, 1)) < 0 && errno == EINTR);
+    if (nread == 0) {
+        syslog(LOG_WARNING, "EOF while waiting for %s response", name);
+        return -1;
+    } else if (nread < 0) {
+        syslog(LOG_ERR, "Read error while waiting for %s response: %s",
+               name, strerror(errno));
         return -1;
     }
+    return response;
+}
+
+
+/**
+ * Send a command and check its response.
+ * @return 0 if the response was received, -1 if not.
+ */
+static int command(int fd, char command, char expected, const char *name) {
+    if (write_command(fd, command, name))
+        return -1;
 
+    int response = read_response(fd, name);
+    if (response < 0)
+        return -1;
+    if (response != expected) {
+        syslog(LOG_INFO, "Invalid %s response from AHRS: %#x", name, response);
+        return -1;
+    }
     return 0;
 }
 
 
 /**
- * Put the AHRS in the continuous mode.
- * @param AHRS400 serial port stream.
- * @return 0 if success, -1 if error.
+ * Ping the AHRS.
+ * @param AHRS400 serial port file descriptor.
+ * @return 0 if pong received, -1 if pong not received in time, if error or
+ *   if EOF.
+ */
+int ahrs_ping(int fd) {
+    return command(fd, PING, PING_RESPONSE, "ping");
+}
+
+
+/**
+ * Change the baud rate of the AHRS and of the serial port.
+ * The AHRS acknowledges the change request at the current rate and the new
+ * rate at that rate.
+ * @return 0 if the AHRS answers at the new rate, -1 if not.
  */
-int ahrs_set_continuous(FILE *file) {
-    if (fputc(CONTINUOUS_MODE, file) == EOF) {
-        syslog(LOG_ERR, "Error writing continuous mode to AHRS stream: %s",
+static int change_baud(int fd, uint8_t code, speed_t speed) {
+    if (command(fd, REQUEST_BAUD, REQUEST_BAUD_RESPONSE, "baud request")
+        || write_command(fd, code, "baud code"))
+        return -1;
+
+    if (set_speed(fd, speed)) {
+        syslog(LOG_ERR, "Error setting AHRS serial port baud rate: %s",
                strerror(errno));
         return -1;
     }
-    return 0;    
+    return command(fd, NEW_BAUD, NEW_BAUD_RESPONSE, "new baud");
+}
+
+
+/**
+ * Negotiate the fastest baud rate of the AHRS up to a maximum.
+ * Must be called in the polled mode, at the default rate of 38400 baud.
+ * Each rate is verified with a ping; if none above the default works, the
+ * AHRS and the serial port are put back to the default rate.
+ * @param AHRS400 serial port file descriptor.
+ * @param fastest baud rate to try.
+ * @return the baud rate in use, 0 if the AHRS does not answer at all.
+ */
+unsigned ahrs_negotiate_baud(int fd, unsigned max_baud) {
+    const size_t count = sizeof baud_rates / sizeof *baud_rates;
+    for (size_t i=0; i<count && baud_rates[i].speed != AHRS_DEFAULT_BAUDRATE;
+         i++) {
+        if (baud_rates[i].baud > max_baud)
+            continue;
+
+        if (!change_baud(fd, baud_rates[i].code, baud_rates[i].speed)
+            && !ahrs_ping(fd)) {
+            syslog(LOG_INFO, "AHRS baud rate set to %u", baud_rates[i].baud);
+            return baud_rates[i].baud;
+        }
+        syslog(LOG_WARNING, "AHRS baud rate %u failed", baud_rates[i].baud);
+
+        // Fall back to the default rate, where the AHRS stays if it did not
+        // get the new rate, or command it back from the new rate
+        if (set_speed(fd, AHRS_DEFAULT_BAUDRATE))
+            return 0;
+        ahrs_purge(fd);
+        if (ahrs_ping(fd)) {
+            if (set_speed(fd, baud_rates[i].speed))
+                return 0;
+            ahrs_purge(fd);
+            if (change_baud(fd, AHRS_DEFAULT_BAUD_CODE, AHRS_DEFAULT_BAUDRATE)
+                || ahrs_ping(fd)) {
+                syslog(LOG_ERR, "AHRS lost after baud rate change");
+                return 0;
+            }
+        }
+    }
+    return AHRS_DEFAULT_BAUD;
+}
+
+
+/**
+ * Put the AHRS in the continuous mode.
+ * @param AHRS400 serial port file descriptor.
+ * @return 0 if success, -1 if error.
+ */
+int ahrs_set_continuous(int fd) {
+    return write_command(fd, CONTINUOUS_MODE, "continuous mode");
 }
 
 
 /**
  * Put the AHRS in the polled mode.
- * @param AHRS400 serial port stream.
+ * @param AHRS400 serial port file descriptor.
  * @return 0 if success, -1 if error.
  */
-int ahrs_set_polled(FILE *file) {
-    if (fputc(POLLED_MODE, file) == EOF) {
-        syslog(LOG_ERR, "Error writing polled mode to AHRS stream: %s",
-               strerror(errno));
-        return -1;
-    }
-    return 0;
+int ahrs_set_polled(int fd) {
+    return write_command(fd, POLLED_MODE, "polled mode");
 }
 
 
 /**
- * Flush the AHRS input/output stream.
- * @param AHRS400 serial port stream.
+ * Flush the AHRS serial port input and output.
+ * @param AHRS400 serial port file descriptor.
  * @return 0 if success, -1 if error.
  */
-int ahrs_purge(FILE *file) {
-    int fd = fileno(file);
-    if (fd < 0) {
-        syslog(LOG_ERR, "Error getting file descriptor: %s", strerror(errno));
-        return -1;
-    }
-    
+int ahrs_purge(int fd) {
     if (tcflush(fd, TCIOFLUSH)) {
         syslog(LOG_WARNING, "Error flushing stream: %s", strerror(errno));
         return -1;
@@ -188,14 +340,52 @@ int ahrs_purge(FILE *file) {
 }
 
 
+/**
+ * Flush the AHRS serial port input until no data arrives for AHRS_QUIET_MS.
+ * Used after the polled mode command, in place of waiting for the longest
+ * time the AHRS may take to finish its last packet. The pending output is
+ * sent first, not flushed with the command.
+ * @param AHRS400 serial port file descriptor.
+ * @return 0 if the line is quiet, -1 if error or if data keeps arriving.
+ */
+int ahrs_purge_quiet(int fd) {
+    if (tcdrain(fd)) {
+        syslog(LOG_WARNING, "Error draining AHRS port: %s", strerror(errno));
+        return -1;
+    }
+
+    uint64_t start = get_time_us();
+    do {
+        if (tcflush(fd, TCIFLUSH)) {
+            syslog(LOG_WARNING, "Error flushing stream: %s", strerror(errno));
+            return -1;
+        }
+
+        struct pollfd pollfd = {.fd=fd, .events=POLLIN};
+        int ready;
+        while ((ready = poll(&pollfd, 1, AHRS_QUIET_MS)) < 0
+               && errno == EINTR);
+        if (ready < 0) {
+            syslog(LOG_ERR, "Error polling AHRS port: %s", strerror(errno));
+            return -1;
+        } else if (ready == 0) {
+            return 0;
+        }
+    } while (get_time_us() - start < AHRS_QUIET_TIMEOUT_MS * 1000ull);
+
+    syslog(LOG_WARNING, "AHRS line not quiet after %d ms",
+           AHRS_QUIET_TIMEOUT_MS);
+    return -1;
+}
+
 
 /**
  * Set the AHRS measurement mode.
- * @param AHRS400 serial port stream.
+ * @param AHRS400 serial port file descriptor.
  * @param desired mode.
  * @return 0 if success received, -1 if error or EOF.
  */
-int ahrs_set_mode(FILE *file, ahrs_mode_t mode) {
+int ahrs_set_mode(int fd, ahrs_mode_t mode) {
     char mode_command, mode_response;
     
     switch (mode) {
@@ -216,21 +406,12 @@ int ahrs_set_mode(FILE *file, ahrs_mode_t mode) {
         return -1;
     }
     
-    if (fputc(mode_command, file) == EOF) {
-        syslog(LOG_ERR, "Error writing mode command to AHRS stream: %s",
-               strerror(errno));
+    if (write_command(fd, mode_command, "mode command"))
         return -1;
-    }
     
-    int response = fgetc(file);
-    if (response == EOF) {
-        if (feof(file))
-            syslog(LOG_WARNING, "EOF while waiting for mode response");
-        else
-            syslog(LOG_ERR, "Read error while waiting for mode response: %s",
-                   strerror(errno));
+    int response = read_response(fd, "mode");
+    if (response < 0)
         return -1;
-    }
     
     if (response != mode_response) {
         syslog(LOG_INFO, "Invalid mode response from AHRS: %#x", response);
@@ -242,188 +423,51 @@ int ahrs_set_mode(FILE *file, ahrs_mode_t mode) {
 
 
 /**
- * Search for an AHRS header in the stream.
- * @param AHRS400 serial port stream.
- * @return 0 if header found, -1 if error or EOF.
- */
-static int search_header(FILE *file) {
-    for (;;) {
-        //Get the next character from the stream
-        int recv = fgetc(file);
-        
-        if (recv == AHRS_DATA_HEADER)
-            return 0;
-        
-        if (recv == EOF) {
-            if (feof(file))
-                syslog(LOG_WARNING, "EOF while waiting for header");
-            else
-                syslog(LOG_ERR, "Read error while waiting for header: %s",
-                       strerror(errno));
-            return -1;
-        }
-    }
-}
-
-
-/**
- * Calculate message checksum.
- * @param message payload.
- * @param message payload length (without header or checksum).
- * @return message checksum.
- */
-static uint8_t checksum(uint8_t *payload, unsigned size) {
-    uint8_t checksum = 0;
-    for (int i=0; i<size; i++)
-        checksum += payload[i];
-    return checksum;
-}
-
-
-/**
- * Get a message from the AHRS.
- * @param AHRS400 serial port stream.
- * @param packet payload size (without header or checksum).
- * @param[out] pointer to where the payload should be stored.
- * @param[out] reception time in microseconds since epoch.
- * @return 0 if message read and payload stored, -1 if error or EOF.
+ * Get a packet from the AHRS.
+ * @param AHRS400 serial port file descriptor.
+ * @param framer of the packets of the port.
+ * @param[out] reception time in microseconds since epoch, of the read
+ *   which completed the packet.
+ * @return the packet payload, NULL if error, EOF or stall.
  */
-static int get_msg(FILE *file, unsigned size, uint8_t *payload,
-                   uint64_t *recv_timestamp) {
-    uint8_t work[size + 1];
-    uint8_t work_ptr = 0;
-    bool header_found = false;
-    
+static const uint8_t* get_msg(int fd, ahrs_framer_t *framer,
+                              uint64_t *recv_timestamp) {
     for (;;) {
-        // Look for header
-        if (!header_found) {
-            if (search_header(file))
-                return -1;
+        const uint8_t *payload = ahrs_framer_next(framer);
+        if (payload) {
+            if (recv_timestamp)
+                *recv_timestamp = framer->read_time_us;
+            return payload;
         }
 
-        // Save the time the header was found
-        if (recv_timestamp)
-            *recv_timestamp = get_time_us();
-        
-        // Get message body and checksum
-        if (!fread(work + work_ptr, sizeof(work) - work_ptr, 1, file)) {
-            if (feof(file))
-                syslog(LOG_WARNING, "EOF while waiting for payload");
-            else
-                syslog(LOG_ERR, "Read error while waiting for payload: %s",
-                       strerror(errno));
-            return -1;
-        }
-        
-        // Check checksum
-        uint8_t recv_checksum = work[size];
-        if (checksum(work, size) == recv_checksum) {
-            // Valid message received, save output and return
-            memcpy(payload, work, size);
-            return 0;
-        }
-        
-        // Invalid message, look for header in work buffer
-        work_ptr = 0;
-        header_found = false;
-        for (int i=0; i<sizeof work; i++) {
-            if (work[i] == AHRS_DATA_HEADER) {
-                memmove(work, work + i + 1, sizeof(work) - i - 1);
-                work_ptr = sizeof(work) - i - 1;
-                header_found = true;
-                break;
-            }
+        ssize_t nread = ahrs_framer_fill(framer, fd);
+        if (nread == 0) {
+            syslog(LOG_WARNING, "No AHRS data for %d ms or EOF",
+                   AHRS_STALL_TIMEOUT_DS * 100);
+            return NULL;
+        } else if (nread < 0) {
+            syslog(LOG_ERR, "Read error while waiting for packet: %s",
+                   strerror(errno));
+            return NULL;
         }
     }
 }
 
 
-static inline int16_t pack_int16(uint8_t *payload, unsigned index) {
-    unsigned msb = index*2;
-    unsigned lsb = index*2 + 1;
-    return payload[lsb] + ((int16_t)payload[msb]<<8);
-}
-
-
-static inline uint16_t pack_uint16(uint8_t *payload, unsigned index) {
-    return (uint16_t) pack_int16(payload, index);
-}
-
-
 /**
  * Get an angle mode message from the AHRS.
- * @param AHRS400 serial port stream.
+ * @param AHRS400 serial port file descriptor.
+ * @param framer of the port, initialized for AHRS_ANGLE_PAYLOAD_LEN.
  * @param Angle raw message payload.
- * @return 0 if message read and payload stored, -1 if error or EOF.
+ * @return 0 if message read and payload stored, -1 if error, EOF or stall.
  */
-int ahrs_get_angle_raw(FILE *file, mavlink_ahrs400_angle_raw_t *angle_raw) {
-    uint8_t payload[AHRS_ANGLE_PAYLOAD_LEN];
-    if (get_msg(file, sizeof payload, payload, &angle_raw->time_usec))
+int ahrs_get_angle_raw(int fd, ahrs_framer_t *framer,
+                       mavlink_ahrs400_angle_raw_t *angle_raw) {
+    uint64_t time_usec;
+    const uint8_t *payload = get_msg(fd, framer, &time_usec);
+    if (!payload)
         return -1;
     
-    angle_raw->roll = pack_int16(payload, 0);
-    angle_raw->pitch = pack_int16(payload, 1);
-    angle_raw->yaw = pack_int16(payload, 2);
-    angle_raw->xgyro = pack_int16(payload, 3);
-    angle_raw->ygyro = pack_int16(payload, 4);
-    angle_raw->zgyro = pack_int16(payload, 5);
-    angle_raw->xacc = pack_int16(payload, 6);
-    angle_raw->yacc = pack_int16(payload, 7);
-    angle_raw->zacc = pack_int16(payload, 8);
-    angle_raw->xmag = pack_int16(payload, 9);
-    angle_raw->ymag = pack_int16(payload, 10);
-    angle_raw->zmag = pack_int16(payload, 11);
-    angle_raw->temperature = pack_uint16(payload, 12);
-    angle_raw->sensor_time = pack_uint16(payload, 13);
+    ahrs_unpack_angle_raw(payload, &time_usec, 1, angle_raw);
     return 0;
 }
-
-
-static inline float raw_to_angle(int16_t raw){
-    return raw * M_PI / 32768.0;
-}
-
-
-static inline float raw_to_gyro(int16_t raw){
-    return raw * 1.5 * AHRS_GYRO_RANGE / 32768.0;
-}
-
-
-static inline float raw_to_accel(int16_t raw){
-    return raw * 1.5 * AHRS_G_RANGE * 9.8 / 32768.0;
-}
-
-
-static inline float raw_to_mag(int16_t raw){
-    return raw * 1.5 * 1.25e-4 / 32768.0;
-}
-
-
-static inline float raw_to_temperature(uint16_t raw){
-    return ((raw * 5 / 4096.0) - 1.375) * 44.44;
-}
-
-
-static inline float raw_to_time(int16_t raw){
-    return -raw * 0.00000079;
-}
-
-
-void ahrs_angle_conv(mavlink_ahrs400_angle_raw_t *raw,
-                     mavlink_ahrs400_angle_t *scaled) {
-    scaled->time_usec = raw->time_usec;
-    scaled->xacc = raw_to_accel(raw->xacc);
-    scaled->yacc = raw_to_accel(raw->yacc);
-    scaled->zacc = raw_to_accel(raw->zacc);
-    scaled->xgyro = raw_to_gyro(raw->xgyro);
-    scaled->ygyro = raw_to_gyro(raw->ygyro);
-    scaled->zgyro = raw_to_gyro(raw->zgyro);
-    scaled->xmag = raw_to_mag(raw->xmag);
-    scaled->ymag = raw_to_mag(raw->ymag);
-    scaled->zmag = raw_to_mag(raw->zmag);
-    scaled->roll = raw_to_angle(raw->roll);
-    scaled->pitch = raw_to_angle(raw->pitch);
-    scaled->yaw = raw_to_angle(raw->yaw);
-    scaled->temperature = raw_to_temperature(raw->temperature);
-    scaled->sensor_time = raw->sensor_time;
-}
@@ -5,25 +5,30 @@
 #ifndef AHRS400_H
 #define AHRS400_H
 
-#include <stdio.h>
-
+#include "convert.h"
+#include "framer.h"
 #include "generated/ahrs400_messages/mavlink.h"
 
+/** Baud rate of the AHRS after power up. */
+#define AHRS_DEFAULT_BAUD 38400
+
 typedef enum {
     AHRS_VOLTAGE_MODE,
     AHRS_SCALED_MODE,
     AHRS_ANGLE_MODE
 } ahrs_mode_t;
 
-FILE* ahrs_open(char *path);
-int ahrs_ping(FILE *file);
-int ahrs_set_continuous(FILE *file);
-int ahrs_set_polled(FILE *file);
-int ahrs_purge(FILE *file);
-int ahrs_set_mode(FILE *file, ahrs_mode_t mode);
-int ahrs_get_angle_raw(FILE *file, mavlink_ahrs400_angle_raw_t *angle_raw);
-void ahrs_angle_conv(mavlink_ahrs400_angle_raw_t *raw,
-                     mavlink_ahrs400_angle_t *scaled);
+int ahrs_open(char *path);
+int ahrs_set_port_baud(int fd, unsigned baud);
+int ahrs_ping(int fd);
+unsigned ahrs_negotiate_baud(int fd, unsigned max_baud);
+int ahrs_set_continuous(int fd);
+int ahrs_set_polled(int fd);
+int ahrs_purge(int fd);
+int ahrs_purge_quiet(int fd);
+int ahrs_set_mode(int fd, ahrs_mode_t mode);
+int ahrs_get_angle_raw(int fd, ahrs_framer_t *framer,
+                       mavlink_ahrs400_angle_raw_t *angle_raw);
 
 
 #endif//AHRS400_H
@@ -0,0 +1,279 @@
+/**
+ * Conversion of the AHRS400 angle mode packets to SI units.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "convert.h"
+
+
+/*** AHRS constants ***/
+#define AHRS_GYRO_RANGE (200 * M_PI / 180)
+#define AHRS_G_RANGE 4
+
+/** Scale factors of the raw values, folded by the compiler. */
+#define ANGLE_SCALE ((float) (M_PI / 32768.0))
+#define GYRO_SCALE ((float) (1.5 * AHRS_GYRO_RANGE / 32768.0))
+#define ACCEL_SCALE ((float) (1.5 * AHRS_G_RANGE * 9.8 / 32768.0))
+#define MAG_SCALE ((float) (1.5 * 1.25e-4 / 32768.0))
+#define TEMPERATURE_SCALE ((float) (5 / 4096.0 * 44.44))
+#define TEMPERATURE_OFFSET ((float) (-1.375 * 44.44))
+
+/** Number of packets converted together by the batch functions. */
+#define BLOCK 64
+
+
+/** Big-endian 16-bit words of the payload, in order. */
+enum {
+    ROLL, PITCH, YAW, XGYRO, YGYRO, ZGYRO, XACC, YACC, ZACC, XMAG, YMAG, ZMAG,
+    TEMPERATURE, SENSOR_TIME, WORDS
+};
+
+/** Number of words scaled to floats, which come first. */
+#define SCALED_WORDS (TEMPERATURE + 1)
+
+/** Scale factors of the signed words. */
+static const float word_scale[TEMPERATURE] = {
+    ANGLE_SCALE, ANGLE_SCALE, ANGLE_SCALE,
+    GYRO_SCALE, GYRO_SCALE, GYRO_SCALE,
+    ACCEL_SCALE, ACCEL_SCALE, ACCEL_SCALE,
+    MAG_SCALE, MAG_SCALE, MAG_SCALE
+};
+
+/** Block of packets, transposed to a column per word. */
+typedef struct block {
+    size_t count;
+    uint64_t time_usec[BLOCK];
+    int16_t words[WORDS][BLOCK];
+} block_t;
+
+
+static inline int16_t pack_int16(const uint8_t *payload, unsigned index) {
+    return (int16_t) (payload[index*2] << 8 | payload[index*2 + 1]);
+}
+
+
+/**
+ * Unpack angle mode payloads.
+ * @param payloads of the packets, contiguous.
+ * @param reception time of each packet, in microseconds since epoch.
+ * @param number of packets.
+ * @param[out] raw messages of the packets.
+ */
+void ahrs_unpack_angle_raw(const uint8_t *payloads, const uint64_t *time_usec,
+                           size_t count, mavlink_ahrs400_angle_raw_t *raw) {
+    for (size_t i=0; i<count; i++, payloads+=AHRS_ANGLE_PAYLOAD_LEN) {
+        raw[i].time_usec = time_usec[i];
+        raw[i].roll = pack_int16(payloads, ROLL);
+        raw[i].pitch = pack_int16(payloads, PITCH);
+        raw[i].yaw = pack_int16(payloads, YAW);
+        raw[i].xgyro = pack_int16(payloads, XGYRO);
+        raw[i].ygyro = pack_int16(payloads, YGYRO);
+        raw[i].zgyro = pack_int16(payloads, ZGYRO);
+        raw[i].xacc = pack_int16(payloads, XACC);
+        raw[i].yacc = pack_int16(payloads, YACC);
+        raw[i].zacc = pack_int16(payloads, ZACC);
+        raw[i].xmag = pack_int16(payloads, XMAG);
+        raw[i].ymag = pack_int16(payloads, YMAG);
+        raw[i].zmag = pack_int16(payloads, ZMAG);
+        raw[i].temperature = (uint16_t) pack_int16(payloads, TEMPERATURE);
+        raw[i].sensor_time = (uint16_t) pack_int16(payloads, SENSOR_TIME);
+    }
+}
+
+
+/**
+ * Scale the words of a packet, in payload order, into a message.
+ */
+static inline void scale_words(const int16_t *words, uint64_t time_usec,
+                               mavlink_ahrs400_angle_t *scaled) {
+    scaled->time_usec = time_usec;
+    scaled->xacc = words[XACC] * ACCEL_SCALE;
+    scaled->yacc = words[YACC] * ACCEL_SCALE;
+    scaled->zacc = words[ZACC] * ACCEL_SCALE;
+    scaled->xgyro = words[XGYRO] * GYRO_SCALE;
+    scaled->ygyro = words[YGYRO] * GYRO_SCALE;
+    scaled->zgyro = words[ZGYRO] * GYRO_SCALE;
+    scaled->xmag = words[XMAG] * MAG_SCALE;
+    scaled->ymag = words[YMAG] * MAG_SCALE;
+    scaled->zmag = words[ZMAG] * MAG_SCALE;
+    scaled->roll = words[ROLL] * ANGLE_SCALE;
+    scaled->pitch = words[PITCH] * ANGLE_SCALE;
+    scaled->yaw = words[YAW] * ANGLE_SCALE;
+    scaled->temperature = (uint16_t) words[TEMPERATURE] * TEMPERATURE_SCALE
+        + TEMPERATURE_OFFSET;
+    scaled->sensor_time = (uint16_t) words[SENSOR_TIME];
+}
+
+
+/**
+ * Convert an angle mode message to SI units.
+ */
+static inline void convert(const mavlink_ahrs400_angle_raw_t *raw,
+                           mavlink_ahrs400_angle_t *scaled) {
+    scaled->time_usec = raw->time_usec;
+    scaled->xacc = raw->xacc * ACCEL_SCALE;
+    scaled->yacc = raw->yacc * ACCEL_SCALE;
+    scaled->zacc = raw->zacc * ACCEL_SCALE;
+    scaled->xgyro = raw->xgyro * GYRO_SCALE;
+    scaled->ygyro = raw->ygyro * GYRO_SCALE;
+    scaled->zgyro = raw->zgyro * GYRO_SCALE;
+    scaled->xmag = raw->xmag * MAG_SCALE;
+    scaled->ymag = raw->ymag * MAG_SCALE;
+    scaled->zmag = raw->zmag * MAG_SCALE;
+    scaled->roll = raw->roll * ANGLE_SCALE;
+    scaled->pitch = raw->pitch * ANGLE_SCALE;
+    scaled->yaw = raw->yaw * ANGLE_SCALE;
+    scaled->temperature =
+        raw->temperature * TEMPERATURE_SCALE + TEMPERATURE_OFFSET;
+    scaled->sensor_time = raw->sensor_time;
+}
+
+
+/**
+ * Convert an angle mode message to SI units.
+ */
+void ahrs_angle_conv(mavlink_ahrs400_angle_raw_t *raw,
+                     mavlink_ahrs400_angle_t *scaled) {
+    convert(raw, scaled);
+}
+
+
+/**
+ * Transpose the next payloads into a block.
+ */
+static void load_payloads(block_t *block, const uint8_t *payloads,
+                          const uint64_t *time_usec, size_t count) {
+    block->count = count;
+    memcpy(block->time_usec, time_usec, count * sizeof *time_usec);
+    for (size_t i=0; i<count; i++, payloads+=AHRS_ANGLE_PAYLOAD_LEN) {
+        for (unsigned w=0; w<WORDS; w++)
+            block->words[w][i] = pack_int16(payloads, w);
+    }
+}
+
+
+/**
+ * Transpose the next raw messages into a block.
+ */
+static void load_raw(block_t *block, const mavlink_ahrs400_angle_raw_t *raw,
+                     size_t count) {
+    block->count = count;
+    for (size_t i=0; i<count; i++) {
+        block->time_usec[i] = raw[i].time_usec;
+        block->words[ROLL][i] = raw[i].roll;
+        block->words[PITCH][i] = raw[i].pitch;
+        block->words[YAW][i] = raw[i].yaw;
+        block->words[XGYRO][i] = raw[i].xgyro;
+        block->words[YGYRO][i] = raw[i].ygyro;
+        block->words[ZGYRO][i] = raw[i].zgyro;
+        block->words[XACC][i] = raw[i].xacc;
+        block->words[YACC][i] = raw[i].yacc;
+        block->words[ZACC][i] = raw[i].zacc;
+        block->words[XMAG][i] = raw[i].xmag;
+        block->words[YMAG][i] = raw[i].ymag;
+        block->words[ZMAG][i] = raw[i].zmag;
+        block->words[TEMPERATURE][i] = (int16_t) raw[i].temperature;
+        block->words[SENSOR_TIME][i] = (int16_t) raw[i].sensor_time;
+    }
+}
+
+
+/**
+ * Scale the words of a block to SI units, a column at a time.
+ * @param[out] destination of each scaled column, in word order.
+ */
+static void scale(const block_t *block, float *const dest[SCALED_WORDS]) {
+    const size_t count = block->count;
+    for (unsigned w=0; w<TEMPERATURE; w++) {
+        const int16_t *restrict words = block->words[w];
+        float *restrict values = dest[w];
+        const float k = word_scale[w];
+        for (size_t i=0; i<count; i++)
+            values[i] = words[i] * k;
+    }
+
+    const uint16_t *restrict temperature =
+        (const uint16_t *) block->words[TEMPERATURE];
+    float *restrict values = dest[TEMPERATURE];
+    for (size_t i=0; i<count; i++)
+        values[i] = temperature[i] * TEMPERATURE_SCALE + TEMPERATURE_OFFSET;
+}
+
+
+/**
+ * Scale a block directly into columns, from the given row on.
+ */
+static void store_columns(const block_t *block, ahrs_angle_columns_t *columns,
+                          size_t row) {
+    float *const dest[SCALED_WORDS] = {
+        columns->roll + row, columns->pitch + row, columns->yaw + row,
+        columns->xgyro + row, columns->ygyro + row, columns->zgyro + row,
+        columns->xacc + row, columns->yacc + row, columns->zacc + row,
+        columns->xmag + row, columns->ymag + row, columns->zmag + row,
+        columns->temperature + row
+    };
+    scale(block, dest);
+
+    memcpy(columns->time_usec + row, block->time_usec,
+           block->count * sizeof *block->time_usec);
+    memcpy(columns->sensor_time + row, block->words[SENSOR_TIME],
+           block->count * sizeof *columns->sensor_time);
+}
+
+
+/**
+ * Convert angle mode messages to SI units.
+ */
+void ahrs_angle_conv_batch(const mavlink_ahrs400_angle_raw_t *raw,
+                           size_t count, mavlink_ahrs400_angle_t *scaled) {
+    for (size_t i=0; i<count; i++)
+        convert(raw + i, scaled + i);
+}
+
+
+/**
+ * Convert angle mode messages to SI units, as columns.
+ * @param[out] columns with room for `count` values each.
+ */
+void ahrs_angle_conv_columns(const mavlink_ahrs400_angle_raw_t *raw,
+                             size_t count, ahrs_angle_columns_t *columns) {
+    block_t block;
+    for (size_t i=0; i<count; i+=BLOCK) {
+        load_raw(&block, raw + i, count - i < BLOCK ? count - i : BLOCK);
+        store_columns(&block, columns, i);
+    }
+}
+
+
+/**
+ * Unpack angle mode payloads and convert them to SI units.
+ * @param payloads of the packets, contiguous.
+ * @param reception time of each packet, in microseconds since epoch.
+ */
+void ahrs_payloads_to_angle(const uint8_t *payloads, const uint64_t *time_usec,
+                            size_t count, mavlink_ahrs400_angle_t *scaled) {
+    for (size_t i=0; i<count; i++, payloads+=AHRS_ANGLE_PAYLOAD_LEN) {
+        int16_t words[WORDS];
+        for (unsigned w=0; w<WORDS; w++)
+            words[w] = pack_int16(payloads, w);
+        scale_words(words, time_usec[i], scaled + i);
+    }
+}
+
+
+/**
+ * Unpack angle mode payloads and convert them to SI units, as columns.
+ * @param[out] columns with room for `count` values each.
+ */
+void ahrs_payloads_to_columns(const uint8_t *payloads,
+                              const uint64_t *time_usec, size_t count,
+                              ahrs_angle_columns_t *columns) {
+    block_t block;
+    for (size_t i=0; i<count; i+=BLOCK) {
+        load_payloads(&block, payloads + i*AHRS_ANGLE_PAYLOAD_LEN,
+                      time_usec + i, count - i < BLOCK ? count - i : BLOCK);
+        store_columns(&block, columns, i);
+    }
+}
@@ -0,0 +1,57 @@
+/**
+ * Conversion of the AHRS400 angle mode packets to SI units.
+ *
+ * The scale factors are single-precision constants folded by the compiler.
+ * The batch functions convert many packets in one pass, to messages or to
+ * one array per field; the latter transpose blocks of packets and scale
+ * each field with a constant factor, in loops the compiler vectorizes.
+ * They are meant for the reprocessing of long raw logs.
+ */
+
+#ifndef AHRS400_CONVERT_H
+#define AHRS400_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "generated/ahrs400_messages/mavlink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Length of the angle mode packet payloads. */
+#define AHRS_ANGLE_PAYLOAD_LEN 28
+
+/** Scaled angle mode data as one array per field, structure of arrays. */
+typedef struct ahrs_angle_columns {
+    uint64_t *time_usec;
+    float *xacc, *yacc, *zacc;
+    float *xgyro, *ygyro, *zgyro;
+    float *xmag, *ymag, *zmag;
+    float *roll, *pitch, *yaw;
+    float *temperature;
+    uint16_t *sensor_time;
+} ahrs_angle_columns_t;
+
+void ahrs_unpack_angle_raw(const uint8_t *payloads, const uint64_t *time_usec,
+                           size_t count, mavlink_ahrs400_angle_raw_t *raw);
+void ahrs_angle_conv(mavlink_ahrs400_angle_raw_t *raw,
+                     mavlink_ahrs400_angle_t *scaled);
+void ahrs_angle_conv_batch(const mavlink_ahrs400_angle_raw_t *raw,
+                           size_t count, mavlink_ahrs400_angle_t *scaled);
+void ahrs_angle_conv_columns(const mavlink_ahrs400_angle_raw_t *raw,
+                             size_t count, ahrs_angle_columns_t *columns);
+void ahrs_payloads_to_angle(const uint8_t *payloads, const uint64_t *time_usec,
+                            size_t count, mavlink_ahrs400_angle_t *scaled);
+void ahrs_payloads_to_columns(const uint8_t *payloads,
+                              const uint64_t *time_usec, size_t count,
+                              ahrs_angle_columns_t *columns);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//AHRS400_CONVERT_H
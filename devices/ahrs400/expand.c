@@ -0,0 +1,98 @@
+/**
+ * Expansion of AHRS400 raw MAVLink streams into scaled angle mode data.
+ */
+
+#include <string.h>
+
+#include "expand.h"
+
+
+/**
+ * Initialize an expander.
+ * @param chan MAVLink channel of the parser, not used by other parsers.
+ */
+void ahrs_expander_init(ahrs_expander_t *expander, uint8_t chan) {
+    memset(expander, 0, sizeof *expander);
+    expander->chan = chan;
+}
+
+
+/**
+ * Parse stream bytes until they end or a batch of raw messages is full.
+ * @return The number of bytes parsed.
+ */
+size_t ahrs_expander_feed(ahrs_expander_t *expander, const uint8_t *data,
+                          size_t len) {
+    size_t i = 0;
+    while (i < len && expander->count < AHRS_EXPAND_BATCH) {
+        mavlink_status_t status;
+        if (!mavlink_parse_char(expander->chan, data[i++], &expander->msg,
+                                &status))
+            continue;
+
+        switch (expander->msg.msgid) {
+        case MAVLINK_MSG_ID_AHRS400_ANGLE_RAW:
+            mavlink_msg_ahrs400_angle_raw_decode(
+                &expander->msg, expander->raw + expander->count++
+            );
+            expander->sysid = expander->msg.sysid;
+            expander->compid = expander->msg.compid;
+            expander->raw_messages++;
+            break;
+
+        case MAVLINK_MSG_ID_AHRS400_ANGLE:
+            // Regenerated from the raw message of the same frame
+            expander->scaled_messages++;
+            break;
+
+        default:
+            expander->other_messages++;
+        }
+    }
+
+    expander->bytes += i;
+    return i;
+}
+
+
+/**
+ * Convert the raw messages parsed since the last call.
+ * @return The number of scaled messages, in expander->angle.
+ */
+size_t ahrs_expander_convert(ahrs_expander_t *expander) {
+    size_t count = expander->count;
+    ahrs_angle_conv_batch(expander->raw, count, expander->angle);
+    expander->count = 0;
+    return count;
+}
+
+
+/**
+ * Print the header of the text logs.
+ * @return The number of characters printed, negative if error.
+ */
+int ahrs_print_text_header(FILE *file) {
+    return fprintf(
+        file, "%% time[us]\txacc[m/s^2]\tyacc\tzacc\t"
+        "xgyro[rad/s]\tygyro\tzgyro\txmag[gauss]\tymag\tzmag\t"
+        "xmag[gauss]\tymag\tzmag\troll[rad]\tpitch\tyaw\t"
+        "temperature[C]\tsensor_time\n"
+    );
+}
+
+
+/**
+ * Print a scaled message as a line of the text logs.
+ * @return The number of characters printed, negative if error.
+ */
+int ahrs_print_text(FILE *file, const mavlink_ahrs400_angle_t *angle) {
+    return fprintf(
+        file, "%llu\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t%e\t"
+        "%e\t%e\t%e\t%e\t%u\n", (unsigned long long) angle->time_usec,
+        angle->xacc, angle->yacc, angle->zacc,
+        angle->xgyro, angle->ygyro, angle->zgyro,
+        angle->xmag, angle->ymag, angle->zmag,
+        angle->roll, angle->pitch, angle->yaw,
+        angle->temperature, angle->sensor_time
+    );
+}
@@ -0,0 +1,54 @@
+/**
+ * Expansion of AHRS400 raw MAVLink streams into scaled angle mode data.
+ *
+ * The scaled AHRS400_ANGLE messages are fully derivable from the raw ones,
+ * so ahrs400-read can log and send only AHRS400_ANGLE_RAW. The expander
+ * parses such streams, or logs also holding the scaled messages, and
+ * converts the raw messages in batches when the scaled values are needed.
+ */
+
+#ifndef AHRS400_EXPAND_H
+#define AHRS400_EXPAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "convert.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Number of raw messages converted together. */
+#define AHRS_EXPAND_BATCH 256
+
+/** Expander of a raw MAVLink stream. */
+typedef struct ahrs_expander {
+    uint8_t chan;             /**< MAVLink channel of the parser. */
+    mavlink_message_t msg;    /**< Last message parsed. */
+    size_t count;             /**< Raw messages waiting for conversion. */
+    mavlink_ahrs400_angle_raw_t raw[AHRS_EXPAND_BATCH];
+    mavlink_ahrs400_angle_t angle[AHRS_EXPAND_BATCH];
+    uint8_t sysid;            /**< System of the last raw message. */
+    uint8_t compid;           /**< Component of the last raw message. */
+    unsigned long long bytes; /**< Bytes parsed. */
+    unsigned long raw_messages; /**< Raw messages parsed. */
+    unsigned long scaled_messages; /**< Scaled messages skipped. */
+    unsigned long other_messages; /**< Other messages skipped. */
+} ahrs_expander_t;
+
+void ahrs_expander_init(ahrs_expander_t *expander, uint8_t chan);
+size_t ahrs_expander_feed(ahrs_expander_t *expander, const uint8_t *data,
+                          size_t len);
+size_t ahrs_expander_convert(ahrs_expander_t *expander);
+int ahrs_print_text_header(FILE *file);
+int ahrs_print_text(FILE *file, const mavlink_ahrs400_angle_t *angle);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//AHRS400_EXPAND_H
@@ -0,0 +1,134 @@
+/**
+ * Incremental framer of the AHRS400 data packets.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "framer.h"
+#include "common/utils.h"
+
+
+/** Mask of the ring buffer indices. */
+#define RING_MASK (AHRS_FRAMER_RING_SIZE - 1)
+
+
+/**
+ * Initialize a framer.
+ * @param payload_len Payload length of the packets, without the header
+ *   and checksum.
+ */
+void ahrs_framer_init(ahrs_framer_t *framer, unsigned payload_len) {
+    memset(framer, 0, sizeof *framer);
+    framer->payload_len = payload_len;
+}
+
+
+/**
+ * Discard the received bytes, like after purging the serial port.
+ */
+void ahrs_framer_reset(ahrs_framer_t *framer) {
+    framer->tail = framer->head;
+}
+
+
+/**
+ * Get the free space of the ring after the received bytes.
+ * @param[out] len Length of the space, contiguous.
+ * @return The start of the space.
+ */
+uint8_t* ahrs_framer_space(ahrs_framer_t *framer, size_t *len) {
+    size_t start = framer->head & RING_MASK;
+    size_t free = AHRS_FRAMER_RING_SIZE - (framer->head - framer->tail);
+    size_t contiguous = AHRS_FRAMER_RING_SIZE - start;
+    *len = free < contiguous ? free : contiguous;
+    return framer->ring + start;
+}
+
+
+/**
+ * Add bytes written to the space given by ahrs_framer_space().
+ */
+void ahrs_framer_commit(ahrs_framer_t *framer, size_t len) {
+    // Mirror the first bytes of the ring after its end
+    size_t start = framer->head & RING_MASK;
+    if (start < AHRS_FRAMER_MAX_PACKET) {
+        size_t mirrored = AHRS_FRAMER_MAX_PACKET - start;
+        memcpy(framer->ring + AHRS_FRAMER_RING_SIZE + start,
+               framer->ring + start, len < mirrored ? len : mirrored);
+    }
+    framer->head += len;
+}
+
+
+/**
+ * Read the available bytes of a file into the ring, blocking until some are.
+ * @return The number of bytes read, 0 if EOF, -1 if error.
+ */
+ssize_t ahrs_framer_fill(ahrs_framer_t *framer, int fd) {
+    size_t len;
+    uint8_t *space = ahrs_framer_space(framer, &len);
+    ssize_t nread;
+    while ((nread = read(fd, space, len)) < 0 && errno == EINTR);
+    if (nread > 0) {
+        ahrs_framer_commit(framer, nread);
+        framer->read_time_us = get_time_us();
+    }
+    return nread;
+}
+
+
+/**
+ * Calculate packet checksum.
+ */
+static uint8_t checksum(const uint8_t *payload, unsigned size) {
+    uint8_t checksum = 0;
+    for (unsigned i=0; i<size; i++)
+        checksum += payload[i];
+    return checksum;
+}
+
+
+/**
+ * Get the next valid packet of the received bytes.
+ * @return The payload of the packet, valid until the next bytes are added,
+ *   or NULL if no whole packet is left.
+ */
+const uint8_t* ahrs_framer_next(ahrs_framer_t *framer) {
+    const size_t packet_len = framer->payload_len + 2;
+
+    while (framer->head - framer->tail >= packet_len) {
+        const uint8_t *packet = framer->ring + (framer->tail & RING_MASK);
+
+        // Skip to the next header
+        if (*packet != AHRS_FRAMER_HEADER) {
+            size_t len = framer->head - framer->tail;
+            size_t contiguous =
+                AHRS_FRAMER_RING_SIZE - (framer->tail & RING_MASK);
+            if (contiguous < len)
+                len = contiguous;
+            const uint8_t *header = memchr(packet, AHRS_FRAMER_HEADER, len);
+            size_t skip = header ? (size_t) (header - packet) : len;
+            framer->tail += skip;
+            framer->skipped += skip;
+            continue;
+        }
+
+        const uint8_t *payload = packet + 1;
+        if (checksum(payload, framer->payload_len)
+            == payload[framer->payload_len]) {
+            framer->tail += packet_len;
+            framer->packets++;
+            return payload;
+        }
+
+        // Bad checksum, resynchronize on the next header after this one
+        framer->tail++;
+        framer->skipped++;
+        framer->bad_checksums++;
+    }
+
+    return NULL;
+}
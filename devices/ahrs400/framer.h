@@ -0,0 +1,60 @@
+/**
+ * Incremental framer of the AHRS400 data packets.
+ *
+ * The packets are a 0xFF header, the payload and the 8-bit sum of the
+ * payload bytes. The framer takes the bytes of the serial port as read()
+ * returns them, in a ring buffer, and finds the packets with a valid
+ * checksum among them. After a bad checksum it resynchronizes on the next
+ * header in the bytes already received, without reading or moving them.
+ *
+ * The first bytes of the ring are mirrored after its end, so that every
+ * packet is contiguous and its payload is returned in place.
+ */
+
+#ifndef AHRS400_FRAMER_H
+#define AHRS400_FRAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Packet header byte. */
+#define AHRS_FRAMER_HEADER 0xFF
+
+/** Size of the ring buffer, a power of two. */
+#define AHRS_FRAMER_RING_SIZE 4096
+
+/** Largest packet, header and checksum included. */
+#define AHRS_FRAMER_MAX_PACKET 64
+
+/** Packet framer. */
+typedef struct ahrs_framer {
+    /** Received bytes, with the first ones mirrored after the end. */
+    uint8_t ring[AHRS_FRAMER_RING_SIZE + AHRS_FRAMER_MAX_PACKET];
+    size_t head;              /**< Bytes received, modulo the ring size. */
+    size_t tail;              /**< Bytes consumed, modulo the ring size. */
+    unsigned payload_len;     /**< Payload length of the packets. */
+    uint64_t read_time_us;    /**< Time of the last ahrs_framer_fill(). */
+    unsigned long packets;    /**< Valid packets found. */
+    unsigned long bad_checksums; /**< Headers followed by a bad checksum. */
+    unsigned long skipped;    /**< Bytes skipped while resynchronizing. */
+} ahrs_framer_t;
+
+void ahrs_framer_init(ahrs_framer_t *framer, unsigned payload_len);
+void ahrs_framer_reset(ahrs_framer_t *framer);
+uint8_t* ahrs_framer_space(ahrs_framer_t *framer, size_t *len);
+void ahrs_framer_commit(ahrs_framer_t *framer, size_t len);
+ssize_t ahrs_framer_fill(ahrs_framer_t *framer, int fd);
+const uint8_t* ahrs_framer_next(ahrs_framer_t *framer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//AHRS400_FRAMER_H
@@ -0,0 +1,261 @@
+#ifndef FDAS_DEVICES_IIO_DECODER_HPP_
+#define FDAS_DEVICES_IIO_DECODER_HPP_
+
+/**
+ * Decoders of the samples of iio channels.
+ */
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <iio.h>
+
+#include "common/common.hpp"
+#include "deinterleave.hpp"
+
+
+namespace fdas {
+
+/**
+ * Decoder of the samples of an iio channel in a buffer.
+ * Chosen once per channel by MakeChannelDecoder(), so that the decoding
+ * loop does not depend on the data format at run time.
+ */
+class ChannelDecoder {
+ protected:
+  const DataId *id;
+
+ public:
+  explicit ChannelDecoder(const DataId *id) : id(id) {}
+  virtual ~ChannelDecoder() {}
+
+  const DataId* Id() const {return id;}
+
+  /** Type of the decoded values. */
+  virtual ValueType Type() const = 0;
+
+  /**
+   * Decode the samples of the channel and pass them to the sinks as a block.
+   * @param first Pointer to the first sample of the channel.
+   * @param step Distance in bytes between consecutive samples.
+   * @param count Number of samples, at most the buffer size of the decoder.
+   */
+  virtual void Decode(const char *first, ptrdiff_t step, size_t count,
+                      const uint64_t *timestamps,
+                      const DataSinkPtrList &data_sinks) = 0;
+};
+
+inline uint8_t ByteSwap(uint8_t value) {return value;}
+inline uint16_t ByteSwap(uint16_t value) {return __builtin_bswap16(value);}
+inline uint32_t ByteSwap(uint32_t value) {return __builtin_bswap32(value);}
+inline uint64_t ByteSwap(uint64_t value) {return __builtin_bswap64(value);}
+
+/**
+ * Decoder of a channel format.
+ *
+ * The raw sample is a `Raw` word in the buffer, byte swapped if `kSwap`,
+ * whose value is `bits` wide starting at bit `shift`. It is sign extended if
+ * `kSigned` and delivered as `Value`, which is either the integer type of the
+ * sample or double for the scaled value (raw + offset) * scale.
+ */
+template<typename Raw, bool kSigned, bool kSwap, typename Value>
+class TypedChannelDecoder : public ChannelDecoder {
+  typedef typename std::conditional<
+    kSigned, typename std::make_signed<Raw>::type, Raw>::type Integer;
+
+  unsigned shift;  /**< Position of the value in the raw word. */
+  unsigned extend; /**< Number of unused high bits of the raw word. */
+  double offset, scale;
+  std::vector<Value> column;
+
+  /** Decode one sample. */
+  Value Sample(const char *p) const {
+    Raw raw;
+    std::memcpy(&raw, p, sizeof raw);
+    if (kSwap)
+      raw = ByteSwap(raw);
+    raw = static_cast<Raw>(raw >> shift);
+
+    // Shift the value to the top and back to clear or sign extend the rest
+    Integer value = static_cast<Integer>(static_cast<Integer>(
+        static_cast<Raw>(raw << extend)) >> extend);
+    if (std::is_floating_point<Value>::value)
+      return static_cast<Value>((value + offset) * scale);
+    return static_cast<Value>(value);
+  }
+
+ public:
+  TypedChannelDecoder(const DataId *id, const struct iio_data_format *fmt,
+                      double offset, double scale, size_t buffer_size)
+      : ChannelDecoder(id), shift(fmt->shift), offset(offset), scale(scale),
+        column(buffer_size) {
+    const unsigned width = 8 * sizeof(Raw);
+    unsigned bits = fmt->bits;
+    if (!bits || bits + shift > width)
+      bits = width - std::min(shift, width - 1);
+    extend = width - bits;
+  }
+
+  virtual ValueType Type() const {return ValueTypeOf<Value>();}
+
+  virtual void Decode(const char *first, ptrdiff_t step, size_t count,
+                      const uint64_t *timestamps,
+                      const DataSinkPtrList &data_sinks) {
+    Value *values = column.data();
+    for (size_t i=0; i<count; i++, first += step)
+      values[i] = Sample(first);
+
+    DataBlock<Value> block(id, values, timestamps, count);
+    for (const auto& sink: data_sinks)
+      sink->TakeBlock(block);
+  }
+};
+
+/**
+ * Decoder of a channel format supported by the vectorized kernels.
+ * `Value` is double for scaled values, otherwise the integer type of the
+ * sample, and the kernel is chosen for the CPU by BestKernel().
+ */
+template<typename Value>
+class KernelChannelDecoder : public ChannelDecoder {
+  Kernel kernel;
+  ColumnFormat format;
+  std::vector<Value> column;
+
+ public:
+  KernelChannelDecoder(const DataId *id, Kernel kernel,
+                       const ColumnFormat &format, size_t buffer_size)
+      : ChannelDecoder(id), kernel(kernel), format(format),
+        column(buffer_size) {}
+
+  virtual ValueType Type() const {return ValueTypeOf<Value>();}
+
+  virtual void Decode(const char *first, ptrdiff_t step, size_t count,
+                      const uint64_t *timestamps,
+                      const DataSinkPtrList &data_sinks) {
+    DecodeColumn(kernel, format, first, step, count, column.data());
+
+    DataBlock<Value> block(id, column.data(), timestamps, count);
+    for (const auto& sink: data_sinks)
+      sink->TakeBlock(block);
+  }
+};
+
+/**
+ * Create the decoder of a format for a vectorized kernel.
+ * @return the decoder, or null if the kernel does not support the format.
+ */
+inline std::unique_ptr<ChannelDecoder> MakeKernelChannelDecoder(
+    const DataId *id, const struct iio_data_format *fmt, double offset,
+    bool scaled, size_t buffer_size, Kernel kernel) {
+  const bool host_be = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+  ColumnFormat format;
+  format.length = fmt->length;
+  format.bits = fmt->bits;
+  format.shift = fmt->shift;
+  format.is_signed = fmt->is_signed;
+  format.swap = fmt->is_be != host_be;
+  format.scaled = scaled && fmt->with_scale;
+  format.offset = offset;
+  format.scale = fmt->scale;
+  if (kernel == Kernel::SCALAR || !KernelSupports(format))
+    return nullptr;
+
+  ChannelDecoder *decoder;
+  if (format.scaled)
+    decoder = new KernelChannelDecoder<double>(id, kernel, format, buffer_size);
+  else if (format.length == 16 && format.is_signed)
+    decoder = new KernelChannelDecoder<int16_t>(id, kernel, format, buffer_size);
+  else if (format.length == 16)
+    decoder = new KernelChannelDecoder<uint16_t>(id, kernel, format,
+                                                 buffer_size);
+  else if (format.is_signed)
+    decoder = new KernelChannelDecoder<int32_t>(id, kernel, format, buffer_size);
+  else
+    decoder = new KernelChannelDecoder<uint32_t>(id, kernel, format,
+                                                 buffer_size);
+  return std::unique_ptr<ChannelDecoder>(decoder);
+}
+
+/** Select the decoder value type, scaled or the sample integer type. */
+template<typename Raw, bool kSigned, bool kSwap>
+std::unique_ptr<ChannelDecoder> SelectChannelValue(
+    const DataId *id, const struct iio_data_format *fmt, double offset,
+    bool scaled, size_t buffer_size) {
+  typedef typename std::conditional<
+    kSigned, typename std::make_signed<Raw>::type, Raw>::type Integer;
+
+  if (scaled && fmt->with_scale) {
+    return std::unique_ptr<ChannelDecoder>(
+        new TypedChannelDecoder<Raw, kSigned, kSwap, double>(
+            id, fmt, offset, fmt->scale, buffer_size));
+  }
+  return std::unique_ptr<ChannelDecoder>(
+      new TypedChannelDecoder<Raw, kSigned, kSwap, Integer>(
+          id, fmt, 0, 1, buffer_size));
+}
+
+/** Select the decoder byte order, swapping if it differs from the host. */
+template<typename Raw, bool kSigned>
+std::unique_ptr<ChannelDecoder> SelectChannelOrder(
+    const DataId *id, const struct iio_data_format *fmt, double offset,
+    bool scaled, size_t buffer_size) {
+  const bool host_be = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+  if (fmt->is_be != host_be) {
+    return SelectChannelValue<Raw, kSigned, true>(
+        id, fmt, offset, scaled, buffer_size);
+  }
+  return SelectChannelValue<Raw, kSigned, false>(
+      id, fmt, offset, scaled, buffer_size);
+}
+
+/** Select the decoder signedness. */
+template<typename Raw>
+std::unique_ptr<ChannelDecoder> SelectChannelSign(
+    const DataId *id, const struct iio_data_format *fmt, double offset,
+    bool scaled, size_t buffer_size) {
+  if (fmt->is_signed)
+    return SelectChannelOrder<Raw, true>(id, fmt, offset, scaled, buffer_size);
+  return SelectChannelOrder<Raw, false>(id, fmt, offset, scaled, buffer_size);
+}
+
+/**
+ * Create the decoder of a channel data format.
+ * @param offset Channel offset, added to the raw value before scaling.
+ * @param scaled Whether to deliver scaled double values for channels with
+ *   a scale, instead of their raw integer values.
+ * @param buffer_size Largest number of samples decoded at once.
+ * @param kernel Vectorized kernel used for the formats it supports.
+ * @throw std::runtime_error if the sample length is not supported.
+ */
+inline std::unique_ptr<ChannelDecoder> MakeChannelDecoder(
+    const DataId *id, const struct iio_data_format *fmt, double offset,
+    bool scaled, size_t buffer_size, Kernel kernel = Kernel::SCALAR) {
+  auto decoder = MakeKernelChannelDecoder(id, fmt, offset, scaled,
+                                          buffer_size, kernel);
+  if (decoder)
+    return decoder;
+
+  switch (fmt->length) {
+    case 8:
+      return SelectChannelSign<uint8_t>(id, fmt, offset, scaled, buffer_size);
+    case 16:
+      return SelectChannelSign<uint16_t>(id, fmt, offset, scaled, buffer_size);
+    case 32:
+      return SelectChannelSign<uint32_t>(id, fmt, offset, scaled, buffer_size);
+    case 64:
+      return SelectChannelSign<uint64_t>(id, fmt, offset, scaled, buffer_size);
+    default:
+      throw std::runtime_error("Unexpected data length");
+  }
+}
+
+}// namespace fdas
+
+#endif//FDAS_DEVICES_IIO_DECODER_HPP_
@@ -0,0 +1,267 @@
+/**
+ * Vectorized de-interleaving of iio scan buffers.
+ */
+
+#include "deinterleave.hpp"
+
+#include <climits>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FDAS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+
+namespace fdas {
+
+Kernel BestKernel() {
+#ifdef FDAS_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return Kernel::AVX2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return Kernel::SSE41;
+#endif
+  return Kernel::SCALAR;
+}
+
+const char* KernelName(Kernel kernel) {
+  switch (kernel) {
+    case Kernel::AVX2: return "avx2";
+    case Kernel::SSE41: return "sse4.1";
+    default: return "scalar";
+  }
+}
+
+bool KernelSupports(const ColumnFormat &format) {
+  // The vector conversion to double is signed, so the values must fit 31 bits
+  return (format.length == 16 || format.length == 32) && format.bits
+      && format.bits + format.shift <= format.length
+      && !(format.scaled && !format.is_signed && format.bits == 32);
+}
+
+static inline uint16_t ByteSwap(uint16_t value) {
+  return __builtin_bswap16(value);
+}
+
+static inline uint32_t ByteSwap(uint32_t value) {
+  return __builtin_bswap32(value);
+}
+
+static inline void Store(uint16_t *out, int64_t value, const ColumnFormat&) {
+  *out = static_cast<uint16_t>(value);
+}
+
+static inline void Store(uint32_t *out, int64_t value, const ColumnFormat&) {
+  *out = static_cast<uint32_t>(value);
+}
+
+static inline void Store(double *out, int64_t value, const ColumnFormat &f) {
+  *out = (value + f.offset) * f.scale;
+}
+
+/** Decode samples one at a time, for the CPUs without vector kernels. */
+template<typename Raw, typename Out>
+static void ScalarColumn(const ColumnFormat &f, const char *p, ptrdiff_t step,
+                         size_t count, Out *out) {
+  const unsigned width = 8 * sizeof(Raw);
+  const unsigned extend = width - f.bits;
+  for (size_t i=0; i<count; i++, p += step) {
+    Raw raw;
+    std::memcpy(&raw, p, sizeof raw);
+    if (f.swap)
+      raw = ByteSwap(raw);
+    raw = static_cast<Raw>(static_cast<Raw>(raw >> f.shift) << extend);
+
+    int64_t value = raw >> extend;
+    if (f.is_signed && extend < width && (raw >> (width - 1)))
+      value -= int64_t(1) << f.bits;
+    Store(out + i, value, f);
+  }
+}
+
+#ifdef FDAS_X86_KERNELS
+
+/**
+ * Byte shuffle of the 32-bit lanes loaded at each sample: moves the sample
+ * word to the low end of the lane in host order and clears the rest.
+ */
+static inline void ShuffleMask(const ColumnFormat &f, char mask[16]) {
+  static const char kOrders[4][4] = {
+    {0, 1, -1, -1}, {1, 0, -1, -1}, {0, 1, 2, 3}, {3, 2, 1, 0}};
+  const char *order = kOrders[(f.length == 32) * 2 + f.swap];
+  for (int lane=0; lane<4; lane++) {
+    for (int byte=0; byte<4; byte++) {
+      mask[4*lane + byte] = static_cast<char>(
+          order[byte] < 0 ? -1 : 4*lane + order[byte]);
+    }
+  }
+}
+
+template<bool kSigned>
+__attribute__((target("sse4.1")))
+static inline __m128i Sse41Decode(__m128i x, __m128i mask, __m128i shift,
+                                  __m128i extend) {
+  x = _mm_shuffle_epi8(x, mask);
+  x = _mm_sll_epi32(_mm_srl_epi32(x, shift), extend);
+  return kSigned ? _mm_sra_epi32(x, extend) : _mm_srl_epi32(x, extend);
+}
+
+template<bool kSigned>
+__attribute__((target("sse4.1")))
+static inline void Sse41Store(uint16_t *out, __m128i x, const ColumnFormat&) {
+  x = kSigned ? _mm_packs_epi32(x, x) : _mm_packus_epi32(x, x);
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(out), x);
+}
+
+template<bool kSigned>
+__attribute__((target("sse4.1")))
+static inline void Sse41Store(uint32_t *out, __m128i x, const ColumnFormat&) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), x);
+}
+
+template<bool kSigned>
+__attribute__((target("sse4.1")))
+static inline void Sse41Store(double *out, __m128i x, const ColumnFormat &f) {
+  const __m128d offset = _mm_set1_pd(f.offset), scale = _mm_set1_pd(f.scale);
+  __m128d low = _mm_cvtepi32_pd(x);
+  __m128d high = _mm_cvtepi32_pd(_mm_srli_si128(x, 8));
+  _mm_storeu_pd(out, _mm_mul_pd(_mm_add_pd(low, offset), scale));
+  _mm_storeu_pd(out + 2, _mm_mul_pd(_mm_add_pd(high, offset), scale));
+}
+
+/**
+ * Decode four samples at a time with SSE4.1.
+ * The last sample is left to the scalar loop, since the 32-bit loads of
+ * 16-bit samples reach two bytes past it.
+ * @return the number of samples decoded.
+ */
+template<bool kSigned, typename Out>
+__attribute__((target("sse4.1")))
+static size_t Sse41Column(const ColumnFormat &f, const char *p,
+                          ptrdiff_t step, size_t count, Out *out) {
+  char shuffle[16];
+  ShuffleMask(f, shuffle);
+  const __m128i mask = _mm_loadu_si128(reinterpret_cast<__m128i*>(shuffle));
+  const __m128i shift = _mm_cvtsi32_si128(f.shift);
+  const __m128i extend = _mm_cvtsi32_si128(32 - f.bits);
+
+  size_t i = 0;
+  for (; i + 4 < count; i += 4, p += 4*step) {
+    int32_t words[4];
+    for (int lane=0; lane<4; lane++)
+      std::memcpy(words + lane, p + lane*step, sizeof *words);
+    __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i*>(words));
+    Sse41Store<kSigned>(out + i, Sse41Decode<kSigned>(x, mask, shift, extend),
+                        f);
+  }
+  return i;
+}
+
+template<bool kSigned>
+__attribute__((target("avx2")))
+static inline __m256i Avx2Decode(__m256i x, __m256i mask, __m128i shift,
+                                 __m128i extend) {
+  x = _mm256_shuffle_epi8(x, mask);
+  x = _mm256_sll_epi32(_mm256_srl_epi32(x, shift), extend);
+  return kSigned ? _mm256_sra_epi32(x, extend) : _mm256_srl_epi32(x, extend);
+}
+
+template<bool kSigned>
+__attribute__((target("avx2")))
+static inline void Avx2Store(uint16_t *out, __m256i x, const ColumnFormat&) {
+  __m128i low = _mm256_castsi256_si128(x);
+  __m128i high = _mm256_extracti128_si256(x, 1);
+  x = _mm256_castsi128_si256(
+      kSigned ? _mm_packs_epi32(low, high) : _mm_packus_epi32(low, high));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                   _mm256_castsi256_si128(x));
+}
+
+template<bool kSigned>
+__attribute__((target("avx2")))
+static inline void Avx2Store(uint32_t *out, __m256i x, const ColumnFormat&) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), x);
+}
+
+template<bool kSigned>
+__attribute__((target("avx2")))
+static inline void Avx2Store(double *out, __m256i x, const ColumnFormat &f) {
+  const __m256d offset = _mm256_set1_pd(f.offset);
+  const __m256d scale = _mm256_set1_pd(f.scale);
+  __m256d low = _mm256_cvtepi32_pd(_mm256_castsi256_si128(x));
+  __m256d high = _mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1));
+  _mm256_storeu_pd(out, _mm256_mul_pd(_mm256_add_pd(low, offset), scale));
+  _mm256_storeu_pd(out + 4, _mm256_mul_pd(_mm256_add_pd(high, offset), scale));
+}
+
+/**
+ * Decode eight samples at a time with AVX2, gathering them in one load.
+ * Like Sse41Column(), the last sample is left to the scalar loop.
+ * @return the number of samples decoded.
+ */
+template<bool kSigned, typename Out>
+__attribute__((target("avx2")))
+static size_t Avx2Column(const ColumnFormat &f, const char *p,
+                         ptrdiff_t step, size_t count, Out *out) {
+  char shuffle[16];
+  ShuffleMask(f, shuffle);
+  const __m256i mask = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<__m128i*>(shuffle)));
+  const __m128i shift = _mm_cvtsi32_si128(f.shift);
+  const __m128i extend = _mm_cvtsi32_si128(32 - f.bits);
+  const int s = static_cast<int>(step);
+  const __m256i index = _mm256_setr_epi32(0, s, 2*s, 3*s, 4*s, 5*s, 6*s, 7*s);
+
+  size_t i = 0;
+  for (; i + 8 < count; i += 8, p += 8*step) {
+    __m256i x = _mm256_i32gather_epi32(reinterpret_cast<const int*>(p),
+                                       index, 1);
+    Avx2Store<kSigned>(out + i, Avx2Decode<kSigned>(x, mask, shift, extend),
+                       f);
+  }
+  return i;
+}
+
+#endif//FDAS_X86_KERNELS
+
+template<typename Out>
+static void DecodeColumnAs(Kernel kernel, const ColumnFormat &f,
+                           const char *first, ptrdiff_t step, size_t count,
+                           Out *out) {
+  size_t done = 0;
+#ifdef FDAS_X86_KERNELS
+  if (step > 0 && step <= INT_MAX / 8) {
+    if (kernel == Kernel::AVX2) {
+      done = f.is_signed ? Avx2Column<true>(f, first, step, count, out)
+          : Avx2Column<false>(f, first, step, count, out);
+    } else if (kernel == Kernel::SSE41) {
+      done = f.is_signed ? Sse41Column<true>(f, first, step, count, out)
+          : Sse41Column<false>(f, first, step, count, out);
+    }
+  }
+#endif
+
+  first += done * step;
+  if (f.length == 16)
+    ScalarColumn<uint16_t>(f, first, step, count - done, out + done);
+  else
+    ScalarColumn<uint32_t>(f, first, step, count - done, out + done);
+}
+
+void DecodeColumn(Kernel kernel, const ColumnFormat &format,
+                  const char *first, ptrdiff_t step, size_t count, void *out) {
+  if (format.scaled) {
+    DecodeColumnAs(kernel, format, first, step, count,
+                   static_cast<double*>(out));
+  } else if (format.length == 16) {
+    DecodeColumnAs(kernel, format, first, step, count,
+                   static_cast<uint16_t*>(out));
+  } else {
+    DecodeColumnAs(kernel, format, first, step, count,
+                   static_cast<uint32_t*>(out));
+  }
+}
+
+}// namespace fdas
@@ -0,0 +1,63 @@
+#ifndef FDAS_DEVICES_IIO_DEINTERLEAVE_HPP_
+#define FDAS_DEVICES_IIO_DEINTERLEAVE_HPP_
+
+/**
+ * Vectorized de-interleaving of iio scan buffers.
+ */
+
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace fdas {
+
+/** Implementation of the de-interleave kernel. */
+enum class Kernel {SCALAR, SSE41, AVX2};
+
+/** The fastest kernel supported by the running CPU. */
+Kernel BestKernel();
+
+const char* KernelName(Kernel kernel);
+
+/**
+ * Format of a channel decoded by the kernels.
+ *
+ * Samples are 16 or 32-bit words, byte swapped if `swap`, whose value is
+ * `bits` wide starting at bit `shift`. The decoded column holds the sign or
+ * zero extended words, uint16_t or uint32_t, or if `scaled` the doubles
+ * (value + offset) * scale.
+ */
+struct ColumnFormat {
+  unsigned length;
+  unsigned bits;
+  unsigned shift;
+  bool is_signed;
+  bool swap;
+  bool scaled;
+  double offset;
+  double scale;
+};
+
+/** Whether the kernels can decode a format, otherwise use the decoders. */
+bool KernelSupports(const ColumnFormat &format);
+
+/**
+ * De-interleave and decode a channel of a scan buffer into a column.
+ *
+ * The kernels gather the strided samples into vector registers, AVX2 with
+ * a gather instruction, and decode eight or four samples at once with the
+ * same shifts for the extraction and sign extension, a byte shuffle for the
+ * swap and a vector multiply-add for the scaling. Called for each channel
+ * after a refill, while the buffer is still in the cache.
+ *
+ * @param first Pointer to the first sample of the channel.
+ * @param step Distance in bytes between consecutive scans.
+ * @param out Column of `count` values of the decoded type.
+ */
+void DecodeColumn(Kernel kernel, const ColumnFormat &format,
+                  const char *first, ptrdiff_t step, size_t count, void *out);
+
+}// namespace fdas
+
+#endif//FDAS_DEVICES_IIO_DEINTERLEAVE_HPP_
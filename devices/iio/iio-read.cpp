@@ -2,15 +2,24 @@
  * FDAS device module for reading iio devices.
  */
 
-#include <iostream>
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <chrono>
 #include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 
-#include <boost/any.hpp>
 #include <boost/log/trivial.hpp>
 #include <iio.h>
 
 #include "common/common.hpp"
+#include "reader.hpp"
+#include "refill.hpp"
 
 
 namespace po = boost::program_options;
@@ -22,116 +31,289 @@ using std::endl;
 using std::string;
 using std::vector;
 
-using boost::any;
-
-
-any InterpretValue(const struct iio_data_format* fmt, void *data_ptr) {
-  if (fmt->is_signed) {
-    switch (fmt->length/8) {
-      case 1: 
-        return *reinterpret_cast<int8_t*>(data_ptr);
-      case 2: 
-        return *reinterpret_cast<int16_t*>(data_ptr);
-      case 4: 
-        return *reinterpret_cast<int32_t*>(data_ptr);
-      case 8: 
-        return *reinterpret_cast<int64_t*>(data_ptr);
-      default:
-        throw std::runtime_error("Unexpected data length");
+
+/** Time spent measuring the scan rate of a device when auto-tuning. */
+static const double kProbeSeconds = 0.5;
+
+/** Longest wait for a refill of the probe buffer, in milliseconds. */
+static const int kProbeTimeoutMs = 1000;
+
+/** Largest buffer size chosen by the auto-tuning. */
+static const size_t kMaxTunedBufferSize = 1 << 20;
+
+/**
+ * Set the trigger and sampling frequency of a device.
+ * The frequency is set on the trigger for the devices without one, like
+ * those sampled by a timer trigger.
+ * @param sampling_frequency Frequency in Hz, or 0 to leave it.
+ * @param trigger_name Name of the trigger, or empty to leave it.
+ * @return whether the device was configured.
+ */
+bool ConfigureDevice(struct iio_context *ctx, struct iio_device *dev,
+                     double sampling_frequency, const string &trigger_name) {
+  const struct iio_device *trigger = nullptr;
+  if (!trigger_name.empty()) {
+    trigger = iio_context_find_device(ctx, trigger_name.c_str());
+    if (!trigger || !iio_device_is_trigger(trigger)) {
+      BOOST_LOG_TRIVIAL(error) << "Could not find iio trigger `"
+                               << trigger_name << '`';
+      return false;
     }
-  } else {
-    switch (fmt->length/8) {
-      case 1: 
-        return *reinterpret_cast<uint8_t*>(data_ptr);
-      case 2: 
-        return *reinterpret_cast<uint16_t*>(data_ptr);
-      case 4: 
-        return *reinterpret_cast<uint32_t*>(data_ptr);
-      case 8: 
-        return *reinterpret_cast<uint64_t*>(data_ptr);
-      default:
-        throw std::runtime_error("Unexpected data length");
+    int ret = iio_device_set_trigger(dev, trigger);
+    if (ret < 0) {
+      BOOST_LOG_TRIVIAL(error) << "Could not set the trigger of iio device `"
+                               << iio_device_get_id(dev) << "`: "
+                               << std::strerror(-ret);
+      return false;
     }
   }
+
+  if (sampling_frequency > 0) {
+    int ret = iio_device_attr_write_double(dev, "sampling_frequency",
+                                           sampling_frequency);
+    if (ret == -ENOENT && trigger) {
+      ret = iio_device_attr_write_double(trigger, "sampling_frequency",
+                                         sampling_frequency);
+    }
+    if (ret < 0) {
+      BOOST_LOG_TRIVIAL(error) << "Could not set the sampling frequency of "
+                               << "iio device `" << iio_device_get_id(dev)
+                               << "`: " << std::strerror(-ret);
+      return false;
+    }
+  }
+
+  // Report the frequency the driver settled on, which may be rounded
+  double actual;
+  if (iio_device_attr_read_double(dev, "sampling_frequency", &actual) >= 0) {
+    BOOST_LOG_TRIVIAL(info) << "iio device `" << iio_device_get_id(dev)
+                            << "`: sampling frequency " << actual << " Hz";
+  }
+  return true;
 }
 
-void ReadBuffer(struct iio_device *dev, const DataSinkPtrList &data_sinks,
-                size_t buffer_size) {
-  struct iio_channel *timestamp_channel = 0;
-  vector<struct iio_channel*> channels;
-  vector<const struct iio_data_format*> data_formats;
-  vector<void*> data_ptrs;
-  vector<DataId> data_ids;
-  
-  for (int i=0; i<iio_device_get_channels_count(dev); i++) {
+/**
+ * Refill a non-blocking buffer, waiting for data at most `timeout_ms`.
+ * @return the number of bytes read, or a negative error number, -ETIMEDOUT
+ *   if no data came in time.
+ */
+static ssize_t RefillWithTimeout(struct iio_buffer *buffer, int timeout_ms) {
+  struct pollfd fd = {iio_buffer_get_poll_fd(buffer), POLLIN, 0};
+  if (fd.fd < 0)
+    return fd.fd;
+
+  for (;;) {
+    ssize_t nread = iio_buffer_refill(buffer);
+    if (nread != -EAGAIN)
+      return nread;
+
+    int ret = poll(&fd, 1, timeout_ms);
+    if (ret == 0)
+      return -ETIMEDOUT;
+    if (ret < 0 && errno != EINTR)
+      return -errno;
+  }
+}
+
+/**
+ * Measure the scan rate of a device by timing the refills of a probe
+ * buffer. The probe holds about a tenth of the scans of a refill period at
+ * the nominal sampling frequency, or a single scan if there is none. At high
+ * rates a single scan buffer misses scans, underestimating the rate, which
+ * only errs toward smaller buffers. A device which stops sampling fails the
+ * measurement after kProbeTimeoutMs.
+ * @return the rate in Hz, or 0 if it could not be measured.
+ */
+double MeasureScanRate(struct iio_device *dev) {
+  double nominal;
+  if (iio_device_attr_read_double(dev, "sampling_frequency", &nominal) < 0)
+    nominal = 0;
+
+  // The scan elements are enabled as the reader will
+  for (unsigned i=0; i<iio_device_get_channels_count(dev); i++) {
     struct iio_channel *channel = iio_device_get_channel(dev, i);
-    const char* channel_name = iio_channel_get_name(channel);
-
-    // Proceed to next channel if the current cannot be read in the buffer
-    if (!iio_channel_is_scan_element(channel))
-      continue;
-    
-    iio_channel_enable(channel);
-    if (!std::strcmp(channel_name, "timestamp")) {
-      timestamp_channel = channel;
-    } else {
-      channels.push_back(channel);
-      data_formats.push_back(iio_channel_get_data_format(channel));
-      data_ids.push_back(DataId(channel_name));
+    if (iio_channel_is_scan_element(channel))
+      iio_channel_enable(channel);
+  }
+
+  size_t probe_size = std::max<size_t>(1, nominal * kProbeSeconds / 10);
+  struct iio_buffer *probe = iio_device_create_buffer(dev, probe_size, false);
+  if (!probe)
+    return 0;
+  if (iio_buffer_set_blocking_mode(probe, false) < 0) {
+    iio_buffer_destroy(probe);
+    return 0;
+  }
+
+  // Skip the first refill, which includes the start of the acquisition
+  using namespace std::chrono;
+  double elapsed = 0;
+  size_t scans = 0;
+  if (RefillWithTimeout(probe, kProbeTimeoutMs) >= 0) {
+    auto start = steady_clock::now();
+    do {
+      ssize_t nread = RefillWithTimeout(probe, kProbeTimeoutMs);
+      if (nread < 0) {
+        scans = 0;
+        break;
+      }
+      scans += nread / iio_buffer_step(probe);
+      elapsed = duration<double>(steady_clock::now() - start).count();
+    } while (elapsed < kProbeSeconds);
+  }
+  iio_buffer_destroy(probe);
+  return elapsed > 0 ? scans / elapsed : 0;
+}
+
+/**
+ * Choose the buffer size of a device for a maximum latency, from its
+ * measured scan rate. The kernel buffer watermark follows the buffer size
+ * when the buffer is created, so poll() wakes up once a whole buffer is
+ * ready.
+ * @return the buffer size, or 0 if the rate could not be measured.
+ */
+size_t TuneBufferSize(struct iio_device *dev, double max_latency_ms) {
+  double rate = MeasureScanRate(dev);
+  if (rate <= 0) {
+    BOOST_LOG_TRIVIAL(error) << "Could not measure the scan rate of iio "
+                             << "device `" << iio_device_get_id(dev) << '`';
+    return 0;
+  }
+
+  size_t buffer_size = std::min<size_t>(
+      std::max(1.0, rate * max_latency_ms / 1000), kMaxTunedBufferSize);
+  BOOST_LOG_TRIVIAL(info) << "iio device `" << iio_device_get_id(dev)
+                          << "`: measured rate " << rate << " Hz, buffer "
+                          << buffer_size << " scans for a latency of "
+                          << max_latency_ms << " ms";
+  return buffer_size;
+}
+
+/** Read a device, refilling on a dedicated thread if `buffer_count` > 1. */
+void ReadBuffer(DeviceReader &reader, const DataSinkPtrList &data_sinks,
+                size_t buffer_count) {
+  if (buffer_count > 1) {
+    // Refill on a dedicated thread, processing the copies of the scans
+    RefillThread refill(reader.Buffer(), reader.BufferSize() * reader.Step(),
+                        buffer_count);
+    uint64_t overflows = 0;
+    while (ScanBlock *block = refill.Next()) {
+      reader.Process(block->data.data(), block->bytes, block->time_us,
+                     block->first_scan,
+                     data_sinks);
+      refill.Release(block);
+
+      if (refill.Overflows() != overflows) {
+        overflows = refill.Overflows();
+        BOOST_LOG_TRIVIAL(warning) << "iio refill overflows: " << overflows
+                                   << ", queue depth " << refill.Depth()
+                                   << '/' << buffer_count;
+      }
+    }
+    BOOST_LOG_TRIVIAL(error) << "Error refilling iio buffer: "
+                             << std::strerror(refill.Error());
+    BOOST_LOG_TRIVIAL(info) << "iio refill queue depth reached "
+                            << refill.MaxDepth() << '/' << buffer_count
+                            << ", " << refill.Overflows() << " overflows";
+  } else {
+    for (;;) {
+      ssize_t nread = reader.Refill(data_sinks);
+      if (nread < 0) {
+        BOOST_LOG_TRIVIAL(error) << "Error refilling iio buffer: "
+                                 << std::strerror(-nread);
+        return;
+      }
     }
   }
-  
-  struct iio_buffer *buffer = iio_device_create_buffer(dev, buffer_size, false);
-  if (!buffer) {
-    BOOST_LOG_TRIVIAL(error) << "Could create iio buffer.";
-    return;
+}
+
+/**
+ * Read several devices in one event loop.
+ * The buffers are non-blocking and refilled when poll() reports their
+ * descriptors readable, so no device waits for another.
+ */
+void PollDevices(const vector<std::unique_ptr<DeviceReader>> &readers,
+                 const DataSinkPtrList &data_sinks) {
+  vector<struct pollfd> fds;
+  for (const auto& reader: readers) {
+    int status = iio_buffer_set_blocking_mode(reader->Buffer(), false);
+    int fd = status < 0 ? status : iio_buffer_get_poll_fd(reader->Buffer());
+    if (fd < 0) {
+      BOOST_LOG_TRIVIAL(error) << "Could not poll iio device `"
+                               << reader->Id() << "`: "
+                               << std::strerror(-fd);
+      return;
+    }
+    fds.push_back(pollfd{fd, POLLIN, 0});
   }
 
   for (;;) {
-    // Get data from the buffer
-    ssize_t nread = iio_buffer_refill(buffer);
-    if (nread < 0) {
-      BOOST_LOG_TRIVIAL(error) << "Error refilling iio buffer: "
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      BOOST_LOG_TRIVIAL(error) << "Error polling iio buffers: "
                                << std::strerror(errno);
-      goto cleanup_and_exit;
+      return;
     }
 
-    ptrdiff_t buffer_step = iio_buffer_step(buffer);
-    void *buffer_end = iio_buffer_end(buffer);
-    for (int i=0; i<channels.size(); i++) {
-      data_ptrs[i] = iio_buffer_first(buffer, channels[i]);
-    }
-    void *timestamp_data_ptr = iio_buffer_first(buffer, timestamp_channel);
-
-    for (int i=0; i<buffer_size; i++) {
-      int64_t timestamp = *reinterpret_cast<int64_t*>(timestamp_data_ptr);
-      for (int j=0; i<channels.size(); j++) {
-        any value = InterpretValue(data_formats[i], data_ptrs[i]);
-        data_ptrs[j] += buffer_step;
-        std::cout << boost::any_cast<double>(value) << " ";
+    for (size_t i=0; i<fds.size(); i++) {
+      if (!fds[i].revents)
+        continue;
+
+      ssize_t nread = readers[i]->Refill(data_sinks);
+      if (nread < 0 && nread != -EAGAIN) {
+        BOOST_LOG_TRIVIAL(error) << "Error refilling iio buffer of `"
+                                 << readers[i]->Id() << "`: "
+                                 << std::strerror(-nread);
+        return;
       }
-      timestamp_data_ptr += buffer_step;
     }
-
-    std::cout << std::endl;
   }
-  
-cleanup_and_exit:  
-  iio_buffer_destroy(buffer);
 }
 
 int main (int argc, char *argv[]) {
   // Command line arguments
-  string device_name;
+  vector<string> device_names;
   unsigned buffer_size;
+  unsigned buffer_count;
+  double sampling_frequency;
+  double max_latency_ms;
+  string trigger_name;
+  string uri;
+  string record_path;
+  string replay_path;
   
   // Define accepted command line arguments
   po::options_description desc("Read from iio device");
   desc.add_options()
-      ("device,d", po::value<string>(&device_name)->required(),
-       "iio device to read from")
+      ("uri", po::value<string>(&uri),
+       "libiio context URI, like ip:HOST or xml:FILE, instead of the local "
+       "context")
+      ("device,d", po::value<vector<string>>(&device_names)->required(),
+       "iio device to read from, repeat to read several devices in one event "
+       "loop with their streams named DEVICE.CHANNEL")
       ("buffer-size", po::value<unsigned>(&buffer_size)->default_value(512),
-       "iio buffer size (default 512)");
+       "iio buffer size (default 512)")
+      ("buffer-count", po::value<unsigned>(&buffer_count)->default_value(1),
+       "Number of refilled buffers in flight; above 1, a dedicated thread "
+       "refills the iio buffer while the previous ones are processed, with "
+       "a single device (default 1)")
+      ("sampling-frequency",
+       po::value<double>(&sampling_frequency)->default_value(0),
+       "Set the sampling frequency of the devices, in Hz")
+      ("trigger", po::value<string>(&trigger_name),
+       "Set the trigger of the devices")
+      ("max-latency", po::value<double>(&max_latency_ms),
+       "Auto-tune the buffer size of each device for a maximum latency, in "
+       "ms, from its measured scan rate, instead of --buffer-size")
+      ("scaled", "Read scaled values, (raw + offset) * scale, of the channels "
+       "with a scale as double instead of the raw integers")
+      ("record", po::value<string>(&record_path),
+       "Record the scans of the refills to a file, with a single device")
+      ("replay", po::value<string>(&replay_path),
+       "Read the scans of a recording as fast as possible instead of the "
+       "device, with a single device, which may come from an XML context, "
+       "and a buffer size at least that of the recording");
   desc.add(GeneralOptions()).add(DataSinkOptions());
   
   // Parse command line arguments
@@ -156,27 +338,92 @@ int main (int argc, char *argv[]) {
     cerr << "Error processing command line arguments: " << e.what() << endl;
     return EXIT_FAILURE;
   }
+  if (device_names.size() > 1 && (buffer_count > 1 || vm.count("record")
+                                  || vm.count("replay"))) {
+    cerr << "Options --buffer-count, --record and --replay require a single "
+         << "device" << endl;
+    return EXIT_FAILURE;
+  }
   DataSinkPtrList data_sinks = BuildDataSinks(vm);
   
   // Build libiio context
-  struct iio_context *ctx = iio_create_local_context();
+  struct iio_context *ctx = uri.empty() ? iio_create_local_context()
+      : iio_create_context_from_uri(uri.c_str());
   if (!ctx) {
     BOOST_LOG_TRIVIAL(error) << "Could not create libiio context";
     return EXIT_FAILURE;
   }
 
-  // Get the iio device
-  struct iio_device *dev = iio_context_find_device(ctx, device_name.c_str());
-  if (!dev) {
-    BOOST_LOG_TRIVIAL(error) << "Could not find iio device `" << device_name
-                             << '`';
-    return EXIT_FAILURE;
+  const Kernel kernel = BestKernel();
+  BOOST_LOG_TRIVIAL(info) << "Using the " << KernelName(kernel)
+                          << " de-interleave kernel";
+
+  // Get the iio devices
+  vector<std::unique_ptr<DeviceReader>> readers;
+  for (const auto& device_name: device_names) {
+    struct iio_device *dev = iio_context_find_device(ctx, device_name.c_str());
+    if (!dev) {
+      BOOST_LOG_TRIVIAL(error) << "Could not find iio device `" << device_name
+                               << '`';
+      return EXIT_FAILURE;
+    }
+
+    // A replayed device is not sampled
+    size_t device_buffer_size = buffer_size;
+    if (replay_path.empty()) {
+      if (!ConfigureDevice(ctx, dev, sampling_frequency, trigger_name))
+        return EXIT_FAILURE;
+      if (vm.count("max-latency")
+          && !(device_buffer_size = TuneBufferSize(dev, max_latency_ms)))
+        return EXIT_FAILURE;
+    }
+
+    string prefix = device_names.size() > 1 ? device_name + '.' : string();
+    readers.emplace_back(new DeviceReader(dev, prefix, device_buffer_size,
+                                          vm.count("scaled"), kernel));
   }
 
-  // Read from the device
-  ReadBuffer(dev, data_sinks, buffer_size);
+  // Announce the streams of all devices before any data
+  for (const auto& reader: readers)
+    reader->Declare(data_sinks);
+
+  std::FILE *recording = nullptr;
+  if (!record_path.empty()) {
+    recording = std::fopen(record_path.c_str(), "wb");
+    if (!recording) {
+      BOOST_LOG_TRIVIAL(error) << "Could not open scan recording `"
+                               << record_path << "`: " << std::strerror(errno);
+      return EXIT_FAILURE;
+    }
+    std::setvbuf(recording, nullptr, _IOFBF, BUFSIZ);
+    readers.front()->Record(recording);
+  }
+
+  // Read from the devices, or replay the recording of one
+  bool success = true;
+  if (!replay_path.empty()) {
+    std::FILE *replay = std::fopen(replay_path.c_str(), "rb");
+    if (!replay) {
+      BOOST_LOG_TRIVIAL(error) << "Could not open scan recording `"
+                               << replay_path << "`: " << std::strerror(errno);
+      return EXIT_FAILURE;
+    }
+    readers.front()->ComputeLayout();
+    success = readers.front()->Replay(replay, data_sinks);
+    std::fclose(replay);
+  } else {
+    for (const auto& reader: readers)
+      success = success && reader->CreateBuffer();
+    if (success && readers.size() == 1)
+      ReadBuffer(*readers.front(), data_sinks, buffer_count);
+    else if (success)
+      PollDevices(readers, data_sinks);
+  }
 
   // Cleanup and exit
+  readers.clear();
+  if (recording)
+    std::fclose(recording);
   iio_context_destroy(ctx);
-  return EXIT_SUCCESS;
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,248 @@
+/**
+ * Reading of the scan elements of iio devices.
+ */
+
+#include "reader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <boost/log/trivial.hpp>
+
+#include "common/registry.hpp"
+
+using std::string;
+using std::vector;
+
+
+namespace fdas {
+
+/** Number of refills over which the refill period is measured. */
+static const size_t kPeriodRefills = 8;
+
+uint64_t TimeMicroseconds() {
+  using namespace std::chrono;
+  auto now = system_clock::now().time_since_epoch();
+  return duration_cast<microseconds>(now).count();
+}
+
+DeviceReader::DeviceReader(struct iio_device *dev, const string &prefix,
+                           size_t buffer_size, bool scaled, Kernel kernel)
+    : dev(dev), buffer_size(buffer_size), timestamps(buffer_size),
+      clock(1e-3) {
+  for (unsigned i=0; i<iio_device_get_channels_count(dev); i++) {
+    struct iio_channel *channel = iio_device_get_channel(dev, i);
+    const char* channel_name = iio_channel_get_name(channel);
+    if (!channel_name)
+      channel_name = iio_channel_get_id(channel);
+
+    // Proceed to next channel if the current cannot be read in the buffer
+    if (!iio_channel_is_scan_element(channel))
+      continue;
+
+    iio_channel_enable(channel);
+    if (!std::strcmp(channel_name, "timestamp")) {
+      timestamp_channel = channel;
+    } else {
+      // Choose the decoder of the channel data format
+      double offset = 0;
+      if (iio_channel_attr_read_double(channel, "offset", &offset) < 0)
+        offset = 0;
+      string strid = prefix + channel_name;
+      channels.push_back(channel);
+      decoders.push_back(MakeChannelDecoder(
+          DataIdRegistry::Instance().Register(strid.c_str()),
+          iio_channel_get_data_format(channel), offset, scaled,
+          buffer_size, kernel));
+    }
+  }
+
+  // Without timestamps, the scans are timed from their index and rate
+  double rate;
+  if (!timestamp_channel) {
+    if (iio_device_attr_read_double(dev, "sampling_frequency", &rate) < 0)
+      rate = 0;
+    clock = ClockModel(rate > 0 ? 1e6 / rate : 0);
+  }
+}
+
+DeviceReader::~DeviceReader() {
+  if (buffer)
+    iio_buffer_destroy(buffer);
+}
+
+void DeviceReader::Declare(const DataSinkPtrList &data_sinks) const {
+  for (const auto& decoder: decoders) {
+    for (const auto& sink: data_sinks)
+      sink->Declare(decoder->Id(), decoder->Type());
+  }
+}
+
+bool DeviceReader::CreateBuffer() {
+  buffer = iio_device_create_buffer(dev, buffer_size, false);
+  if (!buffer) {
+    BOOST_LOG_TRIVIAL(error) << "Could create iio buffer.";
+    return false;
+  }
+
+  // The watermark can only be checked once the buffer exists, it should
+  // have followed its size so refills wake up on whole buffers
+  long long watermark;
+  if (iio_device_buffer_attr_read_longlong(dev, "watermark", &watermark) >= 0
+      && watermark != static_cast<long long>(buffer_size)) {
+    BOOST_LOG_TRIVIAL(warning) << "iio device `" << iio_device_get_id(dev)
+                               << "`: buffer watermark is not the buffer "
+                               << "size of " << buffer_size << " scans";
+  }
+
+  const char *start = static_cast<const char*>(iio_buffer_start(buffer));
+  step = iio_buffer_step(buffer);
+  offsets.clear();
+  for (const auto& channel: channels) {
+    offsets.push_back(static_cast<const char*>(
+        iio_buffer_first(buffer, channel)) - start);
+  }
+  if (timestamp_channel) {
+    timestamp_offset = static_cast<const char*>(
+        iio_buffer_first(buffer, timestamp_channel)) - start;
+  }
+  return true;
+}
+
+void DeviceReader::ComputeLayout() {
+  vector<struct iio_channel*> elements(channels);
+  if (timestamp_channel)
+    elements.push_back(timestamp_channel);
+  std::stable_sort(elements.begin(), elements.end(),
+                   [](struct iio_channel *a, struct iio_channel *b) {
+                     return iio_channel_get_index(a)
+                         < iio_channel_get_index(b);
+                   });
+
+  vector<ptrdiff_t> element_offsets;
+  ptrdiff_t largest = 1;
+  step = 0;
+  for (const auto& channel: elements) {
+    const struct iio_data_format *format =
+        iio_channel_get_data_format(channel);
+    ptrdiff_t size = std::max(1u, format->length / 8);
+    step = (step + size - 1) / size * size;
+    element_offsets.push_back(step);
+    step += size * std::max(1u, format->repeat);
+    largest = std::max(largest, size);
+  }
+  step = (step + largest - 1) / largest * largest;
+
+  auto offset_of = [&](struct iio_channel *channel) {
+    return element_offsets[std::find(elements.begin(), elements.end(), channel)
+                           - elements.begin()];
+  };
+  offsets.clear();
+  for (const auto& channel: channels)
+    offsets.push_back(offset_of(channel));
+  if (timestamp_channel)
+    timestamp_offset = offset_of(timestamp_channel);
+}
+
+void DeviceReader::Process(const char *scans, size_t bytes, uint64_t time_us,
+                           uint64_t first_scan,
+                           const DataSinkPtrList &data_sinks) {
+  size_t count = std::min<size_t>(bytes / step, buffer_size);
+
+  if (recording) {
+    RecordedRefill header = {time_us, first_scan,
+                             static_cast<uint32_t>(count * step),
+                             static_cast<uint32_t>(step)};
+    if (std::fwrite(&header, sizeof header, 1, recording) != 1
+        || std::fwrite(scans, step, count, recording) != count) {
+      BOOST_LOG_TRIVIAL(error) << "Error writing the scan recording of iio "
+                               << "device `" << Id() << "`, stopped";
+      recording = nullptr;
+    }
+  }
+
+  // Report the refill period once measured over a few refills
+  if (!refills) {
+    first_refill_us = time_us;
+  } else if (refills == kPeriodRefills) {
+    BOOST_LOG_TRIVIAL(info) << "iio device `" << Id() << "`: refill period "
+                            << (time_us - first_refill_us) / 1e3 / refills
+                            << " ms";
+  }
+  if (refills <= kPeriodRefills)
+    refills++;
+
+  // Build the timestamp column shared by all channels, mapping the last
+  // scan to the refill time and the scans to the system time
+  if (!count) {
+    return;
+  } else if (timestamp_channel) {
+    const char *timestamp_ptr = scans + timestamp_offset;
+    int64_t timestamp_ns;
+    std::memcpy(&timestamp_ns, timestamp_ptr + (count - 1) * step,
+                sizeof timestamp_ns);
+    clock.Observe(timestamp_ns, time_us);
+    for (size_t i=0; i<count; i++, timestamp_ptr += step) {
+      std::memcpy(&timestamp_ns, timestamp_ptr, sizeof timestamp_ns);
+      timestamps[i] = clock.Map(timestamp_ns);
+    }
+  } else {
+    clock.Observe(first_scan + count - 1, time_us);
+    for (size_t i=0; i<count; i++)
+      timestamps[i] = clock.Map(first_scan + i);
+  }
+
+  // Pass each channel to the sinks as a block
+  for (size_t i=0; i<decoders.size(); i++) {
+    decoders[i]->Decode(scans + offsets[i], step, count, timestamps.data(),
+                        data_sinks);
+  }
+}
+
+ssize_t DeviceReader::Refill(const DataSinkPtrList &data_sinks) {
+  ssize_t nread = iio_buffer_refill(buffer);
+  if (nread >= 0) {
+    Process(static_cast<const char*>(iio_buffer_start(buffer)), nread,
+            TimeMicroseconds(), next_scan, data_sinks);
+    next_scan += nread / step;
+  }
+  return nread;
+}
+
+bool DeviceReader::Replay(std::FILE *file, const DataSinkPtrList &data_sinks) {
+  RecordedRefill header;
+  vector<char> scans;
+  while (std::fread(&header, sizeof header, 1, file) == 1) {
+    if (!header.step || header.bytes % header.step) {
+      BOOST_LOG_TRIVIAL(error) << "Corrupt scan recording header, refill of "
+                               << header.bytes << " bytes in "
+                               << header.step << "-byte scans";
+      return false;
+    }
+    if (static_cast<ptrdiff_t>(header.step) != step
+        || header.bytes / header.step > buffer_size) {
+      BOOST_LOG_TRIVIAL(error) << "Scan recording of refills of "
+                               << header.bytes / header.step << " "
+                               << header.step << "-byte scans, iio device `"
+                               << Id() << "` has a buffer of " << buffer_size
+                               << ' ' << step << "-byte scans";
+      return false;
+    }
+    scans.resize(header.bytes);
+    if (std::fread(scans.data(), 1, header.bytes, file) != header.bytes) {
+      BOOST_LOG_TRIVIAL(error) << "Truncated scan recording";
+      return false;
+    }
+    Process(scans.data(), header.bytes, header.time_us, header.first_scan,
+            data_sinks);
+  }
+
+  if (std::ferror(file)) {
+    BOOST_LOG_TRIVIAL(error) << "Error reading the scan recording";
+    return false;
+  }
+  return true;
+}
+
+}// namespace fdas
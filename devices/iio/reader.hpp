@@ -0,0 +1,132 @@
+#ifndef FDAS_DEVICES_IIO_READER_HPP_
+#define FDAS_DEVICES_IIO_READER_HPP_
+
+/**
+ * Reading of the scan elements of iio devices.
+ */
+
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <iio.h>
+
+#include "common/clock.hpp"
+#include "common/common.hpp"
+#include "decoder.hpp"
+
+
+namespace fdas {
+
+/** Current time in microseconds since epoch. */
+uint64_t TimeMicroseconds();
+
+/**
+ * Header of a refill in a scan recording, followed by its `bytes` of scans.
+ * Recordings are in host byte order.
+ */
+struct RecordedRefill {
+  uint64_t time_us;    /**< Time of the refill, microseconds since epoch. */
+  uint64_t first_scan; /**< Index of the first scan of the refill. */
+  uint32_t bytes;
+  uint32_t step;       /**< Scan size, checked against the replaying reader. */
+};
+
+/**
+ * Reader of the scan elements of an iio device.
+ *
+ * Decodes the scans of the refills of the device buffer and passes each
+ * channel to the sinks as a block. The scans can also come from elsewhere
+ * through Process(), like a recording made with Record(), using the scan
+ * layout of ComputeLayout() instead of a buffer; readers of devices of XML
+ * contexts work without the hardware that way.
+ */
+class DeviceReader {
+  struct iio_device *dev;
+  size_t buffer_size;
+  struct iio_buffer *buffer = nullptr;
+  struct iio_channel *timestamp_channel = nullptr;
+  std::vector<struct iio_channel*> channels;
+  std::vector<std::unique_ptr<ChannelDecoder>> decoders;
+
+  /** Position of the channels in a scan, the same in every refill. */
+  std::vector<ptrdiff_t> offsets;
+  ptrdiff_t timestamp_offset = 0;
+  ptrdiff_t step = 0;
+
+  /** Per-buffer storage for the timestamps shared by all channels. */
+  std::vector<uint64_t> timestamps;
+
+  size_t refills = 0;         /**< Refills counted for the period. */
+  uint64_t first_refill_us;   /**< Time of the first refill. */
+
+  /**
+   * Model of the timestamp channel clock, in ns, or of the scan index for
+   * the devices without one, mapping them to the system time.
+   */
+  ClockModel clock;
+  uint64_t next_scan = 0;     /**< Index of the next scan refilled. */
+
+  std::FILE *recording = nullptr;
+
+ public:
+  /**
+   * Enable the scan elements of a device and choose their decoders.
+   * @param prefix Prefix of the stream identifiers, to tell the channels
+   *   of several devices apart.
+   */
+  DeviceReader(struct iio_device *dev, const std::string &prefix,
+               size_t buffer_size, bool scaled, Kernel kernel);
+
+  ~DeviceReader();
+
+  const char* Id() const {return iio_device_get_id(dev);}
+
+  struct iio_buffer* Buffer() const {return buffer;}
+
+  ptrdiff_t Step() const {return step;}
+
+  size_t BufferSize() const {return buffer_size;}
+
+  /** Announce the streams of the device. */
+  void Declare(const DataSinkPtrList &data_sinks) const;
+
+  /**
+   * Create the buffer of the device.
+   * @return whether the buffer was created.
+   */
+  bool CreateBuffer();
+
+  /**
+   * Lay the scan out from the channel formats like the kernel does, for
+   * scans which do not come from a buffer: the scan elements in index order,
+   * each aligned on its size, and the scan aligned on the largest.
+   */
+  void ComputeLayout();
+
+  /** Append the processed refills to a scan recording, or stop if null. */
+  void Record(std::FILE *file) {recording = file;}
+
+  /** Decode the scans of a refill and pass them to the sinks. */
+  void Process(const char *scans, size_t bytes, uint64_t time_us,
+               uint64_t first_scan, const DataSinkPtrList &data_sinks);
+
+  /**
+   * Refill the buffer and process the scans.
+   * @return the libiio refill result, negative if error.
+   */
+  ssize_t Refill(const DataSinkPtrList &data_sinks);
+
+  /**
+   * Process the refills of a scan recording, as fast as possible.
+   * @return whether the whole recording was processed.
+   */
+  bool Replay(std::FILE *file, const DataSinkPtrList &data_sinks);
+};
+
+}// namespace fdas
+
+#endif//FDAS_DEVICES_IIO_READER_HPP_
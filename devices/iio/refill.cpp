@@ -0,0 +1,101 @@
+/**
+ * Pipelined refilling of iio buffers.
+ */
+
+#include "refill.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+
+namespace fdas {
+
+/** Current time in microseconds since epoch. */
+static uint64_t TimeMicroseconds() {
+  using namespace std::chrono;
+  auto now = system_clock::now().time_since_epoch();
+  return duration_cast<microseconds>(now).count();
+}
+
+RefillThread::RefillThread(struct iio_buffer *buffer, size_t block_bytes,
+                           size_t count)
+    : buffer(buffer), blocks(count), filled(count), spare(count) {
+  for (size_t i=0; i<count; i++) {
+    blocks[i].data.resize(block_bytes);
+    spare.Push(i, OverflowPolicy::BLOCK);
+  }
+  thread = std::thread(&RefillThread::Run, this);
+}
+
+RefillThread::~RefillThread() {
+  running.store(false, std::memory_order_release);
+  iio_buffer_cancel(buffer);
+  thread.join();
+}
+
+/** Refill thread body. */
+void RefillThread::Run() {
+  while (running.load(std::memory_order_acquire)) {
+    ssize_t nread = iio_buffer_refill(buffer);
+    if (nread < 0) {
+      error.store(static_cast<int>(-nread), std::memory_order_release);
+      Notify();
+      return;
+    }
+
+    uint64_t first_scan = next_scan;
+    next_scan += nread / iio_buffer_step(buffer);
+
+    size_t index;
+    if (!spare.Pop(index)) {
+      overflows.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    ScanBlock &block = blocks[index];
+    block.time_us = TimeMicroseconds();
+    block.first_scan = first_scan;
+    block.bytes = std::min<size_t>(nread, block.data.size());
+    std::memcpy(block.data.data(), iio_buffer_start(buffer), block.bytes);
+
+    size_t now = depth.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (now > max_depth.load(std::memory_order_relaxed))
+      max_depth.store(now, std::memory_order_relaxed);
+    filled.Push(index, OverflowPolicy::BLOCK);
+    Notify();
+  }
+}
+
+/** Wake the processing thread if it waits for a block. */
+void RefillThread::Notify() {
+  // Lock so the wakeup cannot fall between its check and its wait
+  std::lock_guard<std::mutex> lock(mutex);
+  notified = true;
+  ready.notify_one();
+}
+
+ScanBlock* RefillThread::Next() {
+  size_t index;
+  for (;;) {
+    // Read the error before the queue so no block is left behind
+    bool failed = Error() != 0;
+    if (filled.Pop(index)) {
+      depth.fetch_sub(1, std::memory_order_relaxed);
+      return &blocks[index];
+    }
+    if (failed)
+      return nullptr;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [this] {return notified;});
+    notified = false;
+  }
+}
+
+void RefillThread::Release(ScanBlock *block) {
+  spare.Push(block - blocks.data(), OverflowPolicy::BLOCK);
+}
+
+}// namespace fdas
@@ -0,0 +1,102 @@
+#ifndef FDAS_DEVICES_IIO_REFILL_HPP_
+#define FDAS_DEVICES_IIO_REFILL_HPP_
+
+/**
+ * Pipelined refilling of iio buffers.
+ */
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <iio.h>
+
+#include "common/async.hpp"
+
+
+namespace fdas {
+
+/** Copy of the scans of a refilled iio buffer. */
+struct ScanBlock {
+  std::vector<char> data;
+  size_t bytes = 0;        /**< Size of the scans in the block. */
+  uint64_t time_us = 0;    /**< Time of the refill, microseconds since epoch. */
+  uint64_t first_scan = 0; /**< Index of the first scan, counting drops. */
+};
+
+/**
+ * Thread refilling an iio buffer ahead of the processing.
+ *
+ * The thread only refills the buffer and copies the scans to one of
+ * `count` preallocated blocks, handed to the processing thread through a
+ * queue and given back when processed, so refilling and processing overlap
+ * and a slow sink write does not leave the kernel buffer unread. When all
+ * blocks are in flight, the refilled scans are dropped and counted as an
+ * overflow. The processing thread sleeps on a condition variable until the
+ * refill thread hands it a block or fails.
+ */
+class RefillThread {
+  struct iio_buffer *buffer;
+  std::vector<ScanBlock> blocks;
+  SpscRing<size_t> filled;  /**< Blocks waiting to be processed. */
+  SpscRing<size_t> spare;   /**< Blocks free for the next refill. */
+
+  std::atomic<bool> running{true};
+  std::atomic<int> error{0};
+  std::atomic<size_t> depth{0};
+  std::atomic<size_t> max_depth{0};
+  std::atomic<uint64_t> overflows{0};
+  uint64_t next_scan = 0;   /**< Index of the next scan, refill thread only. */
+
+  /** Wakes the processing thread on new blocks and errors. */
+  std::mutex mutex;
+  std::condition_variable ready;
+  bool notified = false;
+  std::thread thread;
+
+  void Run();
+  void Notify();
+
+ public:
+  /**
+   * Start refilling.
+   * @param block_bytes Size of the refilled buffer, samples times step.
+   * @param count Number of blocks in flight.
+   */
+  RefillThread(struct iio_buffer *buffer, size_t block_bytes, size_t count);
+
+  /** Cancel the pending refill and stop the thread. */
+  ~RefillThread();
+
+  /**
+   * Wait for the next refilled block.
+   * @return the block, or null once refilling failed and all blocks were
+   *   processed, with the error number in Error().
+   */
+  ScanBlock* Next();
+
+  /** Give a processed block back for refilling. */
+  void Release(ScanBlock *block);
+
+  int Error() const {return error.load(std::memory_order_acquire);}
+
+  /** Number of refilled blocks waiting to be processed. */
+  size_t Depth() const {return depth.load(std::memory_order_relaxed);}
+
+  /** Largest depth reached. */
+  size_t MaxDepth() const {return max_depth.load(std::memory_order_relaxed);}
+
+  /** Number of refills dropped because all blocks were in flight. */
+  uint64_t Overflows() const {
+    return overflows.load(std::memory_order_relaxed);
+  }
+};
+
+}// namespace fdas
+
+#endif//FDAS_DEVICES_IIO_REFILL_HPP_
@@ -18,7 +18,8 @@
 #include <time.h>
 #include <unistd.h>
 
-#include "../../utils/utils.h"
+#include "common/utils.h"
+#include "common/logrotate.h"
 
 #include "generated/vcmdas1_messages/mavlink.h"
 
@@ -61,6 +62,19 @@ static char args_doc[] = "[BASE_ADDRESS]";
 static struct argp_option options[] = {
     {"logtxt", 't', "FILE", 0, "Write received data as text to FILE"},
     {"logbin", 'b', "FILE", 0, "Write binary MAVLink stream FILE"},
+    {"logseg", 's', "PREFIX", 0,
+     "Write binary MAVLink stream to preallocated memory-mapped segments "
+     "PREFIX.NNNNNN"},
+    {"segment-size", 'S', "MIB", 0,
+     "Size of each log segment in MiB, defaults to 64"},
+    {"logblk", 'k', "FILE", 0,
+     "Write binary MAVLink stream to crash-safe checksummed block log FILE"},
+    {"commit-ms", 'C', "MS", 0,
+     "Longest time data waits to be flushed to the block log, defaults "
+     "to 100"},
+    {"commit-kib", 'K', "KIB", 0,
+     "Amount of data flushed at least together to the block log, defaults "
+     "to 64"},
     {"verbose", 'v', 0, 0, "Write received data as text to STDOUT"},
     {"udp", 'u', "HOST", OPTION_ARG_OPTIONAL,
      "Send MAVLink messages via UDP to HOST, defaults to 224.0.0.1"},
@@ -74,6 +88,11 @@ typedef struct arguments {
     unsigned base_address;
     char *text_log;
     char *binary_log;
+    char *segment_log;
+    size_t segment_size;
+    char *block_log;
+    unsigned commit_ms;
+    size_t commit_bytes;
     bool verbose;
     bool use_udp;
     char *udp_host;
@@ -83,8 +102,7 @@ typedef struct arguments {
 /** Program output streams structure */
 typedef struct output_streams {
     int udp_sock;
-    FILE *binary_log;
-    FILE *text_log;
+    log_files_t logs;
 } output_streams_t;
 
 
@@ -106,6 +124,44 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         arguments->binary_log = arg;
         break;
 
+    case 's':
+        arguments->segment_log = arg;
+        break;
+
+    case 'S':
+        {
+            char *endptr = 0;
+            unsigned long segment_size = strtoul(arg, &endptr, 0);
+            if (*endptr || !segment_size)
+                argp_error(state, "MIB argument must be a positive integer.");
+            arguments->segment_size = (size_t) segment_size << 20;
+        }
+        break;
+
+    case 'k':
+        arguments->block_log = arg;
+        break;
+
+    case 'C':
+        {
+            char *endptr = 0;
+            unsigned long commit_ms = strtoul(arg, &endptr, 0);
+            if (*endptr)
+                argp_error(state, "MS argument must be an integer.");
+            arguments->commit_ms = commit_ms;
+        }
+        break;
+
+    case 'K':
+        {
+            char *endptr = 0;
+            unsigned long commit_kib = strtoul(arg, &endptr, 0);
+            if (*endptr)
+                argp_error(state, "KIB argument must be an integer.");
+            arguments->commit_bytes = (size_t) commit_kib << 10;
+        }
+        break;
+
     case 'u':
         arguments->use_udp = true;
         if (arg)
@@ -152,33 +208,30 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
 static struct argp argp = {options, parse_opt, args_doc, doc};
 
 
+/**
+ * Print the text log file header.
+ */
+void print_text_header(FILE *text_log) {
+    if (fprintf(text_log, "%% time[us]\t") < 0)
+        syslog(LOG_ERR, "Error writing to text log: %s", strerror(errno));
+    for (int i=0; i<0; i++)
+        if (fprintf(text_log, "channel%d\t", i) < 0)
+            syslog(LOG_ERR,"Error writing to text log: %s",strerror(errno));
+}
+
+
 /**
  * Open the program output streams
  */
-void open_output_streams(arguments_t *args, output_streams_t *out) {
-    // Open text log
-    if (args->text_log) {
-	out->text_log = fopen(args->text_log, "w");
-	if (!out->text_log) {
-	    syslog(LOG_ERR, "Error opening text log: %s", strerror(errno));
-	    exit(EXIT_FAILURE);
-	}
-        // Print file header
-        if (fprintf(out->text_log, "%% time[us]\t") < 0)
-            syslog(LOG_ERR, "Error writing to text log: %s", strerror(errno));
-        for (int i=0; i<0; i++)
-            if (fprintf(out->text_log, "channel%d\t", i) < 0)
-                syslog(LOG_ERR,"Error writing to text log: %s",strerror(errno));
-    }
-    
-    // Open binary log
-    if (args->binary_log) {
-	out->binary_log = fopen(args->binary_log, "w");
-	if (!out->binary_log) {
-	    syslog(LOG_ERR, "Error opening binary log: %s", strerror(errno));
-	    exit(EXIT_FAILURE);
-	}
-    }
+void open_output_streams(arguments_t *args, const log_config_t *log_config,
+                         output_streams_t *out) {
+    // Open the logs
+    if (log_files_open(log_config, 0, &out->logs))
+        exit(EXIT_FAILURE);
+
+    // Allocate the STDOUT buffer before the read loop
+    if (args->verbose)
+        preallocate_stream(stdout, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF);
     
     // Open UDP socket
     if (args->use_udp) {
@@ -239,9 +292,19 @@ void output_mavlink_msg(mavlink_message_t *msg, output_streams_t *out) {
     size_t len = mavlink_msg_to_send_buffer(buf, msg);
     
     // Output to binary log
-    if (out->binary_log)
-        if (!fwrite(buf, len, 1, out->binary_log))
+    if (out->logs.binary_log)
+        if (!fwrite(buf, len, 1, out->logs.binary_log))
 	    syslog(LOG_ERR, "Error writing to binary log: %s", strerror(errno));
+
+    // Output to segment log
+    if (out->logs.segment_log)
+        if (seglog_write(out->logs.segment_log, buf, len))
+            syslog(LOG_ERR, "Error writing to segment log");
+
+    // Output to block log
+    if (out->logs.block_log)
+        if (blocklog_write(out->logs.block_log, buf, len))
+            syslog(LOG_ERR, "Error writing to block log");
     
     // Output to UDP socket
     if (out->udp_sock > 0)
@@ -257,6 +320,16 @@ void output_adc_raw(const mavlink_adc_raw_t *adc, output_streams_t *out) {
 }
 
 
+/**
+ * Close the program output streams, flushing all logged data.
+ */
+void close_output_streams(output_streams_t *out) {
+    log_files_close(&out->logs);
+    if (out->udp_sock >= 0)
+        close(out->udp_sock);
+}
+
+
 /**
  * Whether the analog to digital conversion is done.
  */
@@ -288,7 +361,9 @@ void read_all(unsigned base_address, mavlink_adc_raw_t *adc) {
 int main(int argc, char **argv) {
     // Parse command line arguments
     arguments_t arguments = {
-        .base_address=0x3E0, .udp_host="224.0.0.1", .udp_port=38400
+        .base_address=0x3E0, .udp_host="224.0.0.1", .udp_port=38400,
+        .segment_size=64 << 20,
+        .commit_ms=100, .commit_bytes=64 << 10
     };
     output_streams_t output_streams = {.udp_sock=-1};
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
@@ -297,7 +372,19 @@ int main(int argc, char **argv) {
     openlog(0, LOG_PERROR, 0);
 
     // Open the output streams
-    open_output_streams(&arguments, &output_streams);
+    log_config_t log_config = {
+        .text_log=arguments.text_log, .binary_log=arguments.binary_log,
+        .segment_log=arguments.segment_log, .block_log=arguments.block_log,
+        .segment_size=arguments.segment_size,
+        .commit_ms=arguments.commit_ms, .commit_bytes=arguments.commit_bytes,
+        .text_header=print_text_header
+    };
+    open_output_streams(&arguments, &log_config, &output_streams);
+
+    // Open the logs of the rotations in a thread, off the sampling loop
+    logrotate_t *rotate = logrotate_start(&log_config);
+    if (!rotate)
+        exit(EXIT_FAILURE);
     
     // Request IO port permission
     ioperm(arguments.base_address, PORT_RANGE, 1);
@@ -312,10 +399,14 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
     
-    // Block SIGALRM
+    // Block SIGALRM and the control signals, taken by sigwait: SIGHUP
+    // requests the rotation of the logs, SIGTERM and SIGINT closing them
     sigset_t alrmset;
     sigemptyset(&alrmset);
     sigaddset(&alrmset, SIGALRM);
+    sigaddset(&alrmset, SIGHUP);
+    sigaddset(&alrmset, SIGTERM);
+    sigaddset(&alrmset, SIGINT);
     sigprocmask(SIG_BLOCK, &alrmset, NULL);
     
     // Fire the timer
@@ -335,7 +426,18 @@ int main(int argc, char **argv) {
         if (sigwait(&alrmset, &sig))
             syslog(LOG_ERR, "Error in sigwait: %s", strerror(errno));
 
-        // Read from the ADC
+        // Close the logs and exit between two samples
+        if (sig == SIGTERM || sig == SIGINT)
+            break;
+
+        // Request the rotation of the logs, switched when they are open
+        if (sig == SIGHUP) {
+            logrotate_request(rotate);
+            continue;
+        }
+
+        // Read from the ADC, switching to the rotated logs between samples
+        logrotate_swap(rotate, &output_streams.logs);
         mavlink_adc_raw_t adc;
         read_all(arguments.base_address, &adc);
         
@@ -343,11 +445,14 @@ int main(int argc, char **argv) {
         output_adc_raw(&adc, &output_streams);
 
         // Output text
-        log_text(&adc, output_streams.text_log);
+        log_text(&adc, output_streams.logs.text_log);
         if (arguments.verbose)
             log_text(&adc, stdout);
     }
-    
+
+    syslog(LOG_INFO, "Terminating, closing the logs");
+    logrotate_stop(rotate);
+    close_output_streams(&output_streams);
     return 0;
 }
 